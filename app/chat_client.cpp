@@ -1,8 +1,12 @@
 #include "net_client.hpp"
 #include "chat_constants.hpp"
 
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <mutex>
 #include <ncurses.h>
+#include <string>
 
 /*
 
@@ -34,6 +38,10 @@ by submitting "#help" in the input window.
 For example, there are commands to change the client's name, clear the output window,
 send a private message to another client, view the client list, and exit gracefully.
 
+The client follows the client list with #presence as soon as it connects (see chat_presence.hpp),
+keeps its own copy of the list up to date from the changes the server sends, and answers #clients
+from that copy instead of asking the server for it.
+
 */
 
 class chat_client : public application_client {
@@ -66,6 +74,7 @@ public:
 	
 	void start() {
 		application_client::start();
+		follow_presence();
 		write_loop();
 		io_thread_ptr_->join();
 	}
@@ -94,6 +103,10 @@ private:
 				application_client::stop();
 				return;
 			} else if (!strcmp(message, "#clients")) {
+				print_roster();
+			} else if (!strncmp(message, "#clients ", 9)) {
+				client_ptr_->send(message, strlen(message));
+			} else if (!strncmp(message, "#history ", 9)) {
 				client_ptr_->send(message, strlen(message));
 			} else {
 				wprintw(output_win, "Command \"%s\" not recognized.\n", message);
@@ -151,13 +164,33 @@ private:
 		wprintw(output_win, "#clients: ");
 		wattroff(output_win, A_BOLD);
 		wattroff(output_win, COLOR_PAIR(2));
-		wprintw(output_win, "Lists all currently connected clients.\n");
+		wprintw(output_win, "Lists all currently connected clients (from the list this client keeps).\n");
+		
+		// request one page of the client list
+		wattron(output_win, A_BOLD);
+		wattron(output_win, COLOR_PAIR(2));
+		wprintw(output_win, "#clients <page>: ");
+		wattroff(output_win, A_BOLD);
+		wattroff(output_win, COLOR_PAIR(2));
+		wprintw(output_win, "Lists one page of the connected clients, for when there are a lot of them.\n");
+		
+		// request older messages
+		wattron(output_win, A_BOLD);
+		wattron(output_win, COLOR_PAIR(2));
+		wprintw(output_win, "#history <count>: ");
+		wattroff(output_win, A_BOLD);
+		wattroff(output_win, COLOR_PAIR(2));
+		wprintw(output_win, "Shows the last <count> messages sent to the room.\n");
 		
 		wrefresh(output_win);
 		wrefresh(input_win);
 	}
 	
 	void read_handler(char* body, std::size_t length) {
+		if (length >= 9 && !strncmp(body, "#presence", 9)) {
+			apply_presence(body + 9, length - 9);
+			return;
+		}
 		wattron(output_win, A_BOLD);
 		wattron(output_win, COLOR_PAIR(1));
 		for (int i = 0; i < length; i++) {
@@ -172,9 +205,88 @@ private:
 		wrefresh(input_win);
 	}
 
+	void reconnect_handler(bool resumed) {
+		// if the server didn't remember us, we are back with the default name
+		if (resumed) {
+			wprintw(output_win, "Reconnected to the server.\n");
+		} else {
+			wprintw(output_win, "Reconnected to the server as a new client, use #name to set your name again.\n");
+			// the server forgot us, and with that that we were following the client list
+			{
+				std::scoped_lock lock(roster_mutex_);
+				roster_.clear();
+			}
+			follow_presence();
+		}
+		wrefresh(output_win);
+		wrefresh(input_win);
+	}
+
+	void follow_presence() {
+		client_ptr_->send("#presence", 9);
+	}
+	
+	void apply_presence(const char* changes, std::size_t length) {
+		// one "\n+<id> <name>", "\n-<id>" or "\n=<id> <name>" line per change
+		std::size_t joined = 0;
+		std::size_t left = 0;
+		std::string last; // the last change, for saying what happened when it's only one
+		{
+			std::scoped_lock lock(roster_mutex_);
+			std::size_t i = 0;
+			while (i < length) {
+				std::size_t end = i + 1;
+				while (end < length && changes[end] != '\n') {
+					end++;
+				}
+				if (end - i >= 3) {
+					char change = changes[i + 1];
+					std::string line(changes + i + 2, end - i - 2);
+					std::size_t space = line.find(' ');
+					std::size_t id = std::strtoull(line.c_str(), nullptr, 10);
+					std::string name = space == std::string::npos ? std::string() : line.substr(space + 1);
+					auto found = roster_.find(id);
+					if (change == '+') {
+						roster_[id] = name;
+						joined++;
+						last = name + " joined";
+					} else if (change == '-' && found != roster_.end()) {
+						last = found->second + " left";
+						roster_.erase(found);
+						left++;
+					} else if (change == '=' && found != roster_.end()) {
+						last = found->second + " is now " + name;
+						found->second = name;
+					}
+				}
+				i = end;
+			}
+		}
+		if (joined + left > 1) {
+			wprintw(output_win, "server: %zu joined, %zu left.\n", joined, left);
+		} else if (!last.empty()) {
+			wprintw(output_win, "server: %s.\n", last.c_str());
+		}
+		wrefresh(output_win);
+		wrefresh(input_win);
+	}
+	
+	void print_roster() {
+		std::scoped_lock lock(roster_mutex_);
+		wprintw(output_win, "%zu connected:\n", roster_.size());
+		for (auto& entry : roster_) {
+			wprintw(output_win, "%s\n", entry.second.c_str());
+		}
+		wrefresh(output_win);
+		wrefresh(input_win);
+	}
+	
 	WINDOW *output_win;
 	WINDOW *input_win;
 	std::size_t max_body_length_;
+	// the client list as the server last told it, id -> name, written by the io thread and read by #clients
+	std::mutex roster_mutex_;
+	std::map<std::size_t, std::string> roster_;
 };
 
 int main() {
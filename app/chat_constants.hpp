@@ -4,5 +4,32 @@
 
 #define MAX_NAME_LENGTH 12
 
+// how many of the room's last messages a client that joins is sent
+#define HISTORY_DEPTH 100
+// the most messages a #history command sends back
+#define MAX_HISTORY_QUERY 500
+
+// a #msg for a name nobody has is kept until somebody takes the name,
+// up to MAILBOX_BYTES for each name and for at most MAX_MAILBOXES names
+#define MAILBOX_BYTES (16 * 1024)
+#define MAX_MAILBOXES 1024
+
+// how long the server collects roster changes before sending them to the clients that follow them
+#define PRESENCE_WINDOW_MS 100
+
+// with --coalesce, chat lines that arrive within this many microseconds of each other
+// (or until there are this many bytes of them) go out to the room together
+#define COALESCE_WINDOW_US 2000
+#define COALESCE_BYTES (64 * 1024)
+
+// the words the server masks in chat lines, one per line, read again on SIGHUP
+#define FILTER_WORDS_PATH "chat_filter.txt"
+
+// where the server keeps the log of every message sent to the room
+#define LOG_DIRECTORY "chat_log"
+
+// a new chat_server started with --takeover connects here to take over from the running one
+#define HANDOFF_PATH "/tmp/chat_server.sock"
+
 
 #endif
\ No newline at end of file
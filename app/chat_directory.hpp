@@ -0,0 +1,357 @@
+#ifndef _CHAT_DIRECTORY_HPP_
+#define _CHAT_DIRECTORY_HPP_
+
+#include "chat_constants.hpp"
+#include "net_message.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+
+The list of clients that chat_server keeps, indexed by id and by name.
+
+The clients themselves are kept next to each other in one vector, in no particular order
+(removing one moves the last one into its place). Two open addressing hash tables point into it:
+one from a client's id to where the client is in the vector, and one from a name to the id of
+the client that has it. Finding a client, by either, and renaming one are a hash and a probe or two,
+however many clients there are.
+
+Names are at most MAX_NAME_LENGTH characters, so a name key is kept inside the table itself,
+padded with zeros to a fixed size, and comparing two keys is a fixed size memcmp instead of
+following a pointer to a string.
+
+Both tables use linear probing, stay at most half full, and move entries back into place when one
+is removed instead of leaving tombstones, so lookups never slow down as clients come and go.
+
+The directory also keeps the answer to #clients, already encoded. It's split into pages that each
+fit in one message, and it's only built again the first time it's asked for after a client has
+joined, left or changed its name, so every request in between is sent the same shared buffers
+(as a batch, see net_message.hpp) instead of the list being written out for each one.
+
+A client_directory isn't thread safe.
+
+*/
+
+class client {
+public:
+	client()
+	  : id_(0)
+	{
+		name[0] = '\0';
+	}
+	client(int id)
+	  : id_(id)
+	{
+		std::snprintf(name, sizeof(name), "Client%u", id_);
+	}
+
+	const char * get_name() const {
+		return name;
+	}
+
+	int get_id() const {
+		return id_;
+	}
+
+private:
+	friend class client_directory; // renaming has to go through the directory to keep the index right
+
+	void set_name(const char* new_name, std::size_t new_name_length) {
+		std::memcpy(name, new_name, new_name_length);
+		name[new_name_length] = '\0';
+	}
+
+	char name[MAX_NAME_LENGTH + 1];
+	int id_;
+};
+
+struct name_key {
+	// a name padded with zeros, names that are too long never make it into a key
+	enum { size = (MAX_NAME_LENGTH + 8) / 8 * 8 };
+
+	name_key() {
+		std::memset(bytes, 0, size);
+	}
+	name_key(const char* name, std::size_t length) {
+		std::memset(bytes, 0, size);
+		std::memcpy(bytes, name, length < size ? length : size);
+	}
+
+	bool operator==(const name_key& other) const {
+		return !std::memcmp(bytes, other.bytes, size);
+	}
+
+	std::uint64_t hash() const {
+		// FNV-1a
+		std::uint64_t h = 14695981039346656037ull;
+		for (std::size_t i = 0; i < size; i++) {
+			h = (h ^ static_cast<unsigned char>(bytes[i])) * 1099511628211ull;
+		}
+		return h;
+	}
+
+	char bytes[size];
+};
+
+template <typename Key>
+class flat_index {
+	// Key -> std::size_t, open addressing with linear probing. Key needs operator== and hash().
+public:
+	flat_index()
+	  : slots_(16), size_(0)
+	{}
+
+	const std::size_t* find(const Key& key) const {
+		for (std::size_t i = home(key); slots_[i].used; i = next(i)) {
+			if (slots_[i].key == key) {
+				return &slots_[i].value;
+			}
+		}
+		return nullptr;
+	}
+
+	void set(const Key& key, std::size_t value) {
+		if (2 * (size_ + 1) > slots_.size()) {
+			grow();
+		}
+		std::size_t i = home(key);
+		for (; slots_[i].used; i = next(i)) {
+			if (slots_[i].key == key) {
+				slots_[i].value = value;
+				return;
+			}
+		}
+		slots_[i].key = key;
+		slots_[i].value = value;
+		slots_[i].used = true;
+		size_++;
+	}
+
+	bool erase(const Key& key) {
+		std::size_t i = home(key);
+		for (; slots_[i].used; i = next(i)) {
+			if (slots_[i].key == key) {
+				break;
+			}
+		}
+		if (!slots_[i].used) {
+			return false;
+		}
+		// pulls back every entry after it that would no longer be found past the hole
+		for (std::size_t j = next(i); slots_[j].used; j = next(j)) {
+			std::size_t k = home(slots_[j].key);
+			bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+			if (!stays) {
+				slots_[i] = slots_[j];
+				i = j;
+			}
+		}
+		slots_[i].used = false;
+		size_--;
+		return true;
+	}
+
+	std::size_t size() const {
+		return size_;
+	}
+
+private:
+	struct slot {
+		Key key;
+		std::size_t value = 0;
+		bool used = false;
+	};
+
+	std::size_t home(const Key& key) const {
+		return key.hash() & (slots_.size() - 1);
+	}
+
+	std::size_t next(std::size_t i) const {
+		return (i + 1) & (slots_.size() - 1);
+	}
+
+	void grow() {
+		std::vector<slot> old(slots_.size() * 2);
+		old.swap(slots_);
+		size_ = 0;
+		for (auto& entry : old) {
+			if (entry.used) {
+				set(entry.key, entry.value);
+			}
+		}
+	}
+
+	std::vector<slot> slots_; // always a power of two
+	std::size_t size_;
+};
+
+struct id_key {
+	std::size_t id;
+
+	bool operator==(const id_key& other) const {
+		return id == other.id;
+	}
+
+	std::uint64_t hash() const {
+		// ids count up, so spread them over the table instead of filling it in order
+		std::uint64_t h = id * 11400714819323198485ull;
+		return h ^ (h >> 32);
+	}
+};
+
+class client_directory {
+public:
+	typedef std::vector<client>::iterator iterator;
+
+	// nullptr if a client with that id is already there
+	// a client starts out with the name Client<id>, unless somebody has already taken it,
+	// in which case it can't be found by name until it picks a name of its own
+	client* add(std::size_t id) {
+		if (ids_.find(id_key{ id })) {
+			return nullptr;
+		}
+		clients_.emplace_back(id);
+		ids_.set(id_key{ id }, clients_.size() - 1);
+		changed();
+		name_key key(clients_.back().get_name(), strlen(clients_.back().get_name()));
+		if (!names_.find(key)) {
+			names_.set(key, id);
+		}
+		return &clients_.back();
+	}
+
+	bool remove(std::size_t id) {
+		const std::size_t* found = ids_.find(id_key{ id });
+		if (!found) {
+			return false;
+		}
+		std::size_t position = *found;
+		forget_name(clients_[position]);
+		ids_.erase(id_key{ id });
+		if (position + 1 != clients_.size()) {
+			clients_[position] = clients_.back();
+			ids_.set(id_key{ static_cast<std::size_t>(clients_[position].get_id()) }, position);
+		}
+		clients_.pop_back();
+		changed();
+		return true;
+	}
+
+	client* find(std::size_t id) {
+		const std::size_t* found = ids_.find(id_key{ id });
+		return found ? &clients_[*found] : nullptr;
+	}
+
+	client* find(const char* name, std::size_t length) {
+		if (length > MAX_NAME_LENGTH) {
+			return nullptr;
+		}
+		const std::size_t* id = names_.find(name_key(name, length));
+		return id ? find(*id) : nullptr;
+	}
+
+	// false if somebody else already has the name, the caller checks that the name is valid
+	bool rename(std::size_t id, const char* name, std::size_t length) {
+		client* c = find(id);
+		name_key key(name, length);
+		const std::size_t* owner = names_.find(key);
+		if (!c || length > MAX_NAME_LENGTH || (owner && *owner != id)) {
+			return false;
+		}
+		forget_name(*c);
+		c->set_name(name, length);
+		names_.set(key, id);
+		changed();
+		return true;
+	}
+
+	// every page of the client list, as one batch
+	net_message roster() {
+		build_roster();
+		return net_message(roster_, roster_pages_.size());
+	}
+
+	std::size_t roster_pages() {
+		build_roster();
+		return roster_pages_.size();
+	}
+
+	// page is counted from 0 and must be less than roster_pages()
+	net_message roster_page(std::size_t page) {
+		build_roster();
+		return net_message(roster_pages_[page], 1);
+	}
+
+	std::size_t size() const {
+		return clients_.size();
+	}
+
+	iterator begin() {
+		return clients_.begin();
+	}
+
+	iterator end() {
+		return clients_.end();
+	}
+
+	// goes up every time a client joins, leaves or changes its name
+	std::uint64_t version() const {
+		return version_;
+	}
+
+private:
+	void changed() {
+		version_++;
+		roster_ = nullptr;
+	}
+
+	void build_roster() {
+		// a page is "\n" and then one "<name>\n" line per client, as many as fit in a message
+		if (roster_) {
+			return;
+		}
+		roster_pages_.clear();
+		std::string all;
+		std::string page = "\n";
+		auto finish_page = [&]() {
+			net_message msg(page.data(), page.length());
+			roster_pages_.push_back(std::make_shared<const std::string>(msg.get_frame_data(), msg.get_frame_length()));
+			all.append(msg.get_frame_data(), msg.get_frame_length());
+			page = "\n";
+		};
+		for (auto& c : clients_) {
+			std::size_t length = strlen(c.get_name());
+			if (page.length() + length + 1 > net_message::max_body_length) {
+				finish_page();
+			}
+			page.append(c.get_name(), length);
+			page += '\n';
+		}
+		finish_page();
+		roster_ = std::make_shared<const std::string>(std::move(all));
+	}
+
+	void forget_name(const client& c) {
+		// only if the name is really this client's (see add)
+		name_key key(c.get_name(), strlen(c.get_name()));
+		const std::size_t* owner = names_.find(key);
+		if (owner && *owner == static_cast<std::size_t>(c.get_id())) {
+			names_.erase(key);
+		}
+	}
+
+	std::vector<client> clients_;
+	flat_index<id_key> ids_; // id -> position in clients_
+	flat_index<name_key> names_; // name -> id
+	// the encoded #clients pages, null once they're out of date
+	std::shared_ptr<const std::string> roster_;
+	std::vector<std::shared_ptr<const std::string>> roster_pages_;
+	std::uint64_t version_ = 0;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _CHAT_MAILBOX_HPP_
+#define _CHAT_MAILBOX_HPP_
+
+#include "net_message.hpp"
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+/*
+
+The offline mailboxes used by chat_server.
+
+A #msg for a name that nobody has right now is kept in that name's mailbox, and whoever
+next takes the name is sent everything in it. A mailbox keeps its messages already encoded,
+one after another in a single buffer, so storing a message is one append, and delivering the
+mailbox hands that same buffer to the connection as a batch (see net_message.hpp) which goes
+out in one write, without copying the messages again.
+
+Each mailbox holds at most max_bytes of messages, and there are at most max_mailboxes of them,
+so nobody can fill up the server's memory by messaging names that will never show up.
+
+A mailbox_store isn't thread safe, chat_server only uses it from its read_handler.
+
+*/
+
+class mailbox_store {
+public:
+	enum store_result { stored = 0, mailbox_full, too_many_mailboxes };
+
+	mailbox_store(std::size_t max_bytes, std::size_t max_mailboxes)
+	  : max_bytes_(max_bytes), max_mailboxes_(max_mailboxes) {
+	}
+
+	store_result store(const std::string& name, const net_message& msg) {
+		auto found = mailboxes_.find(name);
+		if (found == mailboxes_.end()) {
+			if (mailboxes_.size() >= max_mailboxes_) {
+				return too_many_mailboxes;
+			}
+			found = mailboxes_.emplace(name, mailbox()).first;
+		}
+		mailbox& box = found->second;
+		if (box.frames.size() + msg.get_frame_length() > max_bytes_) {
+			return mailbox_full;
+		}
+		box.frames.append(msg.get_frame_data(), msg.get_frame_length());
+		box.count++;
+		return stored;
+	}
+
+	// everything waiting for name as one batch, which is empty if nothing is
+	net_message take(const std::string& name) {
+		auto found = mailboxes_.find(name);
+		if (found == mailboxes_.end()) {
+			return net_message(std::shared_ptr<const std::string>(), 0);
+		}
+		net_message batch(std::make_shared<const std::string>(std::move(found->second.frames)), found->second.count);
+		mailboxes_.erase(found);
+		return batch;
+	}
+
+	// "<name> <count> <length>\n" followed by the frames, for every mailbox (for a hot restart)
+	std::string save() const {
+		std::stringstream ss;
+		for (auto& entry : mailboxes_) {
+			ss << entry.first << ' ' << entry.second.count << ' ' << entry.second.frames.length() << '\n' << entry.second.frames;
+		}
+		return ss.str();
+	}
+
+	void restore(const std::string& state) {
+		std::stringstream ss(state);
+		std::string name;
+		std::size_t count;
+		std::size_t length;
+		while (ss >> name >> count >> length && mailboxes_.size() < max_mailboxes_) {
+			mailbox box;
+			box.frames.resize(length);
+			ss.get();
+			if (!ss.read(&box.frames[0], length)) {
+				break;
+			}
+			box.count = count;
+			mailboxes_[name] = std::move(box);
+		}
+	}
+
+private:
+	struct mailbox {
+		std::string frames; // the encoded messages, oldest first
+		std::size_t count = 0;
+	};
+
+	std::size_t max_bytes_;
+	std::size_t max_mailboxes_;
+	std::unordered_map<std::string, mailbox> mailboxes_;
+};
+
+#endif
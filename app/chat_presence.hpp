@@ -0,0 +1,213 @@
+#ifndef _CHAT_PRESENCE_HPP_
+#define _CHAT_PRESENCE_HPP_
+
+#include "net_server.hpp"
+#include "chat_constants.hpp"
+#include "chat_directory.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+/*
+
+Roster updates for chat_server's clients.
+
+A client that sends #presence is sent the whole client list once, and from then on only what
+changes: who joined, who left and who changed their name, by id, so that it can keep a copy
+of the list of its own (chat_client does, and answers #clients from it without asking the server).
+chat_server stops sending a subscribed client the "server: ... connected" style lines, since the
+changes say the same thing.
+
+A presence frame is a data frame whose body is "#presence" followed by one line per change:
+	+<id> <name>   joined (the first list is all joins)
+	-<id>          left
+	=<id> <name>   changed their name
+Applying a join for an id that's already in the list, or a leave for one that isn't, has to be
+harmless, because changes that were already on their way can overlap with the first list.
+
+Changes aren't sent as they happen. The first one opens a window of PRESENCE_WINDOW_MS,
+and everything that changes within it goes out together when it closes: as many changes to a frame
+as fit, and all of the frames to every subscriber as one batch (see net_message.hpp), so a burst
+of a thousand joins is a handful of frames and one write per subscriber. Changes to one client
+within a window are merged, a client that joins and leaves again within it isn't sent at all.
+
+*/
+
+class presence_encoder {
+	// packs changes into presence frames and hands them all over as one batch
+public:
+	void add(char change, std::size_t id, const char* name) {
+		char line[64];
+		int length = name ? std::snprintf(line, sizeof(line), "\n%c%zu %s", change, id, name)
+		                  : std::snprintf(line, sizeof(line), "\n%c%zu", change, id);
+		if (!page_.empty() && page_.length() + length > net_message::max_body_length) {
+			finish_page();
+		}
+		if (page_.empty()) {
+			page_ = "#presence";
+		}
+		page_.append(line, length);
+	}
+
+	net_message finish() {
+		if (!page_.empty()) {
+			finish_page();
+		}
+		net_message batch(std::make_shared<const std::string>(std::move(frames_)), count_);
+		frames_.clear();
+		count_ = 0;
+		return batch;
+	}
+
+private:
+	void finish_page() {
+		net_message msg(page_.data(), page_.length());
+		frames_.append(msg.get_frame_data(), msg.get_frame_length());
+		count_++;
+		page_.clear();
+	}
+
+	std::string page_;
+	std::string frames_;
+	std::size_t count_ = 0;
+};
+
+class presence_feed {
+public:
+	enum change_type : char { joined_change = '+', left_change = '-', renamed_change = '=' };
+
+	presence_feed(std::shared_ptr<net_server> server, std::chrono::milliseconds window)
+	  : server_(server), window_(window), timer_(0), snapshot_version_(std::numeric_limits<std::uint64_t>::max()) {
+	}
+
+	~presence_feed() {
+		if (timer_) {
+			server_->get_timer_wheel().cancel(timer_);
+		}
+	}
+
+	// sends id the whole list and then keeps it up to date
+	void subscribe(std::size_t id, client_directory& clients) {
+		net_message snapshot;
+		{
+			std::scoped_lock lock(mutex_);
+			if (snapshot_version_ != clients.version()) {
+				// only built again once somebody has joined, left or changed their name since the last one
+				presence_encoder encoder;
+				for (auto& c : clients) {
+					encoder.add(joined_change, c.get_id(), c.get_name());
+				}
+				snapshot_ = encoder.finish();
+				snapshot_version_ = clients.version();
+			}
+			snapshot = snapshot_;
+			subscribers_.insert(id);
+		}
+		server_->send_to(id, snapshot);
+	}
+
+	void unsubscribe(std::size_t id) {
+		std::scoped_lock lock(mutex_);
+		subscribers_.erase(id);
+	}
+
+	bool subscribed(std::size_t id) {
+		std::scoped_lock lock(mutex_);
+		return subscribers_.count(id) > 0;
+	}
+
+	// the subscribers' ids, and the reverse, for carrying them over a hot restart
+	std::string save() {
+		std::scoped_lock lock(mutex_);
+		std::string ids;
+		for (std::size_t id : subscribers_) {
+			ids += std::to_string(id);
+			ids += ' ';
+		}
+		return ids;
+	}
+
+	void restore(const std::string& ids) {
+		std::scoped_lock lock(mutex_);
+		std::stringstream ss(ids);
+		std::size_t id;
+		while (ss >> id) {
+			subscribers_.insert(id);
+		}
+	}
+
+	void joined(std::size_t id, const char* name) {
+		change_to(id, joined_change, name);
+	}
+
+	void left(std::size_t id) {
+		change_to(id, left_change, nullptr);
+	}
+
+	void renamed(std::size_t id, const char* name) {
+		change_to(id, renamed_change, name);
+	}
+
+private:
+	struct change {
+		change_type type;
+		char name[MAX_NAME_LENGTH + 1];
+	};
+
+	void change_to(std::size_t id, change_type type, const char* name) {
+		std::scoped_lock lock(mutex_);
+		auto found = pending_.find(id);
+		if (found != pending_.end() && found->second.type == joined_change) {
+			// nobody has been told about the join yet
+			if (type == left_change) {
+				pending_.erase(found);
+				return;
+			}
+			type = joined_change;
+		}
+		change& pending = pending_[id];
+		pending.type = type;
+		std::snprintf(pending.name, sizeof(pending.name), "%s", name ? name : "");
+		if (!timer_) {
+			timer_ = server_->get_timer_wheel().schedule(window_, [this]() { flush(); });
+		}
+	}
+
+	void flush() {
+		// sent to the subscribers after letting go of mutex_, because net_server calls
+		// subscribed() from send_to_all with its own mutex held
+		net_message batch;
+		{
+			std::scoped_lock lock(mutex_);
+			timer_ = 0;
+			if (pending_.empty()) {
+				return;
+			}
+			presence_encoder encoder;
+			for (auto& entry : pending_) {
+				encoder.add(entry.second.type, entry.first, entry.second.type == left_change ? nullptr : entry.second.name);
+			}
+			pending_.clear();
+			batch = encoder.finish();
+		}
+		server_->send_to_all(batch, [this](std::size_t id) { return subscribed(id); });
+	}
+
+	std::shared_ptr<net_server> server_;
+	std::chrono::milliseconds window_;
+	std::mutex mutex_;
+	std::map<std::size_t, change> pending_; // merged changes waiting for the window to close, by id
+	std::unordered_set<std::size_t> subscribers_;
+	net_timer_wheel::handle timer_; // 0 while no window is open
+	net_message snapshot_; // the whole list as joins, for new subscribers
+	std::uint64_t snapshot_version_;
+};
+
+#endif
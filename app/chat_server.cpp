@@ -1,6 +1,17 @@
 #include "net_server.hpp"
+#include "net_log.hpp"
+#include "net_coalescer.hpp"
+#include "net_text.hpp"
+#include "net_filter.hpp"
+#include "net_pipeline.hpp"
 #include "chat_constants.hpp"
+#include "chat_mailbox.hpp"
+#include "chat_directory.hpp"
+#include "chat_presence.hpp"
 
+#include <boost/asio/thread_pool.hpp>
+
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <ncurses.h>
@@ -16,7 +27,8 @@ The application can send messages to clients using the net_server::send_to() fun
 or any of its variants (send_to_all, send_to_all_except).
 
 Even though the net_server object will maintain a list of active connections,
-this chat_server class will also maintain its own list of active clients.
+this chat_server class will also maintain its own list of active clients,
+indexed by id and by name (see chat_directory.hpp).
 
 Each client has a unique id that will be the same within the net_server's connection list as well.
 Each client also has a unique name that the net_server object doesn't concern itself with.
@@ -28,73 +40,134 @@ and commands.
 Anytime a client sends a normal message, the server will add the client's name to the message
 then send the message back out to every client.
 
+Because of that fan out, each client is rate limited by the library (see net_rate_limiter.hpp).
+A client sending faster than the limit has its reads delayed rather than its messages dropped.
+If the clients together fall too far behind on receiving, the server stops reading from all of
+them until the backlog drains (see outbound_state in net_server.hpp).
+
+A new build of the server can replace a running one without disconnecting anybody.
+Starting it with --takeover makes it connect to the running server through HANDOFF_PATH,
+which hands over its listening socket, every connection and the list of client names
+(see net_handoff.hpp). The old server exits once the handoff is done.
+
+Clients that lose their connection reconnect on their own and resume their session
+(see session_options in net_server.hpp). Until the session's grace period runs out the
+client still counts as connected, so nobody sees it leave and rejoin.
+
+The room keeps its last HISTORY_DEPTH messages (see net_history.hpp), and a client that joins
+is sent all of them at once before anything else, so it doesn't walk into the middle of a
+conversation. The history goes along with a hot restart.
+
+Everything sent to the room is also written to a log on disk in LOG_DIRECTORY (see net_log.hpp),
+by a thread of the log's own, so a slow disk never holds up the room. A server that starts up
+fills the room's history back in from the log, and #history <count> reads further back than the
+history goes. That read is done on a thread of its own (history_pool_), the io_context only gets
+the finished batch to send.
+
+A #msg for a name that isn't connected is kept in that name's mailbox (see chat_mailbox.hpp)
+and sent, all at once, to whichever client next changes its name to it.
+
+A client can follow the client list with #presence instead of asking for it with #clients
+(see chat_presence.hpp). It's sent the list once and then batches of changes, and isn't sent
+the lines announcing joins, leaves and name changes anymore.
+
+Started with --coalesce, the server holds chat lines back for up to COALESCE_WINDOW_US and sends
+everything that arrived in that time to each client as one batch (see net_coalescer.hpp), which in a busy
+room is a lot fewer writes for a couple of milliseconds of delay. set_coalescing turns it on or off
+while the server runs.
+
+Every message goes through a pipeline of stages (see net_pipeline.hpp) instead of one big
+read_handler: checking the UTF-8, handling commands, filtering and sending chat lines to the room.
+Everything a client sends has to be valid UTF-8, anything else is turned away instead of being
+passed on to the room. Names and commands are checked with the functions in net_text.hpp, which look
+at a whole vector of bytes at a time.
+
+Chat lines go through a content filter before they are sent to the room (see net_filter.hpp):
+words from FILTER_WORDS_PATH are masked with '*', and a client repeating one of its last few lines
+is told so instead of the room hearing it again. Sending the server SIGHUP reads the word list again,
+without stopping the room while the new list is built.
+
 The ncurses library is used for the chatroom, however the server doesn't actually do much with it.
 It is used more extensively by the client.
 
 */
 
-class client {
+class chat_server : public application_server {
 public:
-	client()
-	  : valid_(false)
-	{}
-	client(int id)
-	  : id_(id), valid_(true)
-	{
-		sprintf(name, "Client%u", id_);
-	}
-	
-	const char * get_name() const {
-		return name;
-	}
-	
-	void set_name(const char* new_name, std::size_t new_name_length) {
-		std::memcpy(name, new_name, new_name_length);
-		name[new_name_length] = '\0';
+	chat_server(std::size_t port, const handoff_state* takeover = nullptr, std::size_t history_depth = HISTORY_DEPTH)
+	  : application_server(port, 1, takeover), history_(history_depth), log_(log_settings()),
+	    mailboxes_(MAILBOX_BYTES, MAX_MAILBOXES), presence_(server_ptr_, std::chrono::milliseconds(PRESENCE_WINDOW_MS)),
+	    room_(io_context_, server_ptr_), reload_signal_(io_context_, SIGHUP), history_pool_(1),
+	    inbound_(utf8_stage(), command_stage(this), filter_stage(filter_), say_stage(this)) {
+		// every chat line is sent to every client, so keep any single client from flooding the room
+		rate_limit_options limits;
+		limits.enabled = true;
+		limits.messages_per_second = 10;
+		limits.message_burst = 20;
+		limits.bytes_per_second = 8 * 1024;
+		limits.byte_burst = 16 * 1024;
+		limits.policy = rate_limit_options::delay;
+		server_ptr_->set_rate_limit(limits);
+		// stop reading from everyone while the room is more than 16MB behind on sending
+		server_ptr_->set_flow_control(16 * 1024 * 1024, 8 * 1024 * 1024);
+		// a client that drops out and comes back within the grace period keeps its name and misses nothing
+		session_options sessions;
+		sessions.enabled = true;
+		server_ptr_->set_session(sessions);
+		goodbye_message_ = "server: The server is shutting down.";
+		if (takeover) {
+			restore_state(takeover->application);
+		} else {
+			// nothing is being served yet, and the history has to be filled in before anyone joins
+			log_.read_last(history_depth, [this](const log_record& record) {
+				history_.append(net_message(record.frame + net_message::header_length,
+				                            record.frame_length - net_message::header_length));
+			});
+		}
+		enable_hot_restart(HANDOFF_PATH, true);
+		if (std::ifstream(FILTER_WORDS_PATH)) {
+			filter_.reload(FILTER_WORDS_PATH);
+		}
+		wait_for_reload();
 	}
 	
-	int get_id() const {
-		return id_;
+	void set_coalescing(const coalesce_options& options) {
+		room_.set_options(options);
 	}
 	
-private:
-	char name[MAX_NAME_LENGTH + 1];
-	int id_;
-	bool valid_;
-};
-
-class chat_server : public application_server {
-public:
-	chat_server(std::size_t port)
-	  : application_server(port)
-	{}
-	
 	void accept_handler(std::size_t client_id, bool connect) {
 		std::scoped_lock lock(clients_mutex_);
 		if (connect) {
-			clients_.emplace_back(client_id);
+			client* client_ptr = clients_.add(client_id);
 			printw("New client connected with id: %d\n", client_id);
+			// catch the new client up on the conversation so far, the lines still waiting
+			// for the window are already in the history, so they mustn't reach it twice
+			room_.flush([client_id](std::size_t id) { return id != client_id; });
+			server_ptr_->send_to(client_id, history_.replay());
+			if (client_ptr) {
+				presence_.joined(client_id, client_ptr->get_name());
+			}
 			std::stringstream ss;
 			ss << "server: " << "New client connected with id " << client_id << ".";
 			const std::string& tmp = ss.str();
 			const char* reply = tmp.c_str();
-			server_ptr_->send_to_all_except(client_id, reply, tmp.length());
+			announce(reply, tmp.length(), client_id);
 			refresh();
 		} else {
-			clients_.remove_if([this,client_id](const client &client_){ 
-				if (client_.get_id() == client_id) {
-					printw("Client %d (%s) disconnected.\n", client_id, client_.get_name());
-					refresh();
-					std::stringstream ss;
-					ss << "server: " << client_.get_name() << " has disconnected.";
-					const std::string& tmp = ss.str();
-					const char* reply = tmp.c_str();
-					server_ptr_->send_to_all(reply, tmp.length());
-					return true;
-				} else {
-					return false;
-				}
-			});
+			client* client_ptr = clients_.find(client_id);
+			if (client_ptr) {
+				printw("Client %d (%s) disconnected.\n", client_id, client_ptr->get_name());
+				refresh();
+				std::stringstream ss;
+				ss << "server: " << client_ptr->get_name() << " has disconnected.";
+				const std::string& tmp = ss.str();
+				const char* reply = tmp.c_str();
+				clients_.remove(client_id);
+				presence_.unsubscribe(client_id);
+				presence_.left(client_id);
+				filter_.forget(client_id);
+				announce(reply, tmp.length());
+			}
 		}
 		//std::cout << "New client with id: " << client_id << std::endl;
 	}
@@ -104,127 +177,185 @@ public:
 		// where clients[sender] will be the connection that sent the message
 		// body will be a pointer to the start of the body of the message
 		// and length will be the length of the body 
-		// we will process the message here and decide if / what to send in response
+		// the message goes through the stages of inbound_, which decide if / what to send in response
 		// (for example, in a chat server, we'd want to forward the message to every client
 		// with the name of the sender attached to it so that clients can update the chat dialogue)
-		if (body[0] == '#') {
-			// could be a command that we need to process
-			if (!strncmp(body, "#name ", 6)) {
-				// user requesting a name change
-				// let's make sure the name they want is valid
-				char* name = body + 6;
-				std::size_t name_length = strlen(name);
-				if (name_length == 0) {
-					printw("Client %u attempted to change their name to an empty string which is not allowed.\n", sender);
-					char reply[] = "server: Cannot change your name to the empty string";
+		net_frame frame{ sender, body, length };
+		if (!inbound_(frame) && frame.rejected) {
+			printw("Turned away a message from client %u: %s\n", sender, frame.rejected);
+			std::string reply = std::string("server: ") + frame.rejected;
+			server_ptr_->send_to(sender, reply.c_str(), reply.length());
+			refresh();
+		}
+	}
+private:
+	enum command_type { unknown_command = 0, name_command, msg_command, clients_command, presence_command, history_command };
+	
+	static command_type parse_command(const char* word, std::size_t length) {
+		static const struct {
+			const char* word;
+			std::size_t length;
+			command_type command;
+		} commands[] = {
+			{ "#name", 5, name_command },
+			{ "#msg", 4, msg_command },
+			{ "#clients", 8, clients_command },
+			{ "#presence", 9, presence_command },
+			{ "#history", 8, history_command }
+		};
+		for (auto& entry : commands) {
+			if (entry.length == length && !std::memcmp(entry.word, word, length)) {
+				return entry.command;
+			}
+		}
+		return unknown_command;
+	}
+	
+	// the stages of inbound_ (see net_pipeline.hpp): anything that isn't valid UTF-8 is turned away,
+	// commands are handled here, and whatever is left is a chat line that goes through the filter
+	// and then to the room
+	
+	stage_result handle_command(net_frame& frame) {
+		std::size_t sender = frame.client;
+		char* body = frame.body;
+		std::size_t length = frame.length;
+		if (body[0] != '#') {
+			return stage_result::next;
+		}
+		// could be a command that we need to process
+		// the command is everything up to the first space, and its argument everything after it
+		std::size_t command_length = text_find(body, length, ' ');
+		char* argument = body + (command_length < length ? command_length + 1 : length);
+		std::size_t argument_length = length - (argument - body);
+		command_type command = parse_command(body, command_length);
+		if (command == name_command) {
+			// user requesting a name change
+			// let's make sure the name they want is valid
+			char* name = argument;
+			std::size_t name_length = argument_length;
+			if (name_length == 0) {
+				printw("Client %u attempted to change their name to an empty string which is not allowed.\n", sender);
+				char reply[] = "server: Cannot change your name to the empty string";
+				server_ptr_->send_to(sender, reply, strlen(reply));
+			} else if (name_length > MAX_NAME_LENGTH) {
+				printw("Client %u attempted to change their name to a name that is too long.\n", sender);
+				std::stringstream ss;
+				ss << "server: Name cannot exceed " << MAX_NAME_LENGTH << " characters.";
+				const std::string& tmp = ss.str();
+				const char* reply = tmp.c_str();
+				server_ptr_->send_to(sender, reply, tmp.length());
+			} else {
+				bool valid = text_is_identifier(name, name_length);
+				if (!valid) {
+					printw("Client %u attempted to change their name to a name with at least one non-alphanumeric character.\n", sender);
+					char reply[] = "server: Names can only contain letters and numbers.";
 					server_ptr_->send_to(sender, reply, strlen(reply));
-				} else if (name_length > MAX_NAME_LENGTH) {
-					printw("Client %u attempted to change their name to a name that is too long.\n", sender);
-					std::stringstream ss;
-					ss << "server: Name cannot exceed " << MAX_NAME_LENGTH << " characters.";
-					const std::string& tmp = ss.str();
-					const char* reply = tmp.c_str();
-					server_ptr_->send_to(sender, reply, tmp.length());
-				} else {
-					bool valid = true;
-					for (int i = 0; i < name_length; i++) {
-						if (!isalpha(name[i]) && !isdigit(name[i])) {
-							printw("Client %u attempted to change their name to a name with at least one non-alphanumeric character.\n", sender);
-							char reply[] = "server: Names can only contain letters and numbers.";
-							server_ptr_->send_to(sender, reply, strlen(reply));
-							valid = false;
-							break;
-						}
-					}
-					for (auto& client_ : clients_) {
-						if (!strcmp(name, client_.get_name())) {
-							printw("Client %u attempted to change their name to a name already in use by client %u.\n", sender, client_.get_id());
-							char reply[] = "server: Name change declined due to name already in use.";
-							server_ptr_->send_to(sender, reply, strlen(reply));
-							valid = false;
-							break;
-						}
-					}
-					if (valid) {
-						client* client_ptr = find_client(sender);
-						if (!client_ptr) {
-							printw("Client %u attempted to change their name, but they could not be found \
-									in the list of clients.\n", sender);
-						} else {
-							printw("Client %u has changed their name to %s.\n", sender, name);
-							std::stringstream ss;
-							ss << "server: " << client_ptr->get_name() << " has changed their name to " << name << ".";
-							const std::string& tmp = ss.str();
-							const char* reply = tmp.c_str();
-							client_ptr->set_name(name, name_length);
-							server_ptr_->send_to_all(reply, tmp.length());
-						}
-					}
 				}
-				refresh();
-			} else if (!strncmp(body, "#msg ", 5)) {
-				// #msg <target-name> <message>
-				// client trying to send a private message to another client
-				// first let's make sure they formatted the command properly
-				// while extracting the name of the client they are attempting to message
-				printw("Client %u: %s\n", sender, body);
-				std::size_t name_start = 5;
-				std::size_t name_end = 5;
-				while (name_end < length && body[name_end] != ' ')
-					name_end++;
-				if (name_end == length || name_start+1 == name_end) {
-					printw("Client %u attempted to send a message, but didn't use the command properly.\n", sender);
-					char reply[] = "server: Command not executed properly. Must be #msg <target-name> <message>.";
+				client* owner = valid ? clients_.find(name, name_length) : nullptr;
+				if (owner) {
+					printw("Client %u attempted to change their name to a name already in use by client %u.\n", sender, owner->get_id());
+					char reply[] = "server: Name change declined due to name already in use.";
 					server_ptr_->send_to(sender, reply, strlen(reply));
-				} else {
-					std::size_t name_length = name_end - name_start;
-					char name[name_length+1];
-					std::memcpy(name, body+name_start, name_length);
-					name[name_length] = '\0';
-					bool found = false;
-					for (auto& client_ : clients_) {
-						// search for client with that name
-						if (!strcmp(name, client_.get_name())) {
-							// found client so let's send them the message
-							// first, we need to get the name of the sender
-							client* client_ptr = find_client(sender);
-							if (!client_ptr) {
-								printw("Client %u attempted to send a message, but they could not be found \
-									in the list of clients.\n", sender);
-							} else {
-								std::stringstream ss;
-								ss << client_ptr->get_name() << " (to " << client_.get_name() << "): " << body+name_end+1;
-								const std::string& tmp = ss.str();
-								const char* reply = tmp.c_str();
-								server_ptr_->send_to(client_.get_id(), reply, tmp.length());
-								server_ptr_->send_to(sender, reply, tmp.length());
-							}
-							found = true;
-							break;
-						}
+					valid = false;
+				}
+				if (valid) {
+					client* client_ptr = clients_.find(sender);
+					if (!client_ptr) {
+						printw("Client %u attempted to change their name, but they could not be found \
+								in the list of clients.\n", sender);
+					} else {
+						printw("Client %u has changed their name to %s.\n", sender, name);
+						std::stringstream ss;
+						ss << "server: " << client_ptr->get_name() << " has changed their name to " << name << ".";
+						const std::string& tmp = ss.str();
+						const char* reply = tmp.c_str();
+						clients_.rename(sender, name, name_length);
+						presence_.renamed(sender, name);
+						announce(reply, tmp.length());
+						// anything that was sent to the name while nobody had it
+						server_ptr_->send_to(sender, mailboxes_.take(name));
 					}
-					if (!found) {
-						// unable to find a client with the name specified by the msg command
-						char reply[] = "server: Unable to find a client with the name you specified.";
-						printw("Unable to find a client with the name specified in the #msg command.\n");
-						server_ptr_->send_to(sender, reply, strlen(reply));
+				}
+			}
+			refresh();
+		} else if (command == msg_command) {
+			// #msg <target-name> <message>
+			// client trying to send a private message to another client
+			// first let's make sure they formatted the command properly
+			// while extracting the name of the client they are attempting to message
+			printw("Client %u: %s\n", sender, body);
+			std::size_t name_start = argument - body;
+			std::size_t name_end = name_start + text_find(argument, argument_length, ' ');
+			if (name_end == length || name_start+1 == name_end) {
+				printw("Client %u attempted to send a message, but didn't use the command properly.\n", sender);
+				char reply[] = "server: Command not executed properly. Must be #msg <target-name> <message>.";
+				server_ptr_->send_to(sender, reply, strlen(reply));
+			} else {
+				std::size_t name_length = name_end - name_start;
+				char name[name_length+1];
+				std::memcpy(name, body+name_start, name_length);
+				name[name_length] = '\0';
+				client* target = clients_.find(name, name_length);
+				if (target) {
+					// found client so let's send them the message
+					// first, we need to get the name of the sender
+					client* client_ptr = clients_.find(sender);
+					if (!client_ptr) {
+						printw("Client %u attempted to send a message, but they could not be found \
+							in the list of clients.\n", sender);
+					} else {
+						std::stringstream ss;
+						ss << client_ptr->get_name() << " (to " << target->get_name() << "): " << body+name_end+1;
+						const std::string& tmp = ss.str();
+						net_message msg(tmp.c_str(), tmp.length());
+						server_ptr_->send_to(target->get_id(), msg);
+						server_ptr_->send_to(sender, msg);
 					}
+				} else {
+					// nobody has that name right now, so it waits in the name's mailbox
+					leave_message(sender, name, body + name_end + 1);
 				}
-				refresh();
-			} else if (!strncmp(body, "#clients", 8)) {
-				// client requesting a list of the clients
-				std::stringstream ss;
-				ss << "\n";
-				for (auto& client_ : clients_) {
-					ss << client_.get_name() << "\n";
+			}
+			refresh();
+		} else if (command == clients_command) {
+			// client requesting a list of the clients, all of it or just one page
+			// (the list is kept encoded by clients_ and only built again after it changes)
+			if (command_length < length) {
+				std::size_t page = std::strtoul(argument, nullptr, 10);
+				if (page == 0 || page > clients_.roster_pages()) {
+					std::stringstream ss;
+					ss << "server: The list of clients has " << clients_.roster_pages() << " page(s).";
+					const std::string& tmp = ss.str();
+					server_ptr_->send_to(sender, tmp.c_str(), tmp.length());
+				} else {
+					server_ptr_->send_to(sender, clients_.roster_page(page - 1));
 				}
-				const std::string& tmp = ss.str();
-				const char* reply = tmp.c_str();
-				server_ptr_->send_to(sender, reply, tmp.length());
+			} else {
+				server_ptr_->send_to(sender, clients_.roster());
 			}
-			return;
+		} else if (command == presence_command) {
+			// client wants to follow the client list instead of asking for it
+			presence_.subscribe(sender, clients_);
+		} else if (command == history_command) {
+			// client asking for more of the conversation than it was sent when it joined
+			// the log is read off the io_context, a sender that has gone by the time it's read just isn't found
+			std::size_t count = std::min<std::size_t>(std::strtoul(argument, nullptr, 10), MAX_HISTORY_QUERY);
+			boost::asio::post(history_pool_, [this, sender, count]() {
+				std::string frames;
+				std::size_t found = log_.read_last(count, [&frames](const log_record& record) {
+					frames.append(record.frame, record.frame_length);
+				});
+				server_ptr_->send_to(sender, net_message(std::make_shared<const std::string>(std::move(frames)), found));
+			});
 		}
-		client* client_ptr = find_client(sender);
+		return stage_result::done;
+	}
+	
+	stage_result say(net_frame& frame) {
+		std::size_t sender = frame.client;
+		char* body = frame.body;
+		std::size_t length = frame.length;
+		client* client_ptr = clients_.find(sender);
 		if (!client_ptr) {
 			printw("Client %u attempted to send a message, but they could not be found \
 						in the list of clients.\n", sender);
@@ -245,34 +376,174 @@ public:
 			addch('\n');
 			refresh();
 			
-			server_ptr_->send_to_all(new_message, new_message_length-1);
+			broadcast(new_message, new_message_length-1);
 		}
+		return stage_result::done;
 	}
-private:
-	client* find_client(std::size_t id) {
-		// clients_ list is always guaranteed to be sorted according to id
-		auto iterator = std::lower_bound(clients_.begin(), clients_.end(), id,
-		  [](const client& c1, const std::size_t& id) {
-			return c1.get_id() < id;
+	
+	typedef member_stage<chat_server, &chat_server::handle_command> command_stage;
+	typedef member_stage<chat_server, &chat_server::say> say_stage;
+	
+	void wait_for_reload() {
+		reload_signal_.async_wait([this](const boost::system::error_code& e, int /*signal*/) {
+			if (!e) {
+				filter_.reload(FILTER_WORDS_PATH);
+				wait_for_reload();
+			}
 		});
-		
-		if (iterator == clients_.end()) {
-			return nullptr;
+	}
+	
+	void broadcast(const char* body, std::size_t length) {
+		net_message msg(body, length);
+		record(msg);
+		room_.send(msg);
+	}
+	
+	void announce(const char* body, std::size_t length, std::size_t except = SIZE_MAX) {
+		// a join, leave or name change, which the clients following the presence feed
+		// hear about from it instead
+		net_message msg(body, length);
+		record(msg);
+		room_.flush();
+		server_ptr_->send_to_all(msg, [this, except](std::size_t id) {
+			return id != except && !presence_.subscribed(id);
+		});
+	}
+	
+	void leave_message(std::size_t sender, const char* name, const char* message) {
+		client* client_ptr = clients_.find(sender);
+		std::size_t name_length = strlen(name);
+		bool valid = client_ptr && name_length <= MAX_NAME_LENGTH && text_is_identifier(name, name_length);
+		if (!valid) {
+			// nobody could ever take a name like that
+			char reply[] = "server: Unable to find a client with the name you specified.";
+			printw("Unable to find a client with the name specified in the #msg command.\n");
+			server_ptr_->send_to(sender, reply, strlen(reply));
+			return;
+		}
+		std::stringstream ss;
+		ss << client_ptr->get_name() << " (to " << name << "): " << message;
+		const std::string& tmp = ss.str();
+		net_message msg(tmp.c_str(), tmp.length());
+		std::stringstream reply;
+		switch (mailboxes_.store(name, msg)) {
+		case mailbox_store::stored:
+			server_ptr_->send_to(sender, msg);
+			reply << "server: " << name << " isn't connected, they will get your message when somebody takes that name.";
+			break;
+		case mailbox_store::mailbox_full:
+			reply << "server: " << name << " isn't connected and has too many messages waiting already.";
+			break;
+		case mailbox_store::too_many_mailboxes:
+			reply << "server: " << name << " isn't connected and no more messages can be kept for anybody else.";
+			break;
 		}
-		
-		return &(*iterator);
+		const std::string& reply_text = reply.str();
+		server_ptr_->send_to(sender, reply_text.c_str(), reply_text.length());
+	}
+	
+	void record(const net_message& msg) {
+		// everything said to the whole room goes in its history and its log, encoded just the once
+		history_.append(msg);
+		log_.append(msg);
+	}
+	
+	static log_options log_settings() {
+		log_options options;
+		options.directory = LOG_DIRECTORY;
+		options.max_bytes = 64 * 1024 * 1024;
+		options.max_age = std::chrono::hours(24 * 30);
+		return options;
+	}
+	
+	std::string save_state() override {
+		// one "<id> <name>" line per client,
+		// then "history <length>" and the history's frames,
+		// then "mailboxes <length>" and what mailbox_store::save gives,
+		// then "presence <length>" and the ids of the clients following the presence feed
+		// the log is flushed first so that the new server finds all of it,
+		// and the room so that the lines waiting for the window go with the connections
+		log_.flush();
+		room_.flush();
+		std::scoped_lock lock(clients_mutex_);
+		std::stringstream ss;
+		for (auto& client_ : clients_) {
+			ss << client_.get_id() << ' ' << client_.get_name() << '\n';
+		}
+		std::string history = history_.save();
+		ss << "history " << history.length() << '\n' << history;
+		std::string mailboxes = mailboxes_.save();
+		ss << "mailboxes " << mailboxes.length() << '\n' << mailboxes;
+		std::string subscribers = presence_.save();
+		ss << "presence " << subscribers.length() << '\n' << subscribers;
+		return ss.str();
+	}
+	
+	void restore_state(const std::string& state) {
+		std::scoped_lock lock(clients_mutex_);
+		std::stringstream ss(state);
+		std::string id;
+		std::string name;
+		while (ss >> id >> name) {
+			if (id == "history" || id == "mailboxes" || id == "presence") {
+				// an older server may not have sent these
+				std::string section(std::strtoul(name.c_str(), nullptr, 10), '\0');
+				ss.get();
+				ss.read(&section[0], section.length());
+				section.resize(ss.gcount());
+				if (id == "history") {
+					history_.restore(section);
+				} else if (id == "mailboxes") {
+					mailboxes_.restore(section);
+				} else {
+					presence_.restore(section);
+				}
+				continue;
+			}
+			if (name.length() > MAX_NAME_LENGTH) continue;
+			std::size_t client_id = std::strtoul(id.c_str(), nullptr, 10);
+			clients_.add(client_id);
+			clients_.rename(client_id, name.c_str(), name.length());
+		}
+		printw("Took over %u clients from the previous server.\n", clients_.size());
+		refresh();
 	}
 
-	std::list<client> clients_;
+	client_directory clients_;
 	std::mutex clients_mutex_;
+	message_history history_; // the chat has a single room
+	message_log log_;
+	mailbox_store mailboxes_;
+	presence_feed presence_;
+	broadcast_coalescer room_;
+	content_filter filter_;
+	boost::asio::signal_set reload_signal_;
+	boost::asio::thread_pool history_pool_; // reads the log for #history, stopped before log_ goes
+	net_pipeline<utf8_stage, command_stage, filter_stage, say_stage> inbound_;
 };
 
-int main() {
+int main(int argc, char* argv[]) {
 	try {
+		// chat_server [--takeover] [--coalesce]
+		bool takeover = false;
+		coalesce_options coalesce;
+		for (int i = 1; i < argc; i++) {
+			if (!strcmp(argv[i], "--takeover")) {
+				takeover = true;
+			} else if (!strcmp(argv[i], "--coalesce")) {
+				coalesce.enabled = true;
+				coalesce.window = std::chrono::microseconds(COALESCE_WINDOW_US);
+				coalesce.max_bytes = COALESCE_BYTES;
+			}
+		}
+		handoff_state state;
+		takeover = takeover && receive_handoff(HANDOFF_PATH, state);
 		initscr();
 		scrollok(stdscr, TRUE);
-		chat_server serv(1234);
+		chat_server serv(1234, takeover ? &state : nullptr);
+		serv.set_coalescing(coalesce);
 		serv.start();
+		endwin();
 	} catch (std::exception& e) {
 		std::cerr << e.what() << std::endl;
 		endwin();
@@ -0,0 +1,291 @@
+#ifndef _CONNECT4_AI_HPP_
+#define _CONNECT4_AI_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/*
+
+A computer opponent for connect4 that the server can put a waiting player against.
+
+The board is stored as two 64 bit bitboards (the same layout that is commonly used
+for connect4 solvers). Each column takes up height + 1 bits, with the bottom row in
+the lowest bit and one spare bit on top so that shifts never bleed into the next column.
+	- position: the tiles of the player whose turn it is
+	- mask: every tile that has been played
+Checking for a win then becomes a handful of shifts and ands instead of scanning the board.
+
+The search is a depth limited negamax with alpha-beta pruning, run with iterative deepening
+until the time budget runs out. Moves are ordered from the center column outwards, with the
+best move from the transposition table tried first. The transposition table has a fixed number
+of entries so the memory used per game never grows no matter how long the search runs.
+
+A connect4_ai object isn't thread safe, but each game owns its own and only ever
+searches one move at a time.
+
+*/
+
+class connect4_ai {
+public:
+	enum { width = 7 };
+	enum { height = 6 };
+
+	class position {
+	public:
+		position()
+		  : current_(0), mask_(0), moves_(0)
+		{}
+
+		bool can_play(int col) const {
+			return (mask_ & top_mask(col)) == 0;
+		}
+
+		void play(int col) {
+			current_ ^= mask_;
+			mask_ |= mask_ + bottom_mask(col);
+			moves_++;
+		}
+
+		void add_tile(int col, int row_from_bottom, bool current_player) {
+			// used when building a position from an existing board
+			std::uint64_t bit = std::uint64_t(1) << (col * (height + 1) + row_from_bottom);
+			mask_ |= bit;
+			if (current_player) {
+				current_ |= bit;
+			}
+			moves_++;
+		}
+
+		bool is_winning_move(int col) const {
+			return winning_positions(current_, mask_) & possible() & column_mask(col);
+		}
+
+		std::uint64_t key() const {
+			// unique for every position since the spare bit on top of each column marks its height
+			return current_ + mask_;
+		}
+
+		int moves() const {
+			return moves_;
+		}
+
+		int evaluate() const {
+			// number of empty cells that would complete a line for the player to move,
+			// minus the same for their opponent
+			std::uint64_t empty = board_mask ^ mask_;
+			int mine = popcount(winning_positions(current_, mask_) & empty);
+			int theirs = popcount(winning_positions(current_ ^ mask_, mask_) & empty);
+			return mine - theirs;
+		}
+
+	private:
+		std::uint64_t possible() const {
+			return (mask_ + bottom_row) & board_mask;
+		}
+
+		static std::uint64_t winning_positions(std::uint64_t pos, std::uint64_t mask) {
+			// returns every empty cell that would give pos four in a row
+			// vertical
+			std::uint64_t r = (pos << 1) & (pos << 2) & (pos << 3);
+
+			// horizontal
+			std::uint64_t p = (pos << (height + 1)) & (pos << 2 * (height + 1));
+			r |= p & (pos << 3 * (height + 1));
+			r |= p & (pos >> (height + 1));
+			p = (pos >> (height + 1)) & (pos >> 2 * (height + 1));
+			r |= p & (pos << (height + 1));
+			r |= p & (pos >> 3 * (height + 1));
+
+			// diagonal 1
+			p = (pos << height) & (pos << 2 * height);
+			r |= p & (pos << 3 * height);
+			r |= p & (pos >> height);
+			p = (pos >> height) & (pos >> 2 * height);
+			r |= p & (pos << height);
+			r |= p & (pos >> 3 * height);
+
+			// diagonal 2
+			p = (pos << (height + 2)) & (pos << 2 * (height + 2));
+			r |= p & (pos << 3 * (height + 2));
+			r |= p & (pos >> (height + 2));
+			p = (pos >> (height + 2)) & (pos >> 2 * (height + 2));
+			r |= p & (pos << (height + 2));
+			r |= p & (pos >> 3 * (height + 2));
+
+			return r & (board_mask ^ mask);
+		}
+
+		static constexpr std::uint64_t bottom_mask(int col) {
+			return std::uint64_t(1) << (col * (height + 1));
+		}
+
+		static constexpr std::uint64_t top_mask(int col) {
+			return (std::uint64_t(1) << (height - 1)) << (col * (height + 1));
+		}
+
+		static constexpr std::uint64_t column_mask(int col) {
+			return ((std::uint64_t(1) << height) - 1) << (col * (height + 1));
+		}
+
+		static int popcount(std::uint64_t x) {
+			return __builtin_popcountll(x);
+		}
+
+		// a 1 at the bottom of every column, written as a geometric series
+		static constexpr std::uint64_t bottom_row =
+		    ((std::uint64_t(1) << (width * (height + 1))) - 1) / ((std::uint64_t(1) << (height + 1)) - 1);
+		static constexpr std::uint64_t board_mask = bottom_row * ((std::uint64_t(1) << height) - 1);
+
+		std::uint64_t current_;
+		std::uint64_t mask_;
+		int moves_;
+	};
+
+	connect4_ai(std::size_t table_entries = 1 << 14)
+	  : table_(table_entries), nodes_(0), aborted_(false)
+	{}
+
+	int choose_move(const position& pos, std::chrono::milliseconds budget) {
+		// returns the column to play, or -1 if the board is full
+		deadline_ = std::chrono::steady_clock::now() + budget;
+		aborted_ = false;
+		nodes_ = 0;
+
+		int best_move = -1;
+		for (int i = 0; i < width; i++) {
+			int col = column_order(i);
+			if (!pos.can_play(col)) continue;
+			if (best_move == -1) best_move = col;
+			if (pos.is_winning_move(col)) return col;
+		}
+		if (best_move == -1) return -1;
+
+		// iterative deepening, only trusting the result of a depth if it finished in time
+		int max_depth = width * height - pos.moves();
+		for (int depth = 1; depth <= max_depth; depth++) {
+			int move = search_root(pos, depth);
+			if (aborted_) break;
+			best_move = move;
+		}
+		return best_move;
+	}
+
+	std::size_t memory_usage() const {
+		return table_.size() * sizeof(entry);
+	}
+
+private:
+	enum { win_score = 1000 };
+	enum bound : std::uint8_t { none = 0, exact, lower, upper };
+
+	struct entry {
+		std::uint64_t key;
+		std::int16_t score;
+		std::uint8_t depth;
+		std::uint8_t flag;
+		std::int8_t best_move;
+	};
+
+	static int column_order(int i) {
+		// center column first, then alternating outwards: 3 2 4 1 5 0 6
+		return width / 2 + (1 - 2 * (i % 2)) * (i + 1) / 2;
+	}
+
+	int search_root(const position& pos, int depth) {
+		int alpha = -win_score * 2;
+		int beta = win_score * 2;
+		int best_move = -1;
+		int first = probe_best_move(pos);
+		for (int i = -1; i < width; i++) {
+			int col = i == -1 ? first : column_order(i);
+			if (col < 0 || (i >= 0 && col == first)) continue;
+			if (!pos.can_play(col)) continue;
+			position next = pos;
+			next.play(col);
+			int score = -negamax(next, depth - 1, -beta, -alpha);
+			if (aborted_) return best_move;
+			if (score > alpha || best_move == -1) {
+				alpha = score;
+				best_move = col;
+			}
+		}
+		store(pos, alpha, depth, exact, best_move);
+		return best_move;
+	}
+
+	int negamax(const position& pos, int depth, int alpha, int beta) {
+		if ((++nodes_ & 1023) == 0 && std::chrono::steady_clock::now() > deadline_) {
+			aborted_ = true;
+		}
+		if (aborted_) return 0;
+		if (pos.moves() == width * height) return 0; // draw
+
+		for (int col = 0; col < width; col++) {
+			if (pos.can_play(col) && pos.is_winning_move(col)) {
+				// sooner wins are worth more
+				return win_score - pos.moves();
+			}
+		}
+		if (depth <= 0) return pos.evaluate();
+
+		int alpha_orig = alpha;
+		entry& e = table_[pos.key() % table_.size()];
+		int first = -1;
+		if (e.key == pos.key()) {
+			first = e.best_move;
+			if (e.depth >= depth) {
+				if (e.flag == exact) return e.score;
+				if (e.flag == lower && e.score > alpha) alpha = e.score;
+				else if (e.flag == upper && e.score < beta) beta = e.score;
+				if (alpha >= beta) return e.score;
+			}
+		}
+
+		int best = -win_score * 2;
+		int best_move = -1;
+		for (int i = -1; i < width; i++) {
+			int col = i == -1 ? first : column_order(i);
+			if (col < 0 || (i >= 0 && col == first)) continue;
+			if (!pos.can_play(col)) continue;
+			position next = pos;
+			next.play(col);
+			int score = -negamax(next, depth - 1, -beta, -alpha);
+			if (aborted_) return 0;
+			if (score > best) {
+				best = score;
+				best_move = col;
+			}
+			if (score > alpha) alpha = score;
+			if (alpha >= beta) break;
+		}
+
+		bound flag = exact;
+		if (best <= alpha_orig) flag = upper;
+		else if (best >= beta) flag = lower;
+		store(pos, best, depth, flag, best_move);
+		return best;
+	}
+
+	int probe_best_move(const position& pos) {
+		const entry& e = table_[pos.key() % table_.size()];
+		return e.key == pos.key() ? e.best_move : -1;
+	}
+
+	void store(const position& pos, int score, int depth, bound flag, int best_move) {
+		// always replace, the table is small and recent positions are the useful ones
+		entry& e = table_[pos.key() % table_.size()];
+		e.key = pos.key();
+		e.score = static_cast<std::int16_t>(score);
+		e.depth = static_cast<std::uint8_t>(depth);
+		e.flag = flag;
+		e.best_move = static_cast<std::int8_t>(best_move);
+	}
+
+	std::vector<entry> table_;
+	std::chrono::steady_clock::time_point deadline_;
+	std::uint64_t nodes_;
+	bool aborted_;
+};
+
+#endif
@@ -217,14 +217,14 @@ private:
 				} else {
 					wprintw(game_win, "You have lost.\n");
 				}
-				wprintw(game_win, "To start a new game, you will need to restart the client.\n");
+				wprintw(game_win, "You will be put in a new game shortly.\n");
 				wrefresh(game_win);
 			} else if (!strncmp(body, "#draw ", 6)) {
 				// game has ended in a draw
 				draw_board(body+6, false);
 				
 				wprintw(game_win, "The game has ended in a draw.\n");
-				wprintw(game_win, "To start a new game, you will need to restart the client.\n");
+				wprintw(game_win, "You will be put in a new game shortly.\n");
 				wrefresh(game_win);
 			}
 		}
@@ -0,0 +1,319 @@
+#ifndef _CONNECT4_GAME_HPP_
+#define _CONNECT4_GAME_HPP_
+
+#include "net_server.hpp"
+#include "connect4_ai.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <ncurses.h>
+
+/*
+
+The player and game classes used by connect4_server.
+
+They live in their own header so that connect4_bench can drive the exact same
+game logic (apply_move, check_for_win, check_for_draw) without a server.
+A game only needs a net_server when it talks to its players (start, send_to_players),
+so the benchmark passes a nullptr server along with a strand of its own.
+
+A game talks to its players by their client ids, never through the player objects. Those live in
+connect4_server's players_ list and are erased as soon as their client disconnects, while the game can
+still have handlers queued on its strand (a bot move, a turn timer) that run afterwards. get_players()
+is only for matchmaking, which holds players_mutex_ and only looks at games that are still in games_.
+
+*/
+
+class game;
+
+class player {
+public:
+	// the bot isn't a connection so it gets an id that net_server will never hand out
+	static constexpr std::size_t bot_id = std::numeric_limits<std::size_t>::max();
+
+	player(std::size_t id)
+	  : id_(id), in_game(false), player_num('0'), wait_timer_(0) {
+	}
+	
+	std::size_t get_id() { return id_; }
+	bool is_bot() { return id_ == bot_id; }
+	
+	bool in_game;
+	// the game this player is currently in along with whether they are player '1' or '2'
+	// both are only changed while holding players_mutex_
+	std::shared_ptr<game> game_;
+	char player_num;
+	// armed while the player is waiting for an opponent, fires to start a game against the bot
+	net_timer_wheel::handle wait_timer_;
+private:
+	std::size_t id_;
+};
+
+class game {
+public:
+	enum tile { empty=0, x=1, o=2 };
+	enum { rows = 6 }; // this value must be a single digit value
+	enum { cols = 7 }; // this value must be a single digit value
+
+	game(player* p1, player* p2, net_server* server_ptr_, net_strand strand_)
+	  : players{p1, p2}, player_ids{p1->get_id(), p2 ? p2->get_id() : player::bot_id},
+	    server_ptr(server_ptr_), strand(strand_), has_bot_(false), turn('1'), finished(false),
+	    moves(0), turn_timer(0) {
+	}
+	
+	net_strand& get_strand() {
+		// every read_handler call that touches this game must be running on this strand
+		return strand;
+	}
+	
+	player* add_bot() {
+		// replaces the second player with a computer opponent
+		// the game owns the bot along with its search state
+		bot = std::make_unique<player>(player::bot_id);
+		ai = std::make_unique<connect4_ai>();
+		players[1] = bot.get();
+		player_ids[1] = player::bot_id;
+		has_bot_ = true;
+		return bot.get();
+	}
+	
+	// whether player '2' is the bot
+	bool has_bot() {
+		return has_bot_;
+	}
+	
+	connect4_ai* get_ai() {
+		return ai.get();
+	}
+	
+	connect4_ai::position get_position() {
+		// converts the board into the bitboard representation used by connect4_ai
+		// from the point of view of the player whose turn it is
+		connect4_ai::position pos;
+		tile to_move = turn == '1' ? x : o;
+		for (int col = 0; col < cols; col++) {
+			for (int row = rows-1; row >= 0; row--) {
+				if (board[row][col] == empty) break;
+				pos.add_tile(col, rows-1 - row, board[row][col] == to_move);
+			}
+		}
+		return pos;
+	}
+	
+	void send_to_players(const char* body, std::size_t length) {
+		for (std::size_t id : player_ids) {
+			if (id != player::bot_id) {
+				server_ptr->send_to(id, body, length);
+			}
+		}
+	}
+	
+	void start() {
+		// send a message to both players that the game is
+		// starting and tell them which player they are and 
+		// what the board dimensions are
+		clear_board();
+		std::size_t msg_len = snprintf(NULL, 0, "#start 1 %u %u", rows, cols) + 1;
+		
+		char p1_start_msg[msg_len];
+		char p2_start_msg[msg_len];
+		sprintf(p1_start_msg, "#start 1 %u %u", rows, cols);
+		sprintf(p2_start_msg, "#start 2 %u %u", rows, cols);
+		
+		if (player_ids[0] != player::bot_id)
+			server_ptr->send_to(player_ids[0], p1_start_msg, strlen(p1_start_msg));
+		if (player_ids[1] != player::bot_id)
+			server_ptr->send_to(player_ids[1], p2_start_msg, strlen(p2_start_msg));
+	}
+	
+	void clear_board() {
+		for (int y = 0; y < rows; y++) {
+			for (int x = 0; x < cols; x++) {
+				board[y][x] = empty;
+			}
+		}
+	}
+	
+	void draw_board(WINDOW* win) {
+		for (int x = 0; x < cols; x++) {
+			wprintw(win, "-~");
+		}
+		waddch(win, '\n');
+		for (int y = 0; y < rows; y++) {
+			for (int x = 0; x < cols; x++) {
+				waddch(win, '|');
+				draw_tile(win, board[y][x]);
+			}
+			wprintw(win, "|\n");
+		}
+		for (int x = 0; x < cols; x++) {
+			wprintw(win, "-~");
+		}
+		waddch(win, '-');
+	}
+	
+	player** get_players() {
+		// Precondition: players_mutex_ is held and the game is still in games_
+		return players;
+	}
+	
+	char get_turn() {
+		return turn;
+	}
+	
+	void toggle_turn() {
+		if (turn == '1')
+			turn = '2';
+		else
+			turn = '1';
+	}
+	
+	tile (*get_board())[cols] {
+		return board;
+	}
+	
+	void apply_move(char player_num, std::size_t row, std::size_t col) {
+		if (player_num == '1')
+			board[row][col] = x;
+		else
+			board[row][col] = o;
+		moves++;
+	}
+	
+	std::size_t get_moves() {
+		return moves;
+	}
+	
+	void write_board(std::ostream& os) {
+		// the board as sent to the clients, one character per tile starting from the top row
+		for (int row = 0; row < rows; row++) {
+			for (int col = 0; col < cols; col++) {
+				if (board[row][col] == empty)
+					os << ' ';
+				else if (board[row][col] == x)
+					os << 'x';
+				else
+					os << 'o';
+			}
+		}
+	}
+	
+	// The clocks are owned by the game but armed by the server on its timer wheel.
+	// Each player has a bank of time for the whole game, and each turn is also limited
+	// to turn_limit, whichever runs out first.
+	void start_clock(std::chrono::steady_clock::duration game_limit) {
+		time_left[0] = game_limit;
+		time_left[1] = game_limit;
+		turn_started = std::chrono::steady_clock::now();
+	}
+	
+	std::chrono::steady_clock::duration start_turn(std::chrono::steady_clock::duration turn_limit) {
+		// called when a turn begins, returns how long the player whose turn it is has to move
+		turn_started = std::chrono::steady_clock::now();
+		return std::min(turn_limit, time_left[turn == '1' ? 0 : 1]);
+	}
+	
+	void end_turn(char player_num) {
+		// called when player_num has made their move, charges them for the time they used
+		auto& left = time_left[player_num == '1' ? 0 : 1];
+		left -= std::min(left, std::chrono::steady_clock::now() - turn_started);
+	}
+	
+	net_timer_wheel::handle& get_turn_timer() {
+		return turn_timer;
+	}
+	
+	bool check_for_win(char player_num) {
+		// returns true if player_num has won the game
+		// algorithm taken from https://stackoverflow.com/questions/32770321/connect-4-check-for-a-win-algorithm/32771681
+		tile tile_ = x;
+		if (player_num == '2')
+			tile_ = o;
+		
+		// board[0] is the top row, so "up" is towards smaller row indices
+		// horizontal check
+		for (int row = 0; row < rows; row++) {
+			for (int col = 0; col < cols-3; col++) {
+				if (board[row][col] == tile_ && board[row][col+1] == tile_ && board[row][col+2] == tile_ && board[row][col+3] == tile_)
+					return true;
+			}
+		}
+		
+		// vertical check
+		for (int row = 0; row < rows-3; row++) {
+			for (int col = 0; col < cols; col++) {
+				if (board[row][col] == tile_ && board[row+1][col] == tile_ && board[row+2][col] == tile_ && board[row+3][col] == tile_)
+					return true;
+			}
+		}
+		
+		// bottom left to top right diagonal
+		for (int row = 3; row < rows; row++) {
+			for (int col = 0; col < cols-3; col++) {
+				if (board[row][col] == tile_ && board[row-1][col+1] == tile_ && board[row-2][col+2] == tile_ && board[row-3][col+3] == tile_)
+					return true;
+			}
+		}
+		
+		// top left to bottom right diagonal
+		for (int row = 0; row < rows-3; row++) {
+			for (int col = 0; col < cols-3; col++) {
+				if (board[row][col] == tile_ && board[row+1][col+1] == tile_ && board[row+2][col+2] == tile_ && board[row+3][col+3] == tile_)
+					return true;
+			}
+		}
+		
+		return false;
+	}
+	
+	bool check_for_draw() {
+		// Precondition: game has not been won (make sure to check check_for_win() first)
+		// game is a draw if the first row is completely used up
+		for (int i = 0; i < cols; i++) {
+			if (board[0][i] == empty)
+				return false;
+		}
+		return true;
+	}
+	
+	void game_over() { turn = '0'; finished = true; }
+	
+	// unlike get_turn(), this can be checked from outside of the game's strand (by the reaper)
+	bool is_finished() { return finished; }
+	// called off the strand when a player leaves, the rest of game_over() happens on the strand
+	void abandon() { finished = true; }
+	
+private:
+	void draw_tile(WINDOW* win, tile& tile_) {
+		if (tile_ == empty)
+			waddch(win, ' ');
+		else if (tile_ == x) {
+			wattron(win, COLOR_PAIR(1));
+			waddch(win, 'X');
+			wattroff(win, COLOR_PAIR(1));
+		}
+		wattron(win, COLOR_PAIR(2));
+		waddch(win, 'O');
+		wattroff(win, COLOR_PAIR(2));
+	}
+	
+	net_server* server_ptr;
+	net_strand strand;
+	player* players[2];
+	std::size_t player_ids[2]; // what the game sends to, player::bot_id for the bot
+	std::unique_ptr<player> bot;
+	std::unique_ptr<connect4_ai> ai;
+	bool has_bot_;
+	tile board[rows][cols];
+	char turn;
+	std::atomic<bool> finished;
+	std::size_t moves;
+	std::chrono::steady_clock::time_point turn_started;
+	std::chrono::steady_clock::duration time_left[2];
+	net_timer_wheel::handle turn_timer;
+};
+
+#endif
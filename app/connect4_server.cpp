@@ -1,6 +1,10 @@
 #include "net_server.hpp"
+#include "connect4_ai.hpp"
+#include "connect4_game.hpp"
 
 #include <sstream>
+#include <cstdarg>
+#include <boost/asio/thread_pool.hpp>
 #include <ncurses.h>
 
 /*
@@ -22,214 +26,263 @@ will be notified accordingly.
 If a client disconnects mid-game, their opponent will be put back into the queue
 of players waiting for an opponent.
 
+The server runs its io_context on every core. To keep the game logic free of locks,
+each game owns a strand and both of its players' connections are moved onto that strand
+when the game is created (matchmaking is the only time a connection changes strand).
+From then on, every move for a game is processed by one thread at a time, and
+players_mutex_ is only needed for matchmaking and for looking up which game a player is in.
+
+If a player has been waiting for an opponent for bot_wait_time, they are put in a game
+against the computer instead (see connect4_ai.hpp). The bot always plays second.
+Its searches run on a separate thread pool with a time budget per move, so a
+search never holds up the io_context threads, and the chosen move is posted back
+to the game's strand where it is processed exactly like a move from a client.
+
+Each player has turn_time to make a move and game_time in total for the whole game.
+Running out of either forfeits the game. The clocks live on the server's timer wheel,
+so there is no timer object per game, only one wheel entry for whoever's turn it is.
+Finished games are reclaimed every reap_interval by the reaper, which also puts their
+players back in the queue for a new game.
+
 */
 
-class player {
+class connect4_server : public application_server {
 public:
-	player(std::size_t id)
-	  : id_(id) {
+	connect4_server(std::size_t port, std::size_t num_threads)
+	  : application_server(port, num_threads), ai_pool_(ai_threads) {
+		goodbye_message_ = "#msg 0 The server is shutting down.";
+		// a player whose connection drops can come back to the same game, as long as the clock hasn't run out
+		session_options sessions;
+		sessions.enabled = true;
+		sessions.grace = turn_time;
+		server_ptr_->set_session(sessions);
+		schedule_reaper();
 	}
-	
-	std::size_t get_id() { return id_; }
-	
-	bool in_game;
 private:
-	std::size_t id_;
-};
+	enum { ai_threads = 2 };
+	static constexpr std::chrono::seconds bot_wait_time{10}; // how long a player waits for a human before getting the bot
+	static constexpr std::chrono::milliseconds bot_move_time{250}; // search budget for each of the bot's moves
+	static constexpr std::chrono::seconds turn_time{60}; // time limit for a single move
+	static constexpr std::chrono::minutes game_time{5}; // time each player has for all of their moves
+	static constexpr std::chrono::seconds reap_interval{30};
+	static_assert(int(game::rows) == int(connect4_ai::height) && int(game::cols) == int(connect4_ai::width),
+	              "connect4_ai bitboards are laid out for the default board size");
 
-class game {
-public:
-	enum tile { empty=0, x=1, o=2 };
-	enum { rows = 6 }; // this value must be a single digit value
-	enum { cols = 7 }; // this value must be a single digit value
-
-	game(player* p1, player* p2, net_server* server_ptr_)
-	  : players{p1, p2}, server_ptr(server_ptr_), turn('1') {
-		start_color();
-		init_pair(1, COLOR_MAGENTA, COLOR_BLACK);
-		init_pair(2, COLOR_CYAN, COLOR_BLACK);
+	void print(const char* format, ...) {
+		// ncurses isn't thread safe and the handlers run on several threads
+		std::scoped_lock lock(screen_mutex_);
+		va_list args;
+		va_start(args, format);
+		vw_printw(stdscr, format, args);
+		va_end(args);
+		refresh();
 	}
 	
-	void start() {
-		// send a message to both players that the game is
-		// starting and tell them which player they are and 
-		// what the board dimensions are
-		clear_board();
-		std::size_t msg_len = snprintf(NULL, 0, "#start 1 %u %u", rows, cols);
-		
-		char p1_start_msg[msg_len];
-		char p2_start_msg[msg_len];
-		sprintf(p1_start_msg, "#start 1 %u %u", rows, cols);
-		sprintf(p2_start_msg, "#start 2 %u %u", rows, cols);
-		
-		server_ptr->send_to(players[0]->get_id(), p1_start_msg, strlen(p1_start_msg));
-		server_ptr->send_to(players[1]->get_id(), p2_start_msg, strlen(p2_start_msg));
+	void join_game(player& player_, std::shared_ptr<game> new_game, char player_num) {
+		// Precondition: players_mutex_ is held
+		player_.in_game = true;
+		player_.game_ = new_game;
+		player_.player_num = player_num;
+		if (player_.wait_timer_) {
+			server_ptr_->get_timer_wheel().cancel(player_.wait_timer_);
+			player_.wait_timer_ = 0;
+		}
+		if (!player_.is_bot()) {
+			server_ptr_->set_strand(player_.get_id(), new_game->get_strand());
+		}
 	}
 	
-	void clear_board() {
-		for (int y = 0; y < rows; y++) {
-			for (int x = 0; x < cols; x++) {
-				board[y][x] = empty;
-			}
-		}
+	std::shared_ptr<game> create_game(player& p1, player& p2) {
+		// Precondition: players_mutex_ is held
+		// This is the only place where a connection changes strand. Both players are moved
+		// onto the new game's strand, so after this all of the game's state is single threaded.
+		std::shared_ptr<game> new_game = std::make_shared<game>(&p1, &p2, &(*server_ptr_), server_ptr_->make_strand());
+		join_game(p1, new_game, '1');
+		join_game(p2, new_game, '2');
+		games_.push_back(new_game);
+		return new_game;
 	}
 	
-	void draw_board(WINDOW* win) {
-		for (int x = 0; x < cols; x++) {
-			wprintw(win, "-~");
-		}
-		waddch(win, '\n');
-		for (int y = 0; y < rows; y++) {
-			for (int x = 0; x < cols; x++) {
-				waddch(win, '|');
-				draw_tile(win, board[y][x]);
-			}
-			wprintw(win, "|\n");
-		}
-		for (int x = 0; x < cols; x++) {
-			wprintw(win, "-~");
-		}
-		waddch(win, '-');
+	std::shared_ptr<game> create_bot_game(player& p1) {
+		// Precondition: players_mutex_ is held
+		std::shared_ptr<game> new_game = std::make_shared<game>(&p1, nullptr, &(*server_ptr_), server_ptr_->make_strand());
+		player* bot = new_game->add_bot();
+		join_game(p1, new_game, '1');
+		join_game(*bot, new_game, '2');
+		games_.push_back(new_game);
+		return new_game;
 	}
 	
-	player** get_players() {
-		return players;
+	void start_game(std::shared_ptr<game> new_game) {
+		boost::asio::post(new_game->get_strand(), [this, new_game]() {
+			if (new_game->is_finished()) {
+				return; // a player left before the game got going, and their player is gone
+			}
+			new_game->start();
+			char reply[] = "#msg s Your game has begun.";
+			new_game->send_to_players(reply, strlen(reply));
+			new_game->start_clock(game_time);
+			start_turn_clock(new_game);
+		});
 	}
 	
-	char get_turn() {
-		return turn;
+	void start_turn_clock(std::shared_ptr<game> game_ptr) {
+		// Precondition: running on game_ptr's strand
+		// Replaces the timer for the previous turn with one for the current turn.
+		// The move count is captured so that a timer which fires just as a move arrives
+		// (and was too late to be cancelled) knows that it is stale.
+		net_timer_wheel& timers = server_ptr_->get_timer_wheel();
+		timers.cancel(game_ptr->get_turn_timer());
+		std::chrono::steady_clock::duration limit = game_ptr->start_turn(turn_time);
+		std::size_t moves = game_ptr->get_moves();
+		game_ptr->get_turn_timer() = timers.schedule(game_ptr->get_strand(), limit, [this, game_ptr, moves]() {
+			turn_timeout(game_ptr, moves);
+		});
 	}
 	
-	void toggle_turn() {
-		if (turn == '1')
-			turn = '2';
-		else
-			turn = '1';
+	void stop_turn_clock(std::shared_ptr<game> game_ptr) {
+		// Precondition: running on game_ptr's strand
+		server_ptr_->get_timer_wheel().cancel(game_ptr->get_turn_timer());
+		game_ptr->get_turn_timer() = 0;
 	}
 	
-	tile (*get_board())[cols] {
-		return board;
+	void turn_timeout(std::shared_ptr<game> game_ptr, std::size_t moves) {
+		// Runs on the game's strand when a player has taken too long, and forfeits the game for them.
+		// A game a player has left is finished before its game_over() reaches the strand.
+		if (game_ptr->is_finished() || game_ptr->get_turn() == '0' || game_ptr->get_moves() != moves) {
+			return;
+		}
+		char loser = game_ptr->get_turn();
+		char winner = loser == '1' ? '2' : '1';
+		game_ptr->game_over();
+		game_ptr->get_turn_timer() = 0;
+		
+		std::stringstream msg;
+		msg << "#msg s Player " << loser << " ran out of time.";
+		const std::string& tmp_msg = msg.str();
+		game_ptr->send_to_players(tmp_msg.c_str(), tmp_msg.length());
+		
+		std::stringstream ss;
+		ss << "#win " << winner << " ";
+		game_ptr->write_board(ss);
+		const std::string& tmp = ss.str();
+		game_ptr->send_to_players(tmp.c_str(), tmp.length());
+		print("Player %c ran out of time and forfeited their game.\n", loser);
 	}
 	
-	void apply_move(char player_num, std::size_t row, std::size_t col) {
-		if (player_num == '1')
-			board[row][col] = x;
-		else
-			board[row][col] = o;
+	void schedule_reaper() {
+		server_ptr_->get_timer_wheel().schedule(reap_interval, [this]() {
+			reap_games();
+			schedule_reaper();
+		});
 	}
 	
-	bool check_for_win(char player_num) {
-		// returns true if player_num has won the game
-		// algorithm taken from https://stackoverflow.com/questions/32770321/connect-4-check-for-a-win-algorithm/32771681
-		tile tile_ = x;
-		if (player_num == '2')
-			tile_ = o;
-		
-		// horizontal check
-		for (int j = 0; j < rows-3; j++) {
-			for (int i = 0; i < cols; i++) {
-				if (board[i][j] == tile_ && board[i][j+1] == tile_ && board[i][j+2] == tile_ && board[i][j+3] == tile_)
-					return true;
+	void reap_games() {
+		// Removes every finished game from games_ so that its memory is released,
+		// and puts the human players from those games back in the queue for a new game.
+		std::vector<std::shared_ptr<game>> new_games;
+		std::vector<std::size_t> requeued;
+		std::size_t reaped = 0;
+		{
+			std::scoped_lock lock(players_mutex_);
+			std::vector<player*> waiting;
+			for (auto it = games_.begin(); it != games_.end();) {
+				if (!(*it)->is_finished()) {
+					++it;
+					continue;
+				}
+				for (int i = 0; i < 2; i++) {
+					player* player_ = (*it)->get_players()[i];
+					if (player_->is_bot()) continue;
+					player_->in_game = false;
+					player_->game_.reset();
+					waiting.push_back(player_);
+				}
+				it = games_.erase(it);
+				reaped++;
 			}
-		}
-		
-		// vertical check
-		for (int i = 0; i < cols-3; i++) {
-			for (int j = 0; j < rows; j++) {
-				if (board[i][j] == tile_ && board[i+1][j] == tile_ && board[i+2][j] == tile_ && board[i+3][j] == tile_)
-					return true;
+			for (player* player_ : waiting) {
+				requeued.push_back(player_->get_id());
 			}
-		}
-		
-		// bottom left to top right diagonal
-		for (int i = 3; i < cols; i++) {
-			for (int j = 0; j < rows-3; j++) {
-				if (board[i][j] == tile_ && board[i-1][j+1] == tile_ && board[i-2][j+2] == tile_ && board[i-3][j+3] == tile_)
-					return true;
+			for (player* player_ : waiting) {
+				if (player_->in_game) continue; // already paired up with someone earlier in this loop
+				player* opponent = find_waiting_player(player_->get_id());
+				if (opponent) {
+					new_games.push_back(create_game(*opponent, *player_));
+				} else {
+					start_waiting(*player_);
+				}
 			}
 		}
-		
-		// top left to bottom right diagonal
-		for (int i = 3; i < cols; i++) {
-			for (int j = 3; j < rows; j++) {
-				if (board[i][j] == tile_ && board[i-1][j-1] == tile_ && board[i-2][j-2] == tile_ && board[i-3][j-3] == tile_)
-					return true;
-			}
+		for (std::size_t id : requeued) {
+			char reply[] = "#msg s You have been put back in the queue for a new game.";
+			server_ptr_->send_to(id, reply, strlen(reply));
 		}
-		
-		return false;
-	}
-	
-	bool check_for_draw() {
-		// Precondition: game has not been won (make sure to check check_for_win() first)
-		// game is a draw if the first row is completely used up
-		for (int i = 0; i < cols; i++) {
-			if (board[0][i] == empty)
-				return false;
+		for (auto& new_game : new_games) {
+			start_game(new_game);
+		}
+		if (reaped > 0) {
+			print("Reaped %u finished games.\n", reaped);
 		}
-		return true;
 	}
 	
-	void game_over() { turn = '0'; }
+	void start_waiting(player& player_) {
+		// Precondition: players_mutex_ is held
+		// if nobody else shows up before the timer fires, the player gets a game against the bot
+		// the timer can still fire after the player has found a game or left, which start_bot_game checks for
+		std::size_t id = player_.get_id();
+		player_.wait_timer_ = server_ptr_->get_timer_wheel().schedule(bot_wait_time, [this, id]() {
+			start_bot_game(id);
+		});
+	}
 	
-private:
-	void draw_tile(WINDOW* win, tile& tile_) {
-		if (tile_ == empty)
-			waddch(win, ' ');
-		else if (tile_ == x) {
-			wattron(win, COLOR_PAIR(1));
-			waddch(win, 'X');
-			wattroff(win, COLOR_PAIR(1));
+	void start_bot_game(std::size_t id) {
+		std::unique_lock lock(players_mutex_);
+		auto it = std::find_if(players_.begin(), players_.end(), [id](player& player_) {
+			return player_.get_id() == id;
+		});
+		if (it == players_.end() || it->in_game) {
+			return;
 		}
-		wattron(win, COLOR_PAIR(2));
-		waddch(win, 'O');
-		wattroff(win, COLOR_PAIR(2));
+		std::shared_ptr<game> new_game = create_bot_game(*it);
+		lock.unlock();
+		start_game(new_game);
+		print("Client %u has been waiting too long, starting a game against the bot.\n", id);
 	}
 	
-	net_server* server_ptr;
-	player* players[2];
-	tile board[rows][cols];
-	char turn;
-};
+	player* find_waiting_player(std::size_t except_id) {
+		// Precondition: players_mutex_ is held
+		for (auto& player_ : players_) {
+			if (player_.get_id() == except_id) continue;
+			if (!player_.in_game) {
+				return &player_;
+			}
+		}
+		return nullptr;
+	}
 
-class connect4_server : public application_server {
-public:
-	connect4_server(std::size_t port)
-	  : application_server(port)
-	{}
-private:
 	void accept_handler(std::size_t client_id, bool connect) {
 		if (connect) {
-			for (auto& player_ : players_) {
-				if (!player_.in_game) {
-					// found a player for the new client to play against
-					std::unique_lock lock(players_mutex_);
-					players_.emplace_back(client_id);
-					player& new_player = players_.back();
-					player_.in_game = true;
-					new_player.in_game = true;
-					lock.unlock();
-					// let's creat a new game!
-					std::shared_ptr<game> new_game = std::make_shared<game>(&player_, &new_player, &(*server_ptr_));
-					games_.push_back(new_game);
-					new_game->start();
-					char reply[] = "#msg s Your game has begun.";
-					server_ptr_->send_to(client_id, reply, strlen(reply));
-					server_ptr_->send_to(player_.get_id(), reply, strlen(reply));
-					printw("New client connected with id %u, starting a game with client %u.\n", client_id, player_.get_id());
-					refresh();
-					return;
-				}
-			}
 			std::unique_lock lock(players_mutex_);
 			players_.emplace_back(client_id);
 			player& new_player = players_.back();
+			player* opponent = find_waiting_player(client_id);
+			if (opponent) {
+				// found a player for the new client to play against
+				// let's creat a new game!
+				std::shared_ptr<game> new_game = create_game(*opponent, new_player);
+				std::size_t opponent_id = opponent->get_id();
+				lock.unlock();
+				start_game(new_game);
+				print("New client connected with id %u, starting a game with client %u.\n", client_id, opponent_id);
+				return;
+			}
+			start_waiting(new_player);
 			lock.unlock();
 			// no players available to start a new game so we wait
 			char reply[] = "#msg s No players available to start a new game. You will be put in a game when a new player joins.";
 			server_ptr_->send_to(client_id, reply, strlen(reply));
-			printw("New client connected with id %u, but no player available to start a new game.\n", client_id);
-			refresh();
+			print("New client connected with id %u, but no player available to start a new game.\n", client_id);
 			return;
 		} else {
 			// client disconnected so we should check to see if they were in a game
@@ -237,102 +290,106 @@ private:
 			// into the pool of players waiting for an opponent
 			// we should also check to see if there is already an opponent waiting
 			// in which case we can start a new game between them
-			player* other_player = nullptr;
 			std::unique_lock lock(players_mutex_);
-			for (auto it = players_.begin(); it != players_.end(); ++it) {
-				player& player_ = *it;
-				if (client_id == player_.get_id()) {
-					if (player_.in_game) {
-						// find the game
-						for (int i = 0; i < games_.size(); i++) {
-							std::shared_ptr<game> game_ = games_[i];
-							if (game_->get_players()[0]->get_id() == player_.get_id()) {
-								other_player = game_->get_players()[1];
-							} else if (game_->get_players()[1]->get_id() == player_.get_id()) {
-								other_player = game_->get_players()[0];
-							}
-							if (other_player) {
-								other_player->in_game = false;
-								char reply1[] = "#endgame";
-								server_ptr_->send_to(other_player->get_id(), reply1, strlen(reply1));
-								char reply2[] = "#msg s Your opponent has disconnected so you have been put back in "
-												"queue to wait for a new opponent.";
-								server_ptr_->send_to(other_player->get_id(), reply2, strlen(reply2));
-								games_.erase(games_.begin() + i);
-								break;
-							}
-						}
-					}
-					printw("Player %u has disconnected.\n", client_id);
-					refresh();
-					players_.erase(it);
-					break;
+			auto it = std::find_if(players_.begin(), players_.end(), [client_id](player& player_) {
+				return player_.get_id() == client_id;
+			});
+			if (it == players_.end()) {
+				return;
+			}
+			if (it->wait_timer_) {
+				server_ptr_->get_timer_wheel().cancel(it->wait_timer_);
+			}
+			player* other_player = nullptr;
+			std::shared_ptr<game> old_game = it->game_;
+			if (it->in_game && old_game) {
+				other_player = old_game->get_players()[0] == &(*it) ? old_game->get_players()[1] : old_game->get_players()[0];
+				if (other_player->is_bot()) {
+					// nobody to put back in the queue
+					other_player = nullptr;
+				} else {
+					other_player->in_game = false;
+					other_player->game_.reset();
 				}
+				games_.erase(std::remove(games_.begin(), games_.end(), old_game), games_.end());
+				old_game->abandon();
 			}
-			lock.unlock();
+			players_.erase(it);
+			
 			// if other_player is not nullptr, then that means 
 			// that the user disconnecting was in a game
 			// their game has been removed from the list of games
 			// and other_player->in_game is now false
 			// but we should check to see if there was already a user waiting to play a game
 			// in which case we can start them in a game right now
-			lock.lock();
-			for (auto& player_ : players_) {
-				if (player_.get_id() == other_player->get_id()) continue;
-				if (!player_.in_game) {
-					// found a player for the new client to play against
-					player_.in_game = true;
-					other_player->in_game = true;
-					lock.unlock();
-					// let's creat a new game!
-					std::shared_ptr<game> new_game = std::make_shared<game>(&player_, other_player, &(*server_ptr_));
-					games_.push_back(new_game);
-					new_game->start();
-					printw("Starting a game between client %u and client %u.\n", other_player->get_id(), player_.get_id());
-					refresh();
-					return;
+			std::shared_ptr<game> new_game;
+			std::size_t other_id = 0;
+			std::size_t opponent_id = 0;
+			if (other_player) {
+				other_id = other_player->get_id();
+				player* opponent = find_waiting_player(other_id);
+				if (opponent) {
+					opponent_id = opponent->get_id();
+					new_game = create_game(*opponent, *other_player);
+				} else {
+					start_waiting(*other_player);
 				}
 			}
 			lock.unlock();
+			
+			print("Player %u has disconnected.\n", client_id);
+			if (old_game) {
+				// the abandoned game may still be referenced by a handler on its strand
+				// (or by a bot search that is about to post its move back)
+				boost::asio::post(old_game->get_strand(), [this, old_game]() {
+					old_game->game_over();
+					stop_turn_clock(old_game);
+				});
+			}
+			if (other_player) {
+				char reply1[] = "#endgame";
+				server_ptr_->send_to(other_id, reply1, strlen(reply1));
+				char reply2[] = "#msg s Your opponent has disconnected so you have been put back in "
+								"queue to wait for a new opponent.";
+				server_ptr_->send_to(other_id, reply2, strlen(reply2));
+			}
+			if (new_game) {
+				start_game(new_game);
+				print("Starting a game between client %u and client %u.\n", other_id, opponent_id);
+			}
 		}
 	}
 	
 	void read_handler(std::size_t sender, char* body, std::size_t length) {
 		// a message that was sent by a client with id sender
-		// first let's find the player object
-		player* player_ptr = nullptr;
-		for (auto& player_ : players_) {
-			if (player_.get_id() == sender) {
-				player_ptr = &player_;
-				break;
-			}
-		}
-		if (player_ptr == nullptr)
-			return;
-		if (!player_ptr->in_game)
-			return; // ignore message since player isn't in a game right now
-		// let's find the game that the player is a part of
+		// first let's find the player object and the game it belongs to
 		std::shared_ptr<game> game_ptr;
-		player* other_player_ptr = nullptr;
 		char player_num = '0';
-		for (auto& game_ : games_) {
-			if (game_->get_players()[0]->get_id() == sender) {
-				game_ptr = game_;
-				player_num = '1';
-				other_player_ptr = game_->get_players()[1];
-				break;
-			} else if (game_->get_players()[1]->get_id() == sender) {
-				game_ptr = game_;
-				player_num = '2';
-				other_player_ptr = game_->get_players()[0];
-				break;
-			}
+		{
+			std::scoped_lock lock(players_mutex_);
+			auto it = std::find_if(players_.begin(), players_.end(), [sender](player& player_) {
+				return player_.get_id() == sender;
+			});
+			if (it == players_.end())
+				return;
+			if (!it->in_game || !it->game_)
+				return; // ignore message since player isn't in a game right now
+			game_ptr = it->game_;
+			player_num = it->player_num;
 		}
-		if (!game_ptr) {
-			printw("Error: Player in_game = true, yet can't find a game with the player in it.\n");
-			refresh();
+		if (!game_ptr->get_strand().running_in_this_thread()) {
+			// the connection's strand migration hasn't caught up with this read yet
+			// so we hand the message over to the game's strand
+			std::string copy(body, length);
+			boost::asio::post(game_ptr->get_strand(), [this, sender, copy]() mutable {
+				read_handler(sender, &copy[0], copy.length());
+			});
 			return;
 		}
+		// from here on we are on the game's strand, so nothing else can touch game_ptr
+		if (game_ptr->get_turn() == '0' || game_ptr->is_finished()) {
+			return; // the game is already over
+		}
 		if (!strncmp(body, "#msg ", 5)) {
 			// sender has sent a message that we need to forward to their opponent
 			// first, we need to process the message a little bit
@@ -340,99 +397,131 @@ private:
 			ss << "#msg " << player_num << " " << body+5;
 			const std::string& tmp = ss.str();
 			const char* reply = tmp.c_str();
-			server_ptr_->send_to(other_player_ptr->get_id(), reply, tmp.length());
-			server_ptr_->send_to(sender, reply, tmp.length());
+			game_ptr->send_to_players(reply, tmp.length());
 		} else if (isdigit(body[0])) {
 			// player submitting a move for their game
-			// let's check to make sure that it's their turn
-			// and that the move is valid
-			if (player_num != game_ptr->get_turn()) {
-				printw("Client %u attempted a move when it wasn't their turn.\n", sender);
-				char reply[] = "#msg s It is not your turn to make a move.";
-				server_ptr_->send_to(sender, reply, strlen(reply));
-				refresh();
-				return;
-			} else {
-				std::size_t move = body[0] - '0';
-				if (move >= game_ptr->cols) {
-					// move out of bounds
-					printw("Client %u has attempted a move that is out of bounds.\n", sender);
-					char reply[] = "#msg s The move you have chosen is out of bounds.\n";
-					server_ptr_->send_to(sender, reply, strlen(reply));
-					refresh();
-					return;
-				}
-				// now make sure there is room in that column
-				game::tile (*board)[game::cols] = game_ptr->get_board();
-				if (board[0][move] != game::tile::empty) {
-					// no room left in that column
-					printw("Client %u has attempted a move on a full column.\n", sender);
-					char reply[] = "#msg s The column you have chosen is already full.\n";
-					server_ptr_->send_to(sender, reply, strlen(reply));
-					refresh();
-					return;
+			process_move(game_ptr, sender, player_num, body[0] - '0');
+		}
+	}
+	
+	void process_move(std::shared_ptr<game> game_ptr, std::size_t sender, char player_num, std::size_t move) {
+		// Precondition: running on game_ptr's strand
+		// used for moves from clients as well as moves from the bot
+		if (game_ptr->is_finished()) {
+			return; // a player left, the rest of game_over() is still on its way to the strand
+		}
+		// let's check to make sure that it's their turn
+		// and that the move is valid
+		if (player_num != game_ptr->get_turn()) {
+			print("Client %u attempted a move when it wasn't their turn.\n", sender);
+			char reply[] = "#msg s It is not your turn to make a move.";
+			server_ptr_->send_to(sender, reply, strlen(reply));
+			return;
+		}
+		if (move >= game_ptr->cols) {
+			// move out of bounds
+			print("Client %u has attempted a move that is out of bounds.\n", sender);
+			char reply[] = "#msg s The move you have chosen is out of bounds.\n";
+			server_ptr_->send_to(sender, reply, strlen(reply));
+			return;
+		}
+		// now make sure there is room in that column
+		game::tile (*board)[game::cols] = game_ptr->get_board();
+		if (board[0][move] != game::tile::empty) {
+			// no room left in that column
+			print("Client %u has attempted a move on a full column.\n", sender);
+			char reply[] = "#msg s The column you have chosen is already full.\n";
+			server_ptr_->send_to(sender, reply, strlen(reply));
+			return;
+		}
+		// execute the move
+		// then check to see if the game is over
+		for (int i = game_ptr->rows-1; i >= 0; i--) {
+			// look for the lowest empty cell in the chosen column
+			if (board[i][move] == game::tile::empty) {
+				// this is where the move will go
+				game_ptr->end_turn(player_num);
+				game_ptr->apply_move(player_num, i, move);
+				game_ptr->toggle_turn();
+				bool game_won = game_ptr->check_for_win(player_num);
+				bool game_draw = game_ptr->check_for_draw();
+				
+				// let's send each player the current board state
+				std::stringstream ss;
+				
+				if (game_won) {
+					game_ptr->game_over();
+					ss << "#win " << player_num << " ";
+				} else if (game_draw) {
+					game_ptr->game_over();
+					ss << "#draw ";
+				} else {
+					ss << "#turn " << game_ptr->get_turn() << " ";
 				}
-				// execute the move
-				// then check to see if the game is over
-				for (int i = game_ptr->rows-1; i >= 0; i--) {
-					// look for the lowest empty cell in the chosen column
-					if (board[i][move] == game::tile::empty) {
-						// this is where the move will go
-						game_ptr->apply_move(player_num, i, move);
-						game_ptr->toggle_turn();
-						bool game_won = game_ptr->check_for_win(player_num);
-						bool game_draw = game_ptr->check_for_draw();
-						
-						// let's send each player the current board state
-						std::stringstream ss;
-						
-						if (game_won) {
-							game_ptr->game_over();
-							ss << "#win " << player_num << " ";
-						} else if (game_draw) {
-							game_ptr->game_over();
-							ss << "#draw ";
-						} else {
-							ss << "#turn " << game_ptr->get_turn() << " ";
-						}
-						
-						for (int row = 0; row < game_ptr->rows; row++) {
-							for (int col = 0; col < game_ptr->cols; col++) {
-								if (board[row][col] == game::tile::empty)
-									ss << ' ';
-								else if (board[row][col] == game::tile::x)
-									ss << 'x';
-								else
-									ss << 'o';
-							}
-						}
-						
-						const std::string& tmp = ss.str();
-						const char* reply = tmp.c_str();
-						server_ptr_->send_to(sender, reply, tmp.length());
-						server_ptr_->send_to(other_player_ptr->get_id(), reply, tmp.length());
-						
-						printw("Client %u move processed.\n", sender);
-						
-						break;
-					}
+				
+				game_ptr->write_board(ss);
+				
+				const std::string& tmp = ss.str();
+				const char* reply = tmp.c_str();
+				game_ptr->send_to_players(reply, tmp.length());
+				
+				if (sender == player::bot_id) {
+					print("Bot move processed.\n");
+				} else {
+					print("Client %u move processed.\n", sender);
 				}
+				
+				break;
 			}
-			refresh();
+		}
+		
+		if (game_ptr->get_turn() == '0') {
+			stop_turn_clock(game_ptr);
+			return;
+		}
+		start_turn_clock(game_ptr);
+		if (game_ptr->get_turn() == '2' && game_ptr->has_bot()) {
+			request_bot_move(game_ptr);
 		}
 	}
+	
+	void request_bot_move(std::shared_ptr<game> game_ptr) {
+		// Precondition: running on game_ptr's strand
+		// The search runs on ai_pool_ with a snapshot of the board, then the result
+		// is posted back to the game's strand. By then the game may have ended: the human may
+		// have disconnected, which marks the game finished straight away but only resets the turn
+		// once the posted game_over() runs, so it's is_finished() that has to be checked.
+		connect4_ai::position pos = game_ptr->get_position();
+		boost::asio::post(ai_pool_, [this, game_ptr, pos]() {
+			int col = game_ptr->get_ai()->choose_move(pos, bot_move_time);
+			boost::asio::post(game_ptr->get_strand(), [this, game_ptr, col]() {
+				if (col < 0 || game_ptr->is_finished() || game_ptr->get_turn() != '2') {
+					return;
+				}
+				process_move(game_ptr, player::bot_id, '2', col);
+			});
+		});
+	}
 
+	// games_ and players_ are only modified during matchmaking and disconnects,
+	// both while holding players_mutex_
 	std::vector<std::shared_ptr<game>> games_;
 	std::list<player> players_;
 	std::mutex players_mutex_;
+	std::mutex screen_mutex_;
+	boost::asio::thread_pool ai_pool_;
 };
 
 int main() {
 	try {
 		initscr();
 		scrollok(stdscr, TRUE);
-		connect4_server serv(1234);
+		start_color();
+		init_pair(1, COLOR_MAGENTA, COLOR_BLACK);
+		init_pair(2, COLOR_CYAN, COLOR_BLACK);
+		connect4_server serv(1234, std::thread::hardware_concurrency());
 		serv.start();
+		endwin();
 	} catch (std::exception& e) {
 		std::cerr << e.what() << std::endl;
 		endwin();
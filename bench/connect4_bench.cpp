@@ -0,0 +1,260 @@
+#include "connect4_game.hpp"
+#include "net_client.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+
+A load testing harness for the connect4 server.
+
+The default mode plays randomized games through the real game class from connect4_game.hpp
+on every core, and reports how many moves per second one box can process along with how
+much a call to check_for_win costs and how much memory each game takes up.
+Every move is also checked against the bitboard win detection in connect4_ai.hpp,
+so a regression in apply_move or check_for_win makes the benchmark fail.
+
+Usage:
+	connect4_bench [games] [threads]
+	connect4_bench --loopback [pairs] [port]
+
+The loopback mode connects pairs of clients to a connect4_server that is already running
+on 127.0.0.1 and has each pair play one random game through the full message path.
+Use an even number of clients so that nobody is left waiting for the bot.
+
+*/
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct thread_result {
+	std::uint64_t games = 0;
+	std::uint64_t moves = 0;
+	std::uint64_t wins = 0;
+	std::uint64_t draws = 0;
+	std::uint64_t mismatches = 0;
+};
+
+int random_open_column(game& game_, std::mt19937& rng) {
+	game::tile (*board)[game::cols] = game_.get_board();
+	int open[game::cols];
+	int count = 0;
+	for (int col = 0; col < game::cols; col++) {
+		if (board[0][col] == game::tile::empty) {
+			open[count++] = col;
+		}
+	}
+	return open[rng() % count];
+}
+
+int play_move(game& game_, char player_num, int col) {
+	// same lookup as connect4_server::process_move, returns the row the tile landed in
+	game::tile (*board)[game::cols] = game_.get_board();
+	for (int row = game::rows-1; row >= 0; row--) {
+		if (board[row][col] == game::tile::empty) {
+			game_.apply_move(player_num, row, col);
+			return row;
+		}
+	}
+	return -1;
+}
+
+void simulate(std::uint64_t games, unsigned seed, net_strand strand, thread_result& result) {
+	std::mt19937 rng(seed);
+	player p1(0);
+	player p2(1);
+	for (std::uint64_t i = 0; i < games; i++) {
+		game game_(&p1, &p2, nullptr, strand);
+		game_.clear_board();
+		connect4_ai::position pos; // reference implementation to check the game class against
+		while (true) {
+			char player_num = game_.get_turn();
+			int col = random_open_column(game_, rng);
+			bool expected_win = pos.is_winning_move(col);
+			play_move(game_, player_num, col);
+			pos.play(col);
+			game_.toggle_turn();
+			result.moves++;
+			bool won = game_.check_for_win(player_num);
+			if (won != expected_win) {
+				result.mismatches++;
+			}
+			if (won || expected_win) {
+				result.wins++;
+				break;
+			}
+			if (game_.check_for_draw()) {
+				result.draws++;
+				break;
+			}
+		}
+		result.games++;
+	}
+}
+
+double measure_win_check(net_strand strand) {
+	// Times check_for_win by itself on a set of half played boards.
+	// Returns the average number of nanoseconds per call.
+	enum { boards = 256 };
+	enum { half_game = game::rows * game::cols / 2 };
+	std::mt19937 rng(12345);
+	player p1(0);
+	player p2(1);
+	std::vector<std::unique_ptr<game>> games;
+	for (int i = 0; i < boards; i++) {
+		games.push_back(std::make_unique<game>(&p1, &p2, nullptr, strand));
+		game& game_ = *games.back();
+		game_.clear_board();
+		for (int move = 0; move < half_game; move++) {
+			play_move(game_, game_.get_turn(), random_open_column(game_, rng));
+			game_.toggle_turn();
+		}
+	}
+	const std::uint64_t calls = 4000000;
+	std::uint64_t found = 0;
+	auto start = bench_clock::now();
+	for (std::uint64_t i = 0; i < calls; i++) {
+		found += games[i % boards]->check_for_win((i & 1) ? '2' : '1');
+	}
+	auto elapsed = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	// keeps the compiler from throwing the loop away
+	if (found == calls + 1) std::cout << found << std::endl;
+	return elapsed / calls;
+}
+
+int run_local(std::uint64_t games, unsigned threads) {
+	boost::asio::io_context io_context; // only needed so that each game can have a strand
+	std::vector<thread_result> results(threads);
+	std::vector<std::thread> workers;
+
+	auto start = bench_clock::now();
+	for (unsigned i = 0; i < threads; i++) {
+		std::uint64_t share = games / threads + (i < games % threads ? 1 : 0);
+		net_strand strand = boost::asio::make_strand(io_context);
+		workers.emplace_back(simulate, share, 1000 + i, strand, std::ref(results[i]));
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	thread_result total;
+	for (auto& result : results) {
+		total.games += result.games;
+		total.moves += result.moves;
+		total.wins += result.wins;
+		total.draws += result.draws;
+		total.mismatches += result.mismatches;
+	}
+
+	double win_check_ns = measure_win_check(boost::asio::make_strand(io_context));
+
+	std::cout << "threads:             " << threads << "\n";
+	std::cout << "games:               " << total.games << " (" << total.wins << " won, " << total.draws << " drawn)\n";
+	std::cout << "moves:               " << total.moves << "\n";
+	std::cout << "elapsed:             " << seconds << " s\n";
+	std::cout << "games per second:    " << total.games / seconds << "\n";
+	std::cout << "moves per second:    " << total.moves / seconds << "\n";
+	std::cout << "check_for_win:       " << win_check_ns << " ns per call\n";
+	std::cout << "memory per game:     " << sizeof(game) << " bytes for the game, "
+	          << 2 * sizeof(player) << " bytes for its players\n";
+	std::cout << "extra for bot games: " << connect4_ai().memory_usage() + sizeof(connect4_ai) + sizeof(player) << " bytes\n";
+	std::cout << "win check mismatches: " << total.mismatches << std::endl;
+
+	return total.mismatches == 0 ? 0 : 1;
+}
+
+class loopback_player {
+	// a client that plays random moves as soon as it is its turn
+public:
+	loopback_player(boost::asio::io_context& io_context, std::string& ip, std::size_t port,
+	                std::atomic<std::uint64_t>& moves, std::atomic<std::size_t>& finished)
+	  : client_(io_context, ip, port, std::bind(&loopback_player::read_handler, this, std::placeholders::_1, std::placeholders::_2)),
+	    rng_(std::random_device()()), your_id_('0'), moves_(moves), finished_(finished) {
+	}
+
+private:
+	void read_handler(char* body, std::size_t length) {
+		if (!strncmp(body, "#start ", 7)) {
+			your_id_ = body[7];
+			if (your_id_ == '1') {
+				move(nullptr);
+			}
+		} else if (!strncmp(body, "#turn ", 6) && length >= 8 + game::rows * game::cols) {
+			moves_++;
+			if (body[6] == your_id_) {
+				move(body + 8);
+			}
+		} else if (!strncmp(body, "#win ", 5) || !strncmp(body, "#draw ", 6)) {
+			moves_++;
+			finished_++;
+		}
+	}
+
+	void move(const char* board) {
+		// the first row of the board string is the top row, so a column is open while its top cell is
+		char open[game::cols];
+		int count = 0;
+		for (int col = 0; col < game::cols; col++) {
+			if (!board || board[col] == ' ') {
+				open[count++] = '0' + col;
+			}
+		}
+		client_.send(&open[rng_() % count], 1);
+	}
+
+	net_client client_;
+	std::mt19937 rng_;
+	char your_id_;
+	std::atomic<std::uint64_t>& moves_;
+	std::atomic<std::size_t>& finished_;
+};
+
+int run_loopback(std::size_t pairs, std::size_t port) {
+	boost::asio::io_context io_context;
+	std::string ip("127.0.0.1");
+	std::atomic<std::uint64_t> moves(0);
+	std::atomic<std::size_t> finished(0);
+
+	std::vector<std::unique_ptr<loopback_player>> players;
+	auto start = bench_clock::now();
+	for (std::size_t i = 0; i < pairs * 2; i++) {
+		players.push_back(std::make_unique<loopback_player>(io_context, ip, port, moves, finished));
+	}
+	std::thread io_thread([&io_context]() { io_context.run(); });
+
+	// both players see the final message so a game is finished once it's counted twice
+	while (finished < pairs * 2) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	io_context.stop();
+	io_thread.join();
+
+	std::cout << "games:            " << pairs << "\n";
+	std::cout << "moves:            " << moves / 2 << "\n";
+	std::cout << "elapsed:          " << seconds << " s\n";
+	std::cout << "moves per second: " << moves / 2 / seconds << std::endl;
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	try {
+		if (argc > 1 && !strcmp(argv[1], "--loopback")) {
+			std::size_t pairs = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100;
+			std::size_t port = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1234;
+			return run_loopback(pairs, port);
+		}
+		std::uint64_t games = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+		unsigned threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+		if (threads == 0) threads = 1;
+		return run_local(games, threads);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+	}
+	return 1;
+}
@@ -0,0 +1,183 @@
+#include "net_server.hpp"
+#include "net_client.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+/*
+
+A benchmark for the message path of net_server and net_client.
+
+An echo server and a set of clients run in this one process and talk over loopback.
+Every client keeps one message in flight: it sends, waits for the echo, and sends again
+from inside its read_handler. After a warm up round, the benchmark counts every call to
+operator new in the process while the clients exchange messages, and reports how many
+there were per round trip along with the round trip rate.
+
+Once the connections are warmed up, a message should go through the server and the client
+without touching the heap at all: the handlers for reads and writes live in each
+connection's handler_memory, and the write queues are ring buffers that have already grown
+(see net_handler_memory.hpp and message_queue in net_message.hpp). The benchmark fails if
+anything allocates per message.
+Heartbeats are turned off so that the pings and timers don't show up in the count.
+
+Usage:
+	net_bench [round trips per client] [clients] [port]
+
+*/
+
+typedef std::chrono::steady_clock bench_clock;
+
+namespace {
+	std::atomic<std::uint64_t> allocations(0);
+}
+
+void* operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* pointer = std::malloc(size ? size : 1)) {
+		return pointer;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+	std::free(pointer);
+}
+
+class echo_server : public application_server {
+public:
+	echo_server(const server_options& options)
+	  : application_server(options) {
+		heartbeat_options heartbeat;
+		heartbeat.enabled = false;
+		server_ptr_->set_heartbeat(heartbeat);
+	}
+
+private:
+	void accept_handler(std::size_t client_id, bool connect) {
+	}
+
+	void read_handler(std::size_t sender, char* body, std::size_t length) {
+		server_ptr_->send_to(sender, body, length);
+	}
+};
+
+class echo_client {
+	// sends the same message back and forth until it has done its share of round trips
+public:
+	echo_client(boost::asio::io_context& io_context, std::string& ip, std::size_t port,
+	            std::atomic<std::uint64_t>& round_trips)
+	  : client_(io_context, ip, port, std::bind(&echo_client::read_handler, this, std::placeholders::_1, std::placeholders::_2)),
+	    round_trips_(round_trips), remaining_(0) {
+	}
+
+	void run(std::uint64_t count) {
+		// called from the main thread while the client is idle
+		remaining_ = count;
+		client_.send(message, sizeof(message) - 1);
+	}
+
+private:
+	static constexpr char message[] = "the quick brown fox jumps over the lazy dog";
+
+	void read_handler(char* body, std::size_t length) {
+		round_trips_++;
+		if (--remaining_ > 0) {
+			client_.send(body, length);
+		}
+	}
+
+	net_client client_;
+	std::atomic<std::uint64_t>& round_trips_;
+	std::atomic<std::uint64_t> remaining_;
+};
+
+void run_round(std::vector<std::unique_ptr<echo_client>>& clients, std::atomic<std::uint64_t>& round_trips, std::uint64_t each) {
+	std::uint64_t target = round_trips + clients.size() * each;
+	for (auto& client : clients) {
+		client->run(each);
+	}
+	while (round_trips < target) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	try {
+		std::uint64_t each = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+		std::size_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 8;
+		server_options options(argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1240);
+		options.address = "127.0.0.1";
+		if (each < 2 || count == 0) {
+			std::cerr << "need at least 2 round trips and 1 client" << std::endl;
+			return 1;
+		}
+
+		echo_server server(options);
+		std::thread server_thread([&server]() { server.start(); });
+
+		boost::asio::io_context io_context;
+		std::string ip("127.0.0.1");
+		std::atomic<std::uint64_t> round_trips(0);
+		std::vector<std::unique_ptr<echo_client>> clients;
+		for (std::size_t i = 0; i < count; i++) {
+			clients.push_back(std::make_unique<echo_client>(io_context, ip, options.port, round_trips));
+		}
+		auto work = boost::asio::make_work_guard(io_context);
+		std::thread io_thread([&io_context]() { io_context.run(); });
+
+		// the first round connects everyone and lets every buffer and cache grow to its working size
+		run_round(clients, round_trips, 1000);
+
+		std::uint64_t before = allocations;
+		auto start = bench_clock::now();
+		run_round(clients, round_trips, each);
+		double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+		std::uint64_t allocated = allocations - before;
+		// starting each client's round (from this thread) is the only thing that should allocate
+		std::uint64_t expected = 2 * count;
+		std::uint64_t messages = each * count;
+
+		work.reset();
+		io_context.stop();
+		io_thread.join();
+		server.stop();
+		server_thread.join();
+
+		std::cout << "clients:                 " << count << "\n";
+		std::cout << "round trips:             " << messages << "\n";
+		std::cout << "elapsed:                 " << seconds << " s\n";
+		std::cout << "round trips per second:  " << messages / seconds << "\n";
+		std::cout << "allocations:             " << allocated << " (" << double(allocated) / messages << " per round trip)" << std::endl;
+		if (allocated > expected) {
+			std::cerr << "the message path allocated, expected at most " << expected << std::endl;
+			return 1;
+		}
+		return 0;
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+	}
+	return 1;
+}
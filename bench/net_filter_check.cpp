@@ -0,0 +1,116 @@
+#include "net_filter.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+
+A differential check of the word matching in net_filter.cpp.
+
+word_automaton finds every word in one pass over the text with a DFA built from the list,
+which is easy to get subtly wrong: a failure link that misses a word ending inside a longer one,
+a word boundary looked at after an earlier word has already been masked over it. This check
+builds automata from random lists of short words over a small alphabet (so words overlap,
+contain each other and share prefixes all the time), masks random texts with them, and compares
+the result against the obvious way of doing it: try every word at every position. Both with and
+without whole_words, and contains() has to agree with whether anything was masked.
+
+The seed is fixed, so a failure can be run again.
+
+Usage:
+	net_filter_check [lists]
+
+*/
+
+namespace {
+	unsigned char fold(unsigned char c) {
+		return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	}
+
+	bool is_word_byte(unsigned char c) {
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+	}
+
+	// masks every occurrence of every word, looking at each word at each position, returns how many there were
+	std::size_t naive_mask(const std::vector<std::string>& words, std::string& text, bool whole_words) {
+		std::string original = text;
+		std::set<std::string> distinct;
+		for (const std::string& word : words) {
+			std::string folded;
+			for (unsigned char c : word) {
+				folded += static_cast<char>(fold(c));
+			}
+			distinct.insert(folded);
+		}
+		std::size_t found = 0;
+		for (const std::string& word : distinct) {
+			for (std::size_t start = 0; start + word.size() <= original.size(); start++) {
+				bool match = true;
+				for (std::size_t i = 0; i < word.size() && match; i++) {
+					match = fold(original[start + i]) == static_cast<unsigned char>(word[i]);
+				}
+				std::size_t end = start + word.size();
+				if (!match || (whole_words && ((start > 0 && is_word_byte(original[start - 1]))
+				                               || (end < original.size() && is_word_byte(original[end]))))) {
+					continue;
+				}
+				text.replace(start, word.size(), word.size(), '*');
+				found++;
+			}
+		}
+		return found;
+	}
+
+	std::string random_string(std::mt19937& rng, std::size_t length, const char* alphabet, std::size_t letters) {
+		std::string s;
+		for (std::size_t i = 0; i < length; i++) {
+			s += alphabet[rng() % letters];
+		}
+		return s;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t lists = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+	// a few letters in both cases, a space, a digit, punctuation and a byte of a UTF-8 sequence
+	static const char word_alphabet[] = "abAB c1";
+	static const char text_alphabet[] = "abAB c1.x\xC3";
+
+	std::mt19937 rng(3);
+	std::size_t texts = 0;
+	std::size_t mismatches = 0;
+	for (std::size_t i = 0; i < lists; i++) {
+		std::vector<std::string> words(rng() % 8 + 1);
+		for (std::string& word : words) {
+			word = random_string(rng, rng() % 4 + 1, word_alphabet, sizeof(word_alphabet) - 1);
+		}
+		word_automaton automaton(words);
+		for (int t = 0; t < 4; t++) {
+			std::string text = random_string(rng, rng() % 40, text_alphabet, sizeof(text_alphabet) - 1);
+			for (bool whole_words : { false, true }) {
+				std::string expected = text;
+				std::size_t expected_found = naive_mask(words, expected, whole_words);
+				std::string masked = text;
+				std::size_t found = automaton.mask(&masked[0], masked.size(), whole_words);
+				bool contains = automaton.contains(text.data(), text.size(), whole_words);
+				texts++;
+				if (masked != expected || found != expected_found || contains != (expected_found > 0)) {
+					if (mismatches++ < 10) {
+						std::printf("whole_words %d, text \"%s\": masked \"%s\" (%zu), expected \"%s\" (%zu), contains %d, words",
+						            whole_words, text.c_str(), masked.c_str(), found, expected.c_str(), expected_found, contains);
+						for (const std::string& word : words) {
+							std::printf(" \"%s\"", word.c_str());
+						}
+						std::printf("\n");
+					}
+				}
+			}
+		}
+	}
+	std::printf("%zu lists, %zu texts, %zu mismatches\n", lists, texts, mismatches);
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+// the scalar, SSE and AVX2 versions live in an anonymous namespace, so the check is built with them
+#include "../lib/net_text.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+
+A differential check of the vector code in net_text.cpp.
+
+Random strings are run through the scalar, SSE and AVX2 versions of text_valid_utf8,
+text_is_identifier and text_find, and the check fails if the vector versions ever disagree
+with the scalar one. The strings are made of pieces picked to sit on the edges of UTF-8:
+every length of sequence, overlong forms, surrogates, the last code point and the first
+one past it, sequences cut short and stray continuation bytes, and now and then a few bytes
+overwritten with anything at all. They are up to 80 bytes long, so the tails that don't fill
+a whole vector get checked as much as the vectors themselves.
+
+A version the processor doesn't have is skipped (and said so), the scalar one is always there.
+The seed is fixed, so a failure can be run again.
+
+Usage:
+	net_text_check [strings]
+
+*/
+
+namespace {
+	const std::vector<std::string> pieces = {
+		// valid ones first, the first ten are what mostly valid text is made of
+		"a", "Z", "0", " ", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xF4\x8F\xBF\xBF",
+		"\xE0\xA0\x80", "\xF0\x90\x80\x80",
+		// stray continuation bytes, overlong forms, surrogates, past U+10FFFF, bytes that never appear
+		"\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80",
+		"\xF8", "\xFF",
+		// cut short
+		"\xC3", "\xE2\x82", "\xF0\x9F\x98"
+	};
+
+	std::string random_text(std::mt19937_64& rng) {
+		std::string text;
+		std::size_t length = rng() % 80;
+		bool mostly_valid = rng() % 4 != 0;
+		while (text.size() < length) {
+			text += pieces[mostly_valid ? rng() % 10 : rng() % pieces.size()];
+		}
+		if (!text.empty() && rng() % 5 == 0) {
+			for (int i = 0; i < 3; i++) {
+				text[rng() % text.size()] = static_cast<char>(rng());
+			}
+		}
+		return text;
+	}
+
+	std::string random_identifier(std::mt19937_64& rng) {
+		static const char characters[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		std::string text(rng() % 100, 'x');
+		for (char& c : text) {
+			c = characters[rng() % 62];
+		}
+		if (!text.empty() && rng() % 2 == 0) {
+			text[rng() % text.size()] = static_cast<char>(rng());
+		}
+		return text;
+	}
+
+	void print_bytes(const std::string& text) {
+		for (unsigned char c : text) {
+			std::printf(" %02x", c);
+		}
+		std::printf("\n");
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::size_t strings = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+#ifdef NET_TEXT_X86
+	__builtin_cpu_init();
+	bool avx2 = __builtin_cpu_supports("avx2");
+	bool sse = __builtin_cpu_supports("sse4.2");
+#else
+	bool avx2 = false;
+	bool sse = false;
+#endif
+	if (!avx2) std::printf("no AVX2 on this processor, skipping it\n");
+	if (!sse) std::printf("no SSE4.2 on this processor, skipping it\n");
+
+	std::mt19937_64 rng(42);
+	std::size_t mismatches = 0;
+	auto mismatch = [&mismatches](const char* what, const char* version, const std::string& text) {
+		if (mismatches++ < 10) {
+			std::printf("%s: %s disagrees with scalar on", what, version);
+			print_bytes(text);
+		}
+	};
+	for (std::size_t i = 0; i < strings; i++) {
+		std::string text = i % 4 == 3 ? random_identifier(rng) : random_text(rng);
+		const char* data = text.data();
+		std::size_t length = text.size();
+
+		bool valid = valid_utf8_scalar(data, length);
+		bool identifier = is_identifier_scalar(data, length);
+		char delimiter = "a \xC3"[rng() % 3];
+		std::size_t found = find_scalar(data, length, delimiter);
+#ifdef NET_TEXT_X86
+		if (avx2 && valid_utf8_avx2(data, length) != valid) mismatch("text_valid_utf8", "avx2", text);
+		if (sse && valid_utf8_sse(data, length) != valid) mismatch("text_valid_utf8", "sse4.2", text);
+		if (avx2 && is_identifier_avx2(data, length) != identifier) mismatch("text_is_identifier", "avx2", text);
+		if (sse && is_identifier_sse(data, length) != identifier) mismatch("text_is_identifier", "sse4.2", text);
+		if (avx2 && find_avx2(data, length, delimiter) != found) mismatch("text_find", "avx2", text);
+		if (sse && find_sse(data, length, delimiter) != found) mismatch("text_find", "sse4.2", text);
+#else
+		(void)valid;
+		(void)identifier;
+		(void)found;
+#endif
+	}
+	std::printf("%zu strings, %zu mismatches, text_implementation() is %s\n", strings, mismatches, text_implementation());
+	return mismatches == 0 ? 0 : 1;
+}
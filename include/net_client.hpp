@@ -1,12 +1,14 @@
 #ifndef _NET_CLIENT_HPP_
 #define _NET_CLIENT_HPP_
 
-#include <deque>
+#include <chrono>
+#include <random>
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 #include "net_message.hpp"
+#include "net_handler_memory.hpp"
 
 /*
 
@@ -69,18 +71,43 @@ private:
 	std::size_t max_body_length_;
 };
 
+The connection is made in the background, and if it drops (or the server isn't up yet)
+net_client keeps trying again with exponential backoff and jitter (see reconnect_options).
+Messages sent in the meantime are queued and go out once the client is back.
+
+Every connection starts with a session handshake. The client sends HELO with the session token it
+was given last time (if any) and how many data frames it has received in that session,
+and the server answers WELC with the token to use and how many frames it has received from the client.
+If the server still remembers the session, it's resumed: the client keeps its id on the server
+(so its name, room, game, ... all carry on) and both sides resend whatever the other one
+didn't get. Each side keeps the frames it has written until the other side acknowledges them
+with ACKN, which is sent every net_message::ack_every data frames.
+If the server didn't know the session (it was restarted, or the client was gone for too long),
+the client starts over as a new client. Frames that were written to the old server are not sent again,
+since there is no way to know whether it handled them.
+A server that doesn't keep sessions answers with a token of all zeros, and the client
+doesn't hold on to anything for it.
+
 */
 
+struct reconnect_options {
+	// The n'th attempt in a row waits a random time between 0 and min(max_delay, initial_delay * 2^n).
+	// The randomness matters as much as the backoff: clients that all lost the same server
+	// at the same moment would otherwise all come back at the same moment too.
+	bool enabled = true;
+	std::chrono::milliseconds initial_delay{100};
+	std::chrono::milliseconds max_delay{10000};
+	std::size_t max_attempts = 0; // 0 keeps trying forever
+	std::size_t replay_frames = 1024; // how many written frames are kept until the server acknowledges them
+};
+
 class net_client;
 
 class application_client {
 	// base class to be inherited by any applications that want
 	// to use the net_client class
 public:
-	application_client(std::string& ip, std::size_t port)
-	  : client_ptr_(std::make_shared<net_client>(io_context_, ip, port,
-	      std::bind(&application_client::read_handler, this, std::placeholders::_1, std::placeholders::_2))) {
-	}
+	application_client(std::string& ip, std::size_t port);
 	
 	void start() {
 		io_thread_ptr_ = std::make_shared<std::thread>([this]() { io_context_.run(); });
@@ -96,6 +123,11 @@ private:
 		// it passes the derived version rather than this one
 		std::cout << "You need to implement your own version of read_handler." << std::endl;
 	}
+	
+	virtual void reconnect_handler(bool resumed) {
+		// called after the client got back to the server, resumed is false if it had to start over
+		// as a new client (in which case anything like a chosen name has to be set up again)
+	}
 protected:
 	std::shared_ptr<std::thread> io_thread_ptr_;
 	boost::asio::io_context io_context_;
@@ -104,27 +136,71 @@ protected:
 
 class net_client {
 public:
+	// with reconnecting turned off, the constructor throws if the server can't be reached (like it used to)
 	net_client(boost::asio::io_context& io_context, std::string& ip, std::size_t port,
-	           std::function<void (char*, std::size_t)> read_handler);
+	           std::function<void (char*, std::size_t)> read_handler,
+	           const reconnect_options& options = reconnect_options());
 			   
+	// can be called from any thread, the io_context is expected to be run by a single thread
 	void send(const char* body, std::size_t length);
+	// should be set before the io_context starts running, see application_client::reconnect_handler
+	void set_reconnect_handler(std::function<void (bool)> handler);
 			   
 	std::size_t get_max_body_length();
 private:
-	void connect(std::string& ip, std::size_t port);
+	enum state_type { disconnected, connecting, handshaking, established };
+	
+	// Every attempt to connect gets a new generation, and every handler checks it first
+	// so that completions from a socket that has since been replaced are ignored.
+	void connect();
+	void handle_connect(const boost::system::error_code e, std::uint64_t generation);
+	void handshake();
+	void connection_lost(const boost::system::error_code e);
+	void schedule_reconnect();
 	void read_header();
-	void handle_read_header(const boost::system::error_code e, std::size_t bytes_transferred);
+	void handle_read_header(const boost::system::error_code e, std::size_t bytes_transferred, std::uint64_t generation);
 	void read_body();
-	void handle_read_body(const boost::system::error_code e, std::size_t bytes_transferred);
+	void handle_read_body(const boost::system::error_code e, std::size_t bytes_transferred, std::uint64_t generation);
+	void handle_welcome();
+	void handle_ack(std::uint64_t count);
+	void queue_message(net_message msg);
 	void do_write();
+	void handle_write(const boost::system::error_code e, std::uint64_t generation);
 
 	boost::asio::io_context& io_context_;
 	boost::asio::ip::tcp::socket socket_;
+	boost::asio::ip::tcp::endpoint endpoint_;
+	boost::asio::steady_timer retry_timer_;
+	reconnect_options options_;
+	std::mt19937 rng_;
+	state_type state_;
+	std::uint64_t generation_;
+	std::size_t attempts_;
+	bool writing_; // the write queue can hold messages without a write in flight while the client is away
+	bool reconnected_;
+	
+	// session state, see the top of the file
+	bool has_token_;
+	char token_[net_message::token_length];
+	std::uint64_t received_; // data frames received from the server in this session
+	std::uint64_t acked_; // data frames the server has confirmed receiving
+	message_queue unacked_; // written data frames that the server hasn't confirmed yet
+	net_message hello_message_;
 	
 	net_message read_message_;
-	std::deque<net_message> write_messages_;
+	message_queue write_messages_;
+	// for the read and the queued write that are in flight (see net_handler_memory.hpp)
+	handler_memory read_memory_;
+	handler_memory write_memory_;
 	
 	std::function<void (char*, std::size_t)> read_handler_;
+	std::function<void (bool)> reconnect_handler_;
 };
 
+inline application_client::application_client(std::string& ip, std::size_t port)
+  : client_ptr_(std::make_shared<net_client>(io_context_, ip, port,
+      std::bind(&application_client::read_handler, this, std::placeholders::_1, std::placeholders::_2))) {
+	client_ptr_->set_reconnect_handler(std::bind(&application_client::reconnect_handler, this, std::placeholders::_1));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef _NET_COALESCER_HPP_
+#define _NET_COALESCER_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "net_message.hpp"
+#include "net_server.hpp"
+
+/*
+
+Broadcasts that wait a moment for each other.
+
+Sending every message to every client as soon as it arrives costs, for M messages and N clients,
+M x N messages queued and M x N writes. In a busy room most of those writes carry one short line.
+A broadcast_coalescer sits between an application and net_server::send_to_all. With coalescing
+turned on, a message doesn't go out straight away. It is appended to a batch (see net_message.hpp),
+and the first message of the batch starts a timer. When the window runs out, or once the batch
+has grown to max_bytes, the whole batch goes to every client as one message. That is one queue
+entry and one write per client for everything that arrived in the window.
+
+That makes each message wait up to window longer than it would have otherwise, in exchange
+for far fewer writes. It only pays off when messages come in faster than one a window, so it's
+off by default, and it can be turned on or off (or retuned) at any time. An application with
+several rooms keeps one coalescer per room and decides room by room.
+
+Messages sent by other means (send_to, or a send_to_all that doesn't go through the coalescer)
+don't wait. Anything that has to stay in order with the room should call flush() first:
+
+	room.send(msg); // may wait up to the window
+	...
+	room.flush();
+	server.send_to_all(announcement); // goes out after everything above
+
+The window is kept with a steady_timer of its own, not the server's timer wheel,
+because the wheel ticks every 10ms and a useful window is a few milliseconds at most.
+
+A broadcast_coalescer is thread safe, and messages go out in the order they were sent.
+
+*/
+
+struct coalesce_options {
+	bool enabled = false;
+	std::chrono::microseconds window{2000}; // how long the first message of a batch waits for more
+	std::size_t max_bytes = 64 * 1024; // a batch this big goes out without waiting for the window
+};
+
+class broadcast_coalescer {
+public:
+	broadcast_coalescer(boost::asio::io_context& io_context, std::shared_ptr<net_server> server,
+	                    const coalesce_options& options = coalesce_options());
+	~broadcast_coalescer();
+	broadcast_coalescer(const broadcast_coalescer&) = delete;
+	broadcast_coalescer& operator=(const broadcast_coalescer&) = delete;
+
+	// sends msg to every client, now or with the rest of the batch
+	void send(const net_message& msg);
+	// sends whatever is waiting now, to the clients filter accepts (every client without one)
+	// the clients filter turns down never get those messages
+	void flush(const std::function<bool (std::size_t)>& filter = nullptr);
+
+	// anything that is waiting goes out first under the old options
+	void set_options(const coalesce_options& options);
+	coalesce_options get_options();
+	// how many messages are waiting for the window
+	std::size_t pending();
+
+private:
+	void flush_locked(const std::function<bool (std::size_t)>& filter);
+	void handle_timer(const boost::system::error_code& e);
+
+	std::shared_ptr<net_server> server_;
+	std::mutex mutex_; // held while a batch is handed to the server too, so batches can't overtake each other
+	coalesce_options options_;
+	boost::asio::steady_timer timer_;
+	bool timer_running_;
+	std::string frames_; // the encoded messages of the batch, oldest first
+	std::size_t count_;
+};
+
+#endif
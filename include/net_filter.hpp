@@ -0,0 +1,106 @@
+#ifndef _NET_FILTER_HPP_
+#define _NET_FILTER_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+
+A content filter for the text that clients send, run on every message before it is sent on to the room.
+
+Words: the word list is compiled into an Aho-Corasick automaton, turned into a complete DFA
+(every state has an edge for every input, the failure links are already followed). Scanning a message
+is then one table lookup per byte, however many words are on the list, and every occurrence of
+every word is found in that one pass. Matched words are masked with '*'. Letters are matched
+without regard to case. With whole_words, a word only counts where it isn't part of a longer word,
+so "ass" doesn't mask the middle of "class". Bytes that no word contains all share one column
+of the table, so the table is states x (distinct letters in the list + 1), not states x 256.
+
+Repeats: each message is also hashed (FNV-1a over its letters and digits, folded to
+lower case, so "Hello!!" and "hello" are the same message), and a client that sends a message whose
+hash matches one of its last duplicate_window messages from within duplicate_age has it turned away.
+
+Reloading: the automaton is immutable and shared. reload() reads the list and builds the new automaton
+on a thread of its own, then swaps it in, so a big list never holds up the threads that are filtering.
+Messages that are being checked while the swap happens finish with the old automaton.
+
+A word list file has one word (or phrase) per line, blank lines and lines starting with '#' are skipped.
+
+*/
+
+struct filter_options {
+	bool whole_words = true;
+	std::size_t duplicate_window = 4; // 0 turns the repeat check off
+	std::chrono::seconds duplicate_age{30};
+};
+
+class word_automaton {
+public:
+	explicit word_automaton(const std::vector<std::string>& words);
+
+	// masks every word in text with '*', returns how many were found
+	std::size_t mask(char* text, std::size_t length, bool whole_words) const;
+	// the same without changing text, stops at the first one
+	bool contains(const char* text, std::size_t length, bool whole_words) const;
+
+	std::size_t words() const;
+	std::size_t states() const;
+
+private:
+	template <typename Found>
+	void scan(const char* text, std::size_t length, bool whole_words, Found found) const;
+
+	std::uint8_t classes_[256]; // byte -> column of the table
+	std::size_t columns_;
+	std::vector<std::uint32_t> next_; // state * columns_ + column -> state
+	std::vector<std::uint32_t> word_length_; // the length of the word that ends at a state, 0 if none does
+	std::vector<std::uint32_t> output_; // the next state down the failure chain that ends a word, 0 if none
+	std::size_t words_;
+};
+
+class content_filter {
+public:
+	enum verdict { passed = 0, masked, repeated };
+
+	explicit content_filter(const filter_options& options = filter_options());
+	// waits for a reload that is still building
+	~content_filter();
+	content_filter(const content_filter&) = delete;
+	content_filter& operator=(const content_filter&) = delete;
+
+	// builds the list on the calling thread
+	void set_words(const std::vector<std::string>& words);
+	// reads and builds the list at path on a thread of its own, an unreadable file is reported
+	// to std::cerr and leaves the current list in place
+	void reload(const std::string& path);
+	std::size_t words();
+
+	// masks body in place, or turns it away if sender has just sent the same thing
+	verdict check(std::size_t sender, char* body, std::size_t length);
+	// drops what's remembered about sender's recent messages (once it has disconnected)
+	void forget(std::size_t sender);
+
+private:
+	struct recent_message {
+		std::uint64_t hash;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	bool is_repeat(std::size_t sender, std::uint64_t hash);
+
+	filter_options options_;
+	std::shared_ptr<const word_automaton> automaton_; // only touched with std::atomic_load and std::atomic_store
+	std::mutex recent_mutex_;
+	std::unordered_map<std::size_t, std::vector<recent_message>> recent_; // each client's last messages, oldest first
+	std::mutex reload_mutex_;
+	std::thread reloader_;
+};
+
+#endif
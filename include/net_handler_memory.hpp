@@ -0,0 +1,111 @@
+#ifndef _NET_HANDLER_MEMORY_HPP_
+#define _NET_HANDLER_MEMORY_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio.hpp>
+
+/*
+
+Memory for the completion handlers of a connection's reads and writes.
+
+Every async_read / async_write has asio allocate an operation object that holds the handler
+(the boost::bind with the shared_ptr to the connection) until the operation completes,
+and the hop onto the connection's strand allocates one more. A connection only ever has
+one read and one write in flight at a time, so each of them gets a handler_memory of its own,
+a block that lives in the connection and is handed out over and over again. asio finds it
+through the handler's associated allocator, which make_alloc_handler wraps around the handler:
+
+	boost::asio::async_read(socket_, buffer,
+	  boost::asio::bind_executor(strand, make_alloc_handler(read_memory_, handler)));
+
+asio frees an operation before it calls the handler, so the handler can start the next
+operation with the same memory. Anything that doesn't fit (or a second allocation while
+the block is taken) falls back to the normal heap, so a handler that grows past size
+is only slower, never wrong.
+
+A handler_memory isn't thread safe, it relies on the operations that use it never
+overlapping, which is what one outstanding read (or write) per connection gives.
+
+*/
+
+class handler_memory {
+public:
+	enum { size = 512 };
+
+	handler_memory();
+	handler_memory(const handler_memory&) = delete;
+	handler_memory& operator=(const handler_memory&) = delete;
+
+	void* allocate(std::size_t length);
+	void deallocate(void* pointer);
+
+private:
+	typename std::aligned_storage<size>::type storage_;
+	bool in_use_;
+};
+
+template <typename T>
+class handler_allocator {
+public:
+	typedef T value_type;
+
+	explicit handler_allocator(handler_memory& memory)
+	  : memory_(memory)
+	{}
+	template <typename U>
+	handler_allocator(const handler_allocator<U>& other)
+	  : memory_(other.memory_)
+	{}
+
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+	}
+	void deallocate(T* pointer, std::size_t /*n*/) {
+		memory_.deallocate(pointer);
+	}
+	template <typename U>
+	bool operator==(const handler_allocator<U>& other) const {
+		return &memory_ == &other.memory_;
+	}
+	template <typename U>
+	bool operator!=(const handler_allocator<U>& other) const {
+		return &memory_ != &other.memory_;
+	}
+
+	handler_memory& memory_;
+};
+
+template <typename Handler>
+class alloc_handler {
+	// a handler that tells asio to allocate out of a handler_memory
+public:
+	typedef handler_allocator<Handler> allocator_type;
+
+	alloc_handler(handler_memory& memory, Handler handler)
+	  : memory_(memory), handler_(std::move(handler))
+	{}
+
+	allocator_type get_allocator() const noexcept {
+		return allocator_type(memory_);
+	}
+
+	template <typename... Args>
+	void operator()(Args&&... args) {
+		handler_(std::forward<Args>(args)...);
+	}
+
+private:
+	handler_memory& memory_;
+	Handler handler_;
+};
+
+template <typename Handler>
+inline alloc_handler<typename std::decay<Handler>::type> make_alloc_handler(handler_memory& memory, Handler&& handler) {
+	return alloc_handler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(handler));
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _NET_HANDOFF_HPP_
+#define _NET_HANDOFF_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+/*
+
+Hot restart support for net_server.
+
+Deploying a new build of a server normally means disconnecting every client, and every client
+reconnecting at the same moment. Instead, the running process can hand its listening socket
+(and optionally every live connection) to the new process over a Unix domain socket,
+passing the file descriptors themselves with SCM_RIGHTS. The kernel keeps the TCP
+connections open the whole time, so clients never notice the switch.
+
+The old process listens on a Unix socket path (net_server::enable_hot_restart).
+The new process is started with a way to find that path, connects to it and receives a handoff_state:
+
+	handoff_state state;
+	if (receive_handoff("/tmp/chat_server.sock", state)) {
+		// construct the server from state instead of binding the port again
+	}
+
+When a connection is handed over, the old process stops it at a message boundary where it can.
+inbound holds the start of a message the client was in the middle of sending (so the new process
+reads the rest of it), and outbound holds whole frames that were queued but never written.
+Anything the application wants to carry over (chat_server's client names for example)
+goes in application, in whatever format the application likes.
+
+The format is only meant to be read by a build of the same library on the same machine.
+
+*/
+
+struct handoff_connection {
+	std::size_t id;
+	int fd;
+	std::string inbound;
+	std::string outbound;
+	// session state (see session_options in net_server.hpp), session is empty without one
+	bool established = true;
+	std::string session;
+	std::uint64_t received = 0;
+	std::uint64_t acked = 0;
+	std::string replay; // written frames the client hasn't acknowledged yet
+};
+
+struct handoff_state {
+	int acceptor_fd = -1;
+	std::size_t next_id = 0;
+	std::vector<handoff_connection> connections;
+	std::string application;
+};
+
+// Both block until the whole state has been sent or received, and print the reason to std::cerr on failure.
+// socket_fd must be a connected Unix stream socket. The descriptors in state stay open in the sender
+// (the receiver gets its own copies), so the sender should close them once this returns.
+bool send_handoff(int socket_fd, const handoff_state& state);
+bool receive_handoff(int socket_fd, handoff_state& state);
+// connects to the old process listening on path and receives its state
+bool receive_handoff(const std::string& path, handoff_state& state);
+
+// the protocol (v4 or v6) of a socket that was received from another process
+boost::asio::ip::tcp handoff_protocol(int fd);
+
+#endif
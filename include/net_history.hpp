@@ -0,0 +1,63 @@
+#ifndef _NET_HISTORY_HPP_
+#define _NET_HISTORY_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "net_message.hpp"
+
+/*
+
+The last depth messages of a conversation, kept so that somebody joining it can catch up.
+
+An application keeps one message_history for each room (or game, or whatever a group of
+clients shares) and appends the messages it sends to the room as already encoded net_messages,
+so a message is encoded once for the room and once for the history, not again for every client.
+When a client joins, replay() hands back everything in the history as one batch
+(see net_message.hpp), which net_server::send_to writes to the client in a single write:
+
+	net_message msg(body, length);
+	history.append(msg);
+	server.send_to_all(msg);
+	...
+	server.send_to(new_client, history.replay());
+
+The batch's buffer is built the first time replay() is called after the history changed
+and then shared, so any number of clients joining between two messages all get the same buffer,
+nothing is copied per client. A client that is still reading an old batch keeps that buffer
+alive on its own, appending never touches a buffer that has been handed out.
+
+A message_history is thread safe.
+
+*/
+
+class message_history {
+public:
+	explicit message_history(std::size_t depth);
+	message_history(const message_history&) = delete;
+	message_history& operator=(const message_history&) = delete;
+
+	// only data frames are kept, once the history is full the oldest message makes room
+	void append(const net_message& msg);
+	// a batch of every message in the history, oldest first (an empty batch if there aren't any)
+	net_message replay();
+	std::size_t size();
+	std::size_t depth() const;
+	void clear();
+
+	// the history as encoded frames, and the reverse, for carrying it over a hot restart
+	std::string save();
+	void restore(const std::string& frames);
+
+private:
+	void append_locked(const net_message& msg);
+
+	std::mutex mutex_;
+	const std::size_t depth_;
+	message_queue messages_;
+	std::shared_ptr<const std::string> replay_; // null when it has to be built again
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef _NET_LOG_HPP_
+#define _NET_LOG_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net_message.hpp"
+
+/*
+
+A durable, append only log of messages, kept in a directory of segment files.
+
+The application appends encoded net_messages (a chat server appends everything it says to a room).
+append() never touches the disk: it copies the frame into a buffer and returns, so it can be
+called from a read_handler without holding up the io_context. A writer thread of the log's own
+takes whatever has built up in the buffer, writes all of it with one write, syncs it, and comes
+back for the next lot, so however many messages arrive while the disk is busy, they cost one
+sync between them (group commit). If the disk falls so far behind that max_pending bytes are
+waiting, append drops messages rather than letting the buffer grow without a limit.
+
+Every record is a fixed header and the encoded frame:
+	length   u32  the frame's length in bytes
+	crc      u32  CRC-32 of everything after it (sequence, time and frame)
+	sequence u64  numbers the records one after another, across segments
+	time     i64  when the record was appended, in milliseconds since the epoch
+	frame         the net_message as it goes on the wire
+The numbers are in the machine's byte order, like the handoff format, a log is only read
+by a build of the same library on the same machine.
+
+A segment is named after the sequence of its first record, and a new one is started once the
+current one has grown past segment_bytes (and every time a log is opened, so that two processes
+never write to one file during a hot restart). Whole segments are deleted, oldest first, while the
+log is over max_bytes or while the newest record of the oldest segment is older than max_age.
+
+Opening a log checks every record of the existing segments and cuts the last segment off at
+the first record that doesn't add up, which is what a crash in the middle of a write leaves behind.
+
+Reading maps the segments into memory and hands out pointers straight into the mapping,
+so replaying the log doesn't copy a record until the caller does. Only records that the writer
+has finished writing are seen. Each segment keeps a sparse index, the offset of every
+index_interval'th record (built while the log is opened and as records are written), so a read
+starts at most index_interval records before the first one it wants instead of at the start
+of the segment. Reading still touches the disk, so an application shouldn't do it on its io_context.
+
+*/
+
+struct log_options {
+	std::string directory = "log";
+	std::size_t segment_bytes = 16 * 1024 * 1024;
+	std::uint64_t max_bytes = 256 * 1024 * 1024; // 0 keeps everything
+	std::chrono::seconds max_age{7 * 24 * 60 * 60}; // 0 keeps everything
+	std::size_t max_pending = 8 * 1024 * 1024;
+	bool sync = true; // fdatasync every group of records before writing the next one
+};
+
+struct log_record {
+	std::uint64_t sequence;
+	std::int64_t time_ms;
+	const char* frame; // the encoded net_message, only valid during the call it's passed to
+	std::size_t frame_length;
+};
+
+class message_log {
+public:
+	enum { record_header_length = 24 };
+	enum { index_interval = 64 };
+
+	// opens (or creates) the log in options.directory, throws if the directory can't be used
+	explicit message_log(const log_options& options);
+	// writes out everything that has been appended before returning
+	~message_log();
+	message_log(const message_log&) = delete;
+	message_log& operator=(const message_log&) = delete;
+
+	// returns the record's sequence, or 0 if the record was dropped
+	std::uint64_t append(const net_message& msg);
+	// blocks until everything appended so far has been written (and synced)
+	void flush();
+
+	// Calls visit for the records from sequence from onwards (or the oldest one still kept), oldest first,
+	// at most max of them. Returns how many were visited. Can be called from any thread.
+	std::size_t read(std::uint64_t from, std::size_t max, const std::function<void (const log_record&)>& visit);
+	// the same for the last count records
+	std::size_t read_last(std::size_t count, const std::function<void (const log_record&)>& visit);
+
+	// the sequence the next record written will get
+	std::uint64_t next_sequence();
+
+private:
+	struct segment {
+		std::uint64_t first; // the sequence of its first record
+		std::string path;
+		std::uint64_t bytes;
+		std::int64_t newest_ms; // the time of its last record
+		std::vector<std::uint64_t> offsets; // offsets[i] is where record first + i * index_interval starts
+	};
+	
+	// where reading a segment starts, copied out from under segments_mutex_
+	struct read_range {
+		std::string path;
+		std::uint64_t bytes;
+		std::uint64_t offset;
+	};
+
+	void recover();
+	std::uint64_t scan(segment& seg, bool truncate);
+	void run();
+	void write_group(std::string& group);
+	void start_segment(std::uint64_t first);
+	void apply_retention();
+
+	log_options options_;
+
+	// the buffer appends go into, and what the writer has got through, guarded by mutex_
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable written_;
+	std::string pending_;
+	std::uint64_t next_sequence_;
+	std::uint64_t durable_; // every record before this one has been written
+	bool stopping_;
+	bool dropping_;
+
+	// the segments, oldest first, guarded by segments_mutex_ (the writer changes them, readers copy them)
+	std::mutex segments_mutex_;
+	std::vector<segment> segments_;
+
+	// only touched by the writer thread
+	int fd_;
+	std::thread writer_;
+};
+
+#endif
@@ -2,8 +2,12 @@
 #define _NET_MESSAGE_HPP_
 
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
 /*
 
@@ -13,6 +17,20 @@ that is sent between a client and a server (in either direction)
 a message has a variable length where the first header_length bytes signify
 how many bytes in length the rest of the message is
 
+the library also sends a few control frames of its own. the header of a control frame
+is a word instead of a number, so it can never be mistaken for a data frame, and the
+word decides how long the body is. control frames are handled by net_server / net_client
+and never reach the application.
+	PING / PONG: heartbeats, no body
+	HELO / WELC / ACKN: session frames (see net_client.hpp), the body is a session token
+	followed by a count of data frames, as a big endian 64 bit number
+
+a batch is a run of data frames that were encoded ahead of time into one shared buffer
+(see net_history.hpp). it never appears on the wire as a frame of its own: the server writes
+the whole buffer in one go, and the receiver reads the data frames inside it one by one.
+copying a batch only copies a reference to the buffer, so the same batch can be queued for
+any number of clients.
+
 */
 
 
@@ -21,9 +39,16 @@ class net_message {
 public:
 	enum { header_length = 4 };
 	enum { max_body_length = 512 };
+	enum frame_type { data_frame = 0, ping_frame, pong_frame, hello_frame, welcome_frame, ack_frame, batch_frame };
+	enum { token_length = 16 };
+	enum { session_body_length = token_length + 8 };
+	enum { ack_every = 16 }; // data frames between session acknowledgements
 	
 	net_message(); // default constructor that sets body_length_ to 0
 	net_message(const char* body, std::size_t length); // constructor that takes in the body of the message
+	explicit net_message(frame_type type); // constructor for a ping or pong (no body)
+	net_message(frame_type type, const char* token, std::uint64_t count); // constructor for a session frame
+	net_message(std::shared_ptr<const std::string> frames, std::size_t count); // constructor for a batch of count data frames
 	
 	net_message(const net_message& other); // copy constructor explicit bcz we want to deep copy the data
 	net_message& operator=(const net_message& other); // same as copy constructor but assignment
@@ -35,11 +60,52 @@ public:
 	const char* get_body() const;
 	char* get_body();
 	std::size_t get_body_length() const;
-	void decode_header();
+	frame_type get_type() const;
+	bool decode_header();
+	
+	// the parts of a session frame's body
+	const char* get_token() const;
+	std::uint64_t get_count() const;
+	
+	// what actually gets written for this message, which for a batch is the shared buffer
+	const char* get_frame_data() const;
+	std::size_t get_frame_length() const;
+	std::size_t get_frame_count() const; // data frames in a batch, 1 for anything else
 	
 private:
 	char data_[header_length + max_body_length];
 	std::size_t body_length_;
+	frame_type type_;
+	std::shared_ptr<const std::string> batch_; // only set for a batch
+	std::size_t batch_count_;
+};
+
+class message_queue {
+	// A first in first out queue of messages kept in one ring buffer.
+	// A std::deque allocates a node for every message this size, this only allocates when it has
+	// to grow, and clearing it keeps the storage, so a connection that is reused (see connection_pool
+	// in net_server.hpp) starts out with its queue already allocated.
+public:
+	explicit message_queue(std::size_t capacity = 4);
+	
+	bool empty() const;
+	std::size_t size() const;
+	std::size_t capacity() const;
+	net_message& front();
+	net_message& operator[](std::size_t i); // 0 is the front
+	void push_back(const net_message& msg);
+	void pop_front();
+	void clear();
+	void swap(message_queue& other);
+	// gives back the storage if the queue grew past keep (only when it's empty)
+	void shrink(std::size_t keep);
+	
+private:
+	void grow();
+	
+	std::vector<net_message> ring_;
+	std::size_t head_;
+	std::size_t size_;
 };
 
 #endif
\ No newline at end of file
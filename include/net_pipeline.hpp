@@ -0,0 +1,136 @@
+#ifndef _NET_PIPELINE_HPP_
+#define _NET_PIPELINE_HPP_
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+#include "net_filter.hpp"
+#include "net_text.hpp"
+
+/*
+
+Message processing as a chain of stages.
+
+Instead of one read_handler that validates, checks, dispatches and sends everything itself,
+an application can split the work into stages and run every message through them in order:
+
+	auto inbound = make_pipeline(utf8_stage(), command_stage, filter_stage(filter), room_stage);
+	...
+	void read_handler(std::size_t sender, char* body, std::size_t length) {
+		net_frame frame{ sender, body, length };
+		if (!inbound(frame) && frame.rejected) {
+			// tell the sender why
+		}
+	}
+
+A stage is anything that can be called with a net_frame& and returns a stage_result, a lambda will do.
+It gets a view of the message, not a copy: body points at the bytes net_server read, and a stage
+can change them in place, make the message shorter, or point body at a buffer of its own for the
+stages after it. Returning next hands the frame on. Returning done stops the chain there, because
+the stage has dealt with the message (a command, say) or has turned it away. A stage that turns
+a message away says why in frame.rejected.
+
+The stages are fixed when the pipeline is built: a net_pipeline's type lists them, they are kept
+by value in a tuple and called one after another by a fold expression, so there are no virtual calls
+and no std::function, the compiler can inline the whole chain, and a stage an application doesn't
+use isn't there at all. Nothing in tcp_connection changes, a pipeline runs inside read_handler,
+so new checks are added to an application without touching the read loop.
+
+The same works on the way out: a pipeline whose last stage sends the frame (to one client or to
+the room) runs once per message, before the message is encoded and fanned out, so whatever the
+stages do costs once per message and not once per client.
+
+A pipeline is as thread safe as its stages.
+
+*/
+
+struct net_frame {
+	std::size_t client; // the sender on the way in, the recipient on the way out
+	char* body;
+	std::size_t length;
+	const char* rejected = nullptr; // set by a stage that turns the message away, why it did
+};
+
+enum class stage_result { next, done };
+
+template <typename... Stages>
+class net_pipeline {
+public:
+	explicit net_pipeline(Stages... stages)
+	  : stages_(std::move(stages)...)
+	{}
+
+	// true if every stage handed the frame on, false if one of them stopped it
+	bool operator()(net_frame& frame) {
+		return run(frame, std::index_sequence_for<Stages...>());
+	}
+
+	template <std::size_t I>
+	auto& stage() {
+		return std::get<I>(stages_);
+	}
+
+private:
+	template <std::size_t... I>
+	bool run(net_frame& frame, std::index_sequence<I...>) {
+		// && stops at the first stage that returns done
+		return ((std::get<I>(stages_)(frame) == stage_result::next) && ...);
+	}
+
+	std::tuple<Stages...> stages_;
+};
+
+template <typename... Stages>
+net_pipeline<Stages...> make_pipeline(Stages... stages) {
+	return net_pipeline<Stages...>(std::move(stages)...);
+}
+
+// a stage that calls a member function, for pipelines that are members of the class they call
+template <typename T, stage_result (T::*Method)(net_frame&)>
+class member_stage {
+public:
+	explicit member_stage(T* object)
+	  : object_(object)
+	{}
+
+	stage_result operator()(net_frame& frame) {
+		return (object_->*Method)(frame);
+	}
+
+private:
+	T* object_;
+};
+
+// turns away anything that isn't valid UTF-8 (see net_text.hpp)
+class utf8_stage {
+public:
+	stage_result operator()(net_frame& frame) {
+		if (!text_valid_utf8(frame.body, frame.length)) {
+			frame.rejected = "Messages have to be valid UTF-8.";
+			return stage_result::done;
+		}
+		return stage_result::next;
+	}
+};
+
+// masks listed words and turns away repeats (see net_filter.hpp)
+class filter_stage {
+public:
+	explicit filter_stage(content_filter& filter)
+	  : filter_(&filter)
+	{}
+
+	stage_result operator()(net_frame& frame) {
+		if (filter_->check(frame.client, frame.body, frame.length) == content_filter::repeated) {
+			frame.rejected = "You just said that.";
+			return stage_result::done;
+		}
+		return stage_result::next;
+	}
+
+private:
+	content_filter* filter_;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _NET_RATE_LIMITER_HPP_
+#define _NET_RATE_LIMITER_HPP_
+
+#include <cstdint>
+
+/*
+
+Per connection flood control for net_server.
+
+Every message that a client sends can cost the server a lot more than the message itself
+(a chat message is sent back out to every client), so one client sending as fast as it can
+would eat up the server. Each connection gets a rate_limiter made of two token buckets,
+one counting messages and one counting bytes, which is checked before the message is
+handed to the application's read_handler.
+
+A token bucket holds up to burst tokens and refills at rate tokens per second.
+A message takes one token from the message bucket and one token per byte (header included)
+from the byte bucket. The buckets are kept in units of token-nanoseconds so that refilling and
+spending are just integer multiplies, adds and compares, there is no floating point and no timer.
+
+What happens to a client that is over its limit is chosen by the policy:
+	- delay: the message is delivered, but the connection stops reading until the client
+	  is back under its limit. The client's TCP window fills up and it slows down on its own.
+	- drop: the message is thrown away and reading continues.
+	- disconnect: the connection is closed.
+
+*/
+
+struct rate_limit_options {
+	enum policy_type { delay = 0, drop, disconnect };
+
+	bool enabled = false;
+	std::uint32_t messages_per_second = 50;
+	std::uint32_t message_burst = 100;
+	std::uint32_t bytes_per_second = 64 * 1024;
+	std::uint32_t byte_burst = 128 * 1024;
+	policy_type policy = delay;
+};
+
+class token_bucket {
+public:
+	token_bucket();
+
+	void configure(std::uint32_t rate, std::uint32_t burst, std::int64_t now_ns);
+
+	// Returns 0 if cost tokens are available right now, otherwise how many nanoseconds until they are.
+	std::int64_t wait_time(std::uint32_t cost, std::int64_t now_ns);
+
+	// Takes cost tokens even if that puts the bucket in debt, and returns how long until it's out of debt.
+	std::int64_t force(std::uint32_t cost, std::int64_t now_ns);
+
+private:
+	void refill(std::int64_t now_ns);
+
+	std::int64_t tokens_; // in token-nanoseconds, so one token is 1e9
+	std::int64_t capacity_;
+	std::int64_t rate_;
+	std::int64_t last_ns_;
+};
+
+class rate_limiter {
+public:
+	rate_limiter();
+
+	void configure(const rate_limit_options& options, std::int64_t now_ns);
+	bool enabled() const;
+	rate_limit_options::policy_type policy() const;
+
+	// Charges a message of length bytes to the connection.
+	// Returns 0 if it's within the limits, otherwise how many nanoseconds the connection should wait.
+	// With the delay policy the message is always charged (it's delivered anyway),
+	// with the other policies a message that is over the limit isn't charged.
+	std::int64_t charge(std::uint32_t bytes, std::int64_t now_ns);
+
+private:
+	token_bucket messages_;
+	token_bucket bytes_;
+	rate_limit_options::policy_type policy_;
+	bool enabled_;
+};
+
+#endif
@@ -4,11 +4,24 @@
 #include <deque>
 #include <list>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 #include "net_message.hpp"
+#include "net_timer_wheel.hpp"
+#include "net_rate_limiter.hpp"
+#include "net_handoff.hpp"
+#include "net_handler_memory.hpp"
+#include "net_history.hpp"
 
 /*
 The net_server class is a class that will handle the network connections and messages for your server application.
@@ -18,8 +31,9 @@ To use the net_server class in your application, your main function should look
 int main() {
 	try {
 		boost::asio::io_context io_context;
-		std::size_t port_num = 1234;
-		application_server serv(io_context, port_num);
+		server_options options(1234);
+		options.address = "::"; // IPv4 and IPv6
+		application_server serv(io_context, options);
 		io_context.run();
 	} catch (std::exception& e) {
 		std::cerr << e.what() << std::endl;
@@ -32,8 +46,8 @@ Where application_server is a class that looks something like:
 
 class application_server {
 public:
-	application_server(boost::asio::io_context& io_context, std::size_t port)
-	  : server_(io_context, port, std::bind(&application_server::handle_accept, this, std::placeholders::_1, std::placeholders::_2),
+	application_server(boost::asio::io_context& io_context, const server_options& options)
+	  : server_(io_context, options, std::bind(&application_server::handle_accept, this, std::placeholders::_1, std::placeholders::_2),
 	    std::bind(&application_server::handle_read, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3))
 	{}
 	
@@ -64,25 +78,196 @@ and then it will be decoded by the receiver.
 
 using boost::asio::ip::tcp;
 
+// Every connection runs its handlers on a strand. By default each connection gets its
+// own strand, but an application can move several connections onto one shared strand
+// (see net_server::set_strand) so that all of the state they touch is only ever
+// mutated from a single thread at a time, without needing a mutex.
+typedef boost::asio::strand<boost::asio::io_context::executor_type> net_strand;
+
+struct heartbeat_options {
+	// How the server notices clients that are gone without having closed their connection
+	// (a NAT entry that timed out, a machine that lost power, ...).
+	// Once a connection has been quiet for ping_interval the server sends it a ping,
+	// and a connection that hasn't sent anything at all (a pong counts) for idle_timeout is closed.
+	// A message whose header has arrived must have its body arrive within read_timeout.
+	// These are checked on the io_context's net_timer_wheel, so a dead peer is noticed
+	// within roughly idle_timeout (read_timeout + ping_interval for a stalled body).
+	bool enabled = true;
+	std::chrono::milliseconds ping_interval{5000};
+	std::chrono::milliseconds idle_timeout{15000};
+	std::chrono::milliseconds read_timeout{10000};
+	
+	// TCP keepalive is set on every accepted socket as well (times are in seconds)
+	bool tcp_keepalive = true;
+	int keepalive_idle = 30;
+	int keepalive_interval = 5;
+	int keepalive_count = 3;
+};
+
+struct server_options {
+	// Where the server listens and how its sockets are set up.
+	// address decides the protocol: an IPv4 address listens on IPv4 only, an IPv6 address on IPv6,
+	// and with v6_only off "::" takes IPv4 clients as well (dual-stack).
+	// The acceptor options are used when binding, the rest are set on every accepted socket.
+	// A buffer size of 0 leaves the kernel's default (and its autotuning) alone.
+	// TCP_QUICKACK isn't permanent on Linux, the kernel can go back to delayed acks on its own,
+	// so quick_ack only really covers the start of a connection.
+	server_options() = default;
+	explicit server_options(unsigned short port)
+	  : port(port)
+	{}
+	
+	std::string address = "0.0.0.0";
+	unsigned short port = 1234;
+	bool v6_only = false;
+	int backlog = boost::asio::socket_base::max_listen_connections;
+	bool reuse_address = true;
+	bool reuse_port = false; // lets several processes (or acceptors) share the port
+	int defer_accept = 0; // seconds to wait for the client's first data before accepting, 0 turns it off
+	// How many accepts are kept waiting on the listening socket at once, and how many more
+	// connections each completion takes straight off the backlog without going back to the reactor.
+	std::size_t accepts_outstanding = 4;
+	std::size_t accept_batch = 64;
+	// how many closed connections are kept for reuse (see connection_pool)
+	std::size_t pooled_connections = 1024;
+	
+	bool no_delay = true; // turns Nagle off, a chat message shouldn't wait for the previous one to be acked
+	bool quick_ack = false;
+	int send_buffer = 0;
+	int receive_buffer = 0;
+};
+
+struct session_options {
+	// Lets a client that lost its connection come back as the same client (see net_client.hpp).
+	// When a client with a session goes away, the application isn't told about it for grace.
+	// If the client comes back within that time, its new connection takes over the old id
+	// (and strand), so the application never notices it was gone at all.
+	// Messages sent to a client while it's away are held for it, and every connection keeps
+	// its last written messages until the client acknowledges them, replay_frames of each at most.
+	// With sessions on, accept_handler isn't called for a new connection until the client's
+	// handshake has arrived (or, for a client that doesn't do the handshake, its first message).
+	bool enabled = false;
+	std::chrono::milliseconds grace{30000};
+	std::size_t replay_frames = 256;
+};
+
+struct outbound_state {
+	// Bytes queued for writing across every connection of a net_server.
+	// When the total goes over high_watermark every connection stops reading until
+	// it falls back under low_watermark, so that clients can't push work into the server
+	// faster than it can push the results back out. A high_watermark of 0 turns this off.
+	std::atomic<std::int64_t> queued_bytes{0};
+	std::atomic<bool> saturated{false};
+	std::int64_t high_watermark = 0;
+	std::int64_t low_watermark = 0;
+	std::function<void (bool)> on_change; // called by whichever connection crosses a watermark
+};
+
 class net_server;
+class tcp_connection;
+
+class connection_pool {
+	// Recycles tcp_connection objects so that a client connecting doesn't cost a round of allocations
+	// (the connection, its handlers, its buffers and its write queue) and disconnecting doesn't free them again.
+	// Connections are still handed around as std::shared_ptr, because a std::weak_ptr to a connection
+	// that was recycled has to stay expired instead of pointing at whichever client uses the object next.
+	// The shared_ptr control blocks are recycled here as well (see pool_allocator), so once the pool
+	// has warmed up, a connection coming and going doesn't touch the allocator at all.
+	// Thread safe, connections are given back on whichever thread drops the last reference.
+public:
+	explicit connection_pool(std::size_t capacity);
+	~connection_pool();
+	
+	tcp_connection* take(); // nullptr if the pool is empty
+	void give_back(tcp_connection* connection); // deletes the connection if the pool is full
+	
+	void* allocate_block(std::size_t size);
+	void free_block(void* block, std::size_t size);
+	
+private:
+	std::mutex mutex_;
+	std::size_t capacity_;
+	std::vector<tcp_connection*> idle_;
+	std::size_t block_size_; // all of the control blocks are the same size, the first one decides it
+	std::vector<void*> blocks_;
+};
+
+template <typename T>
+class pool_allocator {
+	// hands the shared_ptr control blocks of pooled connections out of a connection_pool
+public:
+	typedef T value_type;
+	
+	explicit pool_allocator(std::shared_ptr<connection_pool> pool)
+	  : pool_(pool)
+	{}
+	template <typename U>
+	pool_allocator(const pool_allocator<U>& other)
+	  : pool_(other.pool_)
+	{}
+	
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(pool_->allocate_block(n * sizeof(T)));
+	}
+	void deallocate(T* block, std::size_t n) {
+		pool_->free_block(block, n * sizeof(T));
+	}
+	template <typename U>
+	bool operator==(const pool_allocator<U>& other) const {
+		return pool_ == other.pool_;
+	}
+	template <typename U>
+	bool operator!=(const pool_allocator<U>& other) const {
+		return pool_ != other.pool_;
+	}
+	
+	std::shared_ptr<connection_pool> pool_;
+};
 
 class application_server {
 	// a base class that applications should inherit from
 	// in order to use the net_server class as expected
 public:
-	application_server(std::size_t port) 
-	  : server_ptr_(std::make_shared<net_server>(io_context_, port, 
+	// takeover is the state handed over by the process this one is replacing, if any (see net_handoff.hpp)
+	// the derived class is responsible for restoring its own part of it (takeover->application)
+	application_server(std::size_t port, std::size_t num_threads = 1, const handoff_state* takeover = nullptr)
+	  : application_server(server_options(port), num_threads, takeover)
+	{}
+	application_server(const server_options& options, std::size_t num_threads = 1, const handoff_state* takeover = nullptr) 
+	  : server_ptr_(std::make_shared<net_server>(io_context_, options, 
 		  std::bind(&application_server::accept_handler, this, std::placeholders::_1, std::placeholders::_2),
-	      std::bind(&application_server::read_handler, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3))) {
+	      std::bind(&application_server::read_handler, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
+	      takeover)),
+	    num_threads_(num_threads == 0 ? 1 : num_threads) {
 	}
 	void start() {
 		// if you are going to overwrite this function, 
 		// you should still call application_server::start() from inside
+		// the calling thread runs the io_context as well, so num_threads - 1 extra threads are created
+		// SIGINT and SIGTERM shut the server down gracefully, and start() returns once that's done
+		boost::asio::signal_set signals(io_context_, SIGINT, SIGTERM);
+		signals.async_wait([this](const boost::system::error_code& e, int /*signal*/) {
+			if (!e) {
+				shutdown(shutdown_deadline_, goodbye_message_);
+			}
+		});
+		std::vector<std::thread> threads;
+		for (std::size_t i = 1; i < num_threads_; i++) {
+			threads.emplace_back([this]() { io_context_.run(); });
+		}
 		io_context_.run();
+		for (auto& thread : threads) {
+			thread.join();
+		}
 	}
 	void stop() {
+		// stops straight away, anything that hasn't been written to the clients yet is lost
 		io_context_.stop();
 	}
+	// stops once every client has been sent everything that was queued for it (see net_server::shutdown)
+	void shutdown(std::chrono::milliseconds deadline, const std::string& goodbye = "");
+	// lets a newer build take over from this process through the Unix socket at path (see net_server::enable_hot_restart)
+	void enable_hot_restart(const std::string& path, bool include_connections);
 private:
 	virtual void accept_handler(std::size_t client_id, bool connect) {
 		// virtual so that when we pass this function to the net_server constructor,
@@ -96,9 +281,19 @@ private:
 		std::cout << "You need to implement your own version of read_handler." << std::endl;
 	}
 	
+	virtual std::string save_state() {
+		// called when this process hands its clients over to a new one,
+		// whatever is returned shows up as handoff_state::application in the new process
+		return std::string();
+	}
+	
 protected:
 	boost::asio::io_context io_context_;
 	std::shared_ptr<net_server> server_ptr_;
+	std::size_t num_threads_;
+	// used when the process is asked to stop by a signal
+	std::chrono::milliseconds shutdown_deadline_{5000};
+	std::string goodbye_message_;
 };
 
 class tcp_connection
@@ -109,58 +304,267 @@ class tcp_connection
 	// this object will handle the reading/writing of messages between
 	// the server and this client
 	// when the client disconnects, this object will be deleted
+	// all of the handlers for a connection run on its strand, so the connection
+	// never needs a mutex for its own state even when the io_context has many threads
+	friend class net_server;
 public:
-	tcp_connection(tcp::socket socket_, int id, 
+	enum { initial_queue = 8 }; // messages the write queue has room for before it has to grow
+	
+	// Reading can be paused for several reasons at once, and only starts again once
+	// every one of them has been cleared. Pausing takes effect after the message currently
+	// being read (if any) has been handled. While a connection isn't reading, the client's
+	// data backs up in the kernel and the TCP receive window pushes back on the sender.
+	enum pause_reason : std::uint8_t {
+		paused_by_application = 1,
+		paused_by_rate_limit = 2,
+		paused_by_outbound = 4
+	};
+	
+	// A connection is built once with everything that stays the same for the whole server,
+	// and then reset for every client that it is used for (see connection_pool).
+	tcp_connection(boost::asio::io_context& io_context, net_timer_wheel& timers, std::shared_ptr<outbound_state> outbound,
 					std::function<void (std::size_t, char*, std::size_t)> read_handler,
-					std::function<void (std::shared_ptr<tcp_connection>)> disconnect);
+					std::function<void (std::shared_ptr<tcp_connection>)> disconnect,
+					std::function<void (std::shared_ptr<tcp_connection>, const net_message*)> session_handler);
+	~tcp_connection();
+	
+	// Takes on a new client. Must only be called on a connection that nothing else refers to.
+	void reset(tcp::socket socket, int id, net_strand strand,
+	           const rate_limit_options& limits, const session_options& sessions);
+	// Lets go of the client, once the last reference to the connection is gone.
+	void recycle();
 	
 	void start();
+	// Stops taking new messages for this client once everything queued for it has been written,
+	// then closes the sending side so the client sees a clean end of stream after the last message.
+	// The connection goes away when the client closes its side (or net_server gives up on it).
+	void drain();
+	// Hot restart: stops the connection at a message boundary (as far as it can) and passes
+	// everything needed to carry on with it to done, on the connection's strand.
+	// done isn't called if the client disconnects first.
+	void hand_off(std::function<void (std::shared_ptr<tcp_connection>, handoff_connection)> done);
+	// used instead of start() for a connection that was handed over by another process
+	void resume(const std::string& inbound, const std::string& outbound);
 	void send(net_message msg);
 	int get_id();
 	bool valid();
+	net_strand get_strand();
+	void set_strand(net_strand strand);
+	
+	// can be called from any thread, neither allocates unless a stalled read has to be restarted
+	void pause_reading(pause_reason reason);
+	void resume_reading(pause_reason reason);
+	
+	// Called by net_server on the connection's current strand when the liveness timer fires.
+	// Sends a ping or closes the connection if needed, and returns when it should be checked
+	// again (or the epoch once the connection has been closed).
+	std::chrono::steady_clock::time_point check_liveness(const heartbeat_options& options);
 	
 private:
+	void close();
+	void begin_drain();
+	void finish_writes();
+	void check_handoff();
+	bool stop_reading_for_handoff(std::size_t buffered);
+	void continue_reading();
+	void try_resume();
+	void send_greeting();
+	void handle_ack(std::uint64_t count);
+	void hold_message(net_message msg);
 	void read_header();
 	void handle_read_header(const boost::system::error_code e, std::size_t bytes_transferred);
 	void handle_read_body(const boost::system::error_code e, std::size_t bytes_transferred);
 	void read_body();
+	void do_send(net_message msg);
 	void do_write();
+	void handle_write(const boost::system::error_code e, std::size_t bytes_transferred);
 	
 	tcp::socket socket_;
-	bool valid_;
+	net_strand strand_;
+	std::mutex strand_mutex_; // only guards strand_ itself, which changes when the connection is migrated
+	std::atomic<bool> valid_; // read from other threads by send_to_all to skip dead connections
+	std::chrono::steady_clock::time_point last_receive_;
+	std::chrono::steady_clock::time_point body_started_;
+	bool reading_body_;
+	bool ping_outstanding_;
+	net_timer_wheel::handle liveness_timer_; // only touched by net_server on the connection's strand
+	net_timer_wheel& timers_;
+	rate_limiter limiter_;
+	std::atomic<std::uint8_t> pause_reasons_;
+	std::atomic<bool> read_stalled_; // true when no read is outstanding because reading is paused
+	bool draining_;
+	bool write_shut_; // the sending side has been shut down, anything sent afterwards is dropped
+	bool handing_off_;
+	bool handoff_writes_done_;
+	bool handoff_reads_done_;
+	bool handoff_cancelled_;
+	std::size_t handoff_inbound_; // how much of read_message_ had been read when reading stopped
+	std::function<void (std::shared_ptr<tcp_connection>, handoff_connection)> handoff_done_;
+	
+	// Session state (see session_options), all of it belongs to the connection's strand.
+	// A connection that has gone away but whose session is waiting for the client is parked,
+	// it holds on to whatever is sent to it until a new connection takes its session over.
+	bool established_; // false until the session handshake when sessions are on
+	bool parked_;
+	std::string token_; // empty if the connection doesn't have a session
+	std::uint64_t received_; // data frames received from the client in this session
+	std::uint64_t acked_; // data frames the client has confirmed receiving
+	message_queue unacked_; // written data frames (and batches) that the client hasn't confirmed yet
+	std::size_t replay_frames_;
+	std::function<void (std::shared_ptr<tcp_connection>, const net_message*)> session_handler_;
+	std::shared_ptr<outbound_state> outbound_;
 	std::function<void (std::size_t, char*, std::size_t)> read_handler_;
 	std::function<void (std::shared_ptr<tcp_connection>)> disconnect_;
 	net_message read_message_;
-	std::deque<net_message> write_messages_;
+	message_queue write_messages_;
+	// the one read and the one write that can be in flight at a time (see net_handler_memory.hpp)
+	handler_memory read_memory_;
+	handler_memory write_memory_;
 	int id_;
 };
 
 class net_server {
 public:
-	net_server(boost::asio::io_context& io_context, std::size_t port, 
+	// with takeover, the listening socket and connections handed over by another process are used
+	// instead of binding the port (accept_handler isn't called for the connections that came over)
+	// the listening socket is bound in here, so a port that is already taken throws
+	net_server(boost::asio::io_context& io_context, const server_options& options, 
 			   std::function<void (std::size_t, bool)> accept_handler,
-	           std::function<void (std::size_t, char*, std::size_t)> read_handler);
+	           std::function<void (std::size_t, char*, std::size_t)> read_handler,
+	           const handoff_state* takeover = nullptr);
+	~net_server();
 	
 	void send_to(std::size_t id, const char* body, std::size_t length);
 	void send_to_all(const char* body, std::size_t length);
+	// the same for a message the application has already encoded, like a batch from a message_history
+	void send_to(std::size_t id, const net_message& msg);
+	void send_to_all(const net_message& msg);
+	// only to the clients that filter returns true for, it's called with connections_mutex_ held
+	void send_to_all(const net_message& msg, const std::function<bool (std::size_t)>& filter);
 	void send_to_all_except(std::size_t id, const char* body, std::size_t length);
+	
+	// changes how dead connections are detected, applies to connections accepted afterwards
+	void set_heartbeat(const heartbeat_options& options);
+	// limits how fast each client can send messages, applies to connections accepted afterwards
+	void set_rate_limit(const rate_limit_options& options);
+	// lets clients that lost their connection come back as the same client (see session_options)
+	void set_session(const session_options& options);
+	// pauses reading from every client while more than high_watermark bytes are waiting
+	// to be written, until it drops to low_watermark (see outbound_state)
+	void set_flow_control(std::size_t high_watermark, std::size_t low_watermark);
+	
+	// lets the application stop reading from a client that it can't keep up with for now
+	bool pause_reading(std::size_t id);
+	bool resume_reading(std::size_t id);
+	
+	// the timer wheel shared by everything on this server's io_context (see net_timer_wheel.hpp)
+	net_timer_wheel& get_timer_wheel();
+	
+	// Session affinity: an application can create a strand for some unit of shared state
+	// (a game, a room, ...) and move every connection that touches that state onto it.
+	// After that, the read_handler calls for those connections are serialized on the strand.
+	net_strand make_strand();
+	bool set_strand(std::size_t id, net_strand strand);
+	
+	// Graceful shutdown: stops accepting, sends goodbye (if it isn't empty) to every client,
+	// drains every connection (see tcp_connection::drain), and calls done once every client
+	// has gone. Connections that are still around after deadline are closed outright.
+	// done is called once, on one of the io_context's threads.
+	void shutdown(std::chrono::milliseconds deadline, const std::string& goodbye, std::function<void ()> done);
+	
+	// Hot restart (see net_handoff.hpp): listens on the Unix socket at path for a new process.
+	// When one connects, the listening socket (and every connection if include_connections is set)
+	// is handed off to it along with whatever save_state returns, and then done is called.
+	// If sending fails, this server takes everything back and carries on.
+	void enable_hot_restart(const std::string& path, bool include_connections,
+	                        std::function<std::string ()> save_state, std::function<void ()> done);
+	// stops accepting and collects everything that a new process needs to take over
+	void hand_off(bool include_connections, std::function<void (handoff_state)> done);
 		
 private:
 	void client_disconnect(std::shared_ptr<tcp_connection> connection);
 	void start_accept();
+	void accept_one();
+	void add_connection(tcp::socket socket);
+	void setup_connection(tcp::socket& socket, net_strand strand);
 	std::shared_ptr<tcp_connection> find_connection(std::size_t id);
+	void configure_socket(tcp::socket& socket);
+	void set_keepalive(tcp::socket& socket);
+	void schedule_check(std::shared_ptr<tcp_connection> connection, std::chrono::steady_clock::time_point when);
+	void check_connection(std::weak_ptr<tcp_connection> weak_connection);
+	void outbound_changed(bool saturated);
+	void shutdown_deadline();
+	void finish_shutdown();
+	void adopt(const handoff_state& state);
+	void open_session(std::shared_ptr<tcp_connection> connection, const net_message* hello);
+	void establish(std::shared_ptr<tcp_connection> connection, bool with_session);
+	void resume_session(std::shared_ptr<tcp_connection> connection, std::shared_ptr<tcp_connection> parked, std::uint64_t client_received);
+	void finish_resume(std::shared_ptr<tcp_connection> connection, std::shared_ptr<tcp_connection> parked,
+	                   std::deque<net_message> pending, std::uint64_t client_received);
+	void expire_session(std::shared_ptr<tcp_connection> connection);
+	std::shared_ptr<tcp_connection> make_connection(tcp::socket socket, std::size_t id, net_strand strand);
+	void connection_handed_off(std::shared_ptr<tcp_connection> connection, handoff_connection handed_off);
+	void finish_handoff();
 
 	boost::asio::io_context& io_context_;
 	tcp::acceptor acceptor_;
+	net_strand accept_strand_; // so that shutdown can close the acceptor while an accept is completing
+	server_options options_;
+	
+	// Every connection has one liveness check on the timer wheel. Instead of moving the timer
+	// every time a message arrives, the connection just records when it last heard from its client,
+	// and when the timer fires the connection works out whether it needs a ping,
+	// needs to be closed, or can go back on the wheel for later.
+	net_timer_wheel& timer_wheel_;
+	heartbeat_options heartbeat_;
+	rate_limit_options rate_limit_;
+	std::shared_ptr<outbound_state> outbound_; // shared with the connections, which can outlive the server
+	session_options session_;
+	std::shared_ptr<connection_pool> pool_;
 	
 	std::size_t next_id_;
 	std::list<std::shared_ptr<tcp_connection>> connections_;
 	std::mutex connections_mutex_;
 	
+	bool shutting_down_; // guarded by connections_mutex_
+	std::atomic<bool> shutdown_finished_;
+	net_timer_wheel::handle shutdown_timer_;
+	std::function<void ()> shutdown_handler_;
+	
+	bool handing_off_; // guarded by connections_mutex_, like the rest of the handoff state
+	std::size_t handoff_pending_;
+	handoff_state handoff_;
+	std::function<void (handoff_state)> handoff_handler_;
+	std::unique_ptr<boost::asio::local::stream_protocol::acceptor> handoff_acceptor_;
+	
+	// sessions, guarded by connections_mutex_
+	std::unordered_map<std::string, std::size_t> sessions_; // token -> client id
+	std::unordered_map<std::size_t, std::shared_ptr<tcp_connection>> parked_;
+	// new connections whose session still belongs to a connection that hasn't noticed it's dead yet
+	std::unordered_map<std::size_t, std::pair<std::shared_ptr<tcp_connection>, std::uint64_t>> waiting_resume_;
+	
 	std::function<void (std::size_t, bool)> accept_handler_; // the bool is true=connection false=disconnect
 	std::function<void (std::size_t, char*, std::size_t)> read_handler_;
 };
 
+inline void application_server::shutdown(std::chrono::milliseconds deadline, const std::string& goodbye) {
+	server_ptr_->shutdown(deadline, goodbye, [this]() { io_context_.stop(); });
+}
+
+inline void application_server::enable_hot_restart(const std::string& path, bool include_connections) {
+	// With include_connections the clients move to the new process and this one just stops,
+	// otherwise only the listening socket moves and the clients here are drained like in shutdown().
+	server_ptr_->enable_hot_restart(path, include_connections,
+	  [this]() { return save_state(); },
+	  [this, include_connections]() {
+		if (include_connections) {
+			io_context_.stop();
+		} else {
+			shutdown(shutdown_deadline_, goodbye_message_);
+		}
+	  });
+}
+
 #endif
 
 /*
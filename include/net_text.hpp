@@ -0,0 +1,38 @@
+#ifndef _NET_TEXT_HPP_
+#define _NET_TEXT_HPP_
+
+#include <cstddef>
+
+/*
+
+Checks for the text that clients send, done a vector at a time.
+
+A server that relays what clients type has to look at every byte of it before passing it on:
+that it's valid UTF-8 (or every client gets to deal with the broken bytes), that a name only has
+the characters names are allowed to have, and where a command's arguments start and end.
+Byte by byte, that costs more than everything else the server does with a message once messages
+get long. These functions look at 32 bytes at a time with AVX2, or 16 at a time with SSSE3 and SSE4.2,
+and fall back to plain loops on processors (and architectures) without them. Which one is used
+is decided once, the first time any of them is called, from what the processor says it supports,
+so the library itself is built without any -m flags and runs anywhere.
+
+UTF-8 is checked the way simdjson does it (Keiser and Lemire, "Validating UTF-8 In Less Than One
+Instruction Per Byte"): every byte is looked at together with the three before it, and three table
+lookups on their nibbles find every sequence that is too short, too long, overlong, a surrogate
+or past U+10FFFF, without any branches on the data.
+
+All of them take a pointer and a length, the text doesn't have to end with a '\0'
+(and a '\0' in it is just another byte).
+
+*/
+
+// true if data is well formed UTF-8 (RFC 3629), an empty string is
+bool text_valid_utf8(const char* data, std::size_t length);
+// true if data is at least one byte long and only has ASCII letters and digits in it
+bool text_is_identifier(const char* data, std::size_t length);
+// the position of the first delimiter in data, length if there isn't one
+std::size_t text_find(const char* data, std::size_t length, char delimiter);
+// which version is in use: "avx2", "sse4.2" or "scalar"
+const char* text_implementation();
+
+#endif
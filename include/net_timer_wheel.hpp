@@ -0,0 +1,115 @@
+#ifndef _NET_TIMER_WHEEL_HPP_
+#define _NET_TIMER_WHEEL_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+/*
+
+The net_timer_wheel class is a timer service that is shared by everything running on an io_context.
+
+A boost::asio::steady_timer per timeout means one heap allocated timer and one insert into
+the io_context's timer queue every time the timeout is reset. With a timeout per connection
+(or per game, or per rate limit window) that cost adds up, so instead all of those timeouts
+go on one hierarchical timer wheel that is driven by a single steady_timer.
+
+The wheel has levels of 64 slots each. Level 0 holds timers that are due within 64 ticks,
+level 1 within 64^2 ticks and so on. When level 0 wraps around, the next slot of level 1 is
+emptied into the lower levels (and the same for the higher levels). Scheduling and cancelling
+a timer are both O(1), and each timer is moved down at most once per level.
+
+There is one wheel per io_context, created the first time it's asked for:
+
+	net_timer_wheel& timers = boost::asio::use_service<net_timer_wheel>(io_context);
+	net_timer_wheel::handle h = timers.schedule(std::chrono::seconds(5), []() {
+		// runs on one of the io_context's threads roughly 5 seconds from now
+	});
+	timers.cancel(h);
+
+Timers are accurate to one tick (resolution(), 10ms by default).
+A callback can be scheduled on a strand so that it is serialized with everything else on that strand.
+The strand is the one passed to schedule(), fixed from then on: something that can move to another
+strand in the meantime (a net_server connection can) should schedule a plain callback instead and
+dispatch to wherever it is when the callback runs. The strand is kept in the timer's entry next to
+the callback, so scheduling on a strand costs no more than scheduling without one.
+A callback that is already on its way to running can't be cancelled anymore, cancel() returns false
+in that case so the caller knows to expect it.
+net_server gives access to the wheel through net_server::get_timer_wheel() as well.
+
+*/
+
+class net_timer_wheel : public boost::asio::io_context::service {
+public:
+	typedef std::uint64_t handle; // 0 is never a valid handle so it can be used for "no timer"
+	typedef std::chrono::steady_clock clock;
+	typedef boost::asio::strand<boost::asio::io_context::executor_type> strand_type;
+
+	static boost::asio::io_context::id id;
+
+	explicit net_timer_wheel(boost::asio::io_context& io_context);
+
+	handle schedule(clock::duration delay, std::function<void ()> callback);
+	handle schedule(strand_type strand, clock::duration delay, std::function<void ()> callback);
+	bool cancel(handle timer);
+
+	// the length of a tick, can only be changed while no timers are scheduled
+	void set_resolution(clock::duration resolution);
+	clock::duration resolution();
+	std::size_t size();
+
+private:
+	enum { levels = 4 };
+	enum { slot_bits = 6 };
+	enum { slots = 1 << slot_bits };
+	enum : std::uint32_t { npos = 0xffffffff };
+
+	struct entry {
+		std::function<void ()> callback;
+		std::optional<strand_type> strand; // where the callback is dispatched to, if anywhere
+		std::uint64_t expire_tick;
+		std::uint32_t prev;
+		std::uint32_t next;
+		std::uint32_t list; // index into heads_ of the slot this entry is in
+		std::uint32_t generation; // bumped every time the entry is reused so old handles stop matching
+	};
+
+	// a callback that has come due, taken out of its entry so the entry can be reused straight away
+	struct due_timer {
+		std::function<void ()> callback;
+		std::optional<strand_type> strand;
+	};
+
+	void shutdown() override;
+
+	handle add(clock::duration delay, std::function<void ()> callback, std::optional<strand_type> strand);
+	void insert(std::uint32_t index);
+	void link(std::uint32_t index, std::uint32_t list);
+	void unlink(std::uint32_t index);
+	void release(std::uint32_t index);
+	std::uint64_t now_tick();
+	void advance(std::vector<due_timer>& due);
+	void cascade(int level);
+	void arm();
+	void handle_tick(const boost::system::error_code& e);
+
+	boost::asio::steady_timer tick_timer_;
+	std::mutex mutex_;
+	clock::time_point origin_;
+	clock::duration resolution_;
+	std::uint64_t current_tick_;
+	bool ticking_;
+	bool shutdown_;
+
+	std::vector<entry> entries_;
+	std::vector<std::uint32_t> free_;
+	std::uint32_t heads_[levels * slots];
+	std::size_t size_;
+};
+
+#endif
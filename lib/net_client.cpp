@@ -1,35 +1,137 @@
 #include "net_client.hpp"
 
+#include <algorithm>
+
 
 net_client::net_client(boost::asio::io_context& io_context, std::string& ip, std::size_t port,
-	           std::function<void (char*, std::size_t)> read_handler) 
-  : io_context_(io_context), socket_(io_context), read_handler_(read_handler) {
-	connect(ip, port);
+	           std::function<void (char*, std::size_t)> read_handler, const reconnect_options& options)
+  : io_context_(io_context), socket_(io_context),
+    endpoint_(boost::asio::ip::address::from_string(ip), port), retry_timer_(io_context),
+    options_(options), rng_(std::random_device()()), state_(disconnected), generation_(0), attempts_(0),
+    writing_(false), reconnected_(false), has_token_(false), received_(0), acked_(0), read_handler_(read_handler) {
+	if (!options_.enabled) {
+		// the old behaviour: a server that isn't there is an error straight away
+		socket_.connect(endpoint_);
+		socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+		state_ = handshaking;
+		handshake();
+		return;
+	}
+	connect();
+}
+
+void net_client::set_reconnect_handler(std::function<void (bool)> handler) {
+	reconnect_handler_ = handler;
 }
 
-void net_client::connect(std::string& ip, std::size_t port) {
-	// The first thing that we do after the constructor has initialized its members
-	// is connect to the server.
+void net_client::connect() {
+	// Starts a new connection attempt on a fresh socket.
 	// As of now, only local network connections are supported so we will
 	// always connect to 127.0.0.1
-	// After connecting, we call read_header() to start the read loop.
-	socket_.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(ip), port));
-		
+	// Once connected, the session handshake starts the read loop.
+	boost::system::error_code ec;
+	socket_.close(ec);
+	socket_ = boost::asio::ip::tcp::socket(io_context_);
+	state_ = connecting;
+	generation_++;
+	socket_.async_connect(endpoint_, boost::bind(&net_client::handle_connect, this,
+	  boost::asio::placeholders::error, generation_));
+}
+
+void net_client::handle_connect(const boost::system::error_code e, std::uint64_t generation) {
+	if (generation != generation_) return;
+	if (e) {
+		std::cerr << "couldn't connect to server: " << e.message() << std::endl;
+		state_ = disconnected;
+		schedule_reconnect();
+		return;
+	}
+	// frames are small and written one at a time, Nagle would only hold them back
+	boost::system::error_code ec;
+	socket_.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+	state_ = handshaking;
+	handshake();
+}
+
+void net_client::handshake() {
+	// HELO goes out ahead of everything in the write queue, which waits for the server's WELC
+	hello_message_ = net_message(net_message::hello_frame, has_token_ ? token_ : nullptr, received_);
+	std::uint64_t generation = generation_;
+	boost::asio::async_write(socket_, boost::asio::buffer(hello_message_.get_data(),
+	    hello_message_.get_body_length() + net_message::header_length),
+	  [this, generation] (boost::system::error_code ec, std::size_t /*length*/) {
+		if (generation == generation_ && ec) {
+			connection_lost(ec);
+		}
+	  });
 	read_header();
 }
 
+void net_client::connection_lost(const boost::system::error_code e) {
+	// Everything that was queued or written but not acknowledged stays around for the next connection.
+	if (state_ == disconnected) return;
+	std::cerr << "lost the connection to the server: " << e.message() << std::endl;
+	boost::system::error_code ec;
+	socket_.close(ec);
+	state_ = disconnected;
+	writing_ = false;
+	generation_++;
+	if (options_.enabled) {
+		schedule_reconnect();
+	}
+}
+
+void net_client::schedule_reconnect() {
+	// full jitter: anywhere between no wait at all and the current backoff
+	attempts_++;
+	if (options_.max_attempts && attempts_ > options_.max_attempts) {
+		std::cerr << "giving up on reconnecting to the server" << std::endl;
+		return;
+	}
+	std::chrono::milliseconds cap = options_.max_delay;
+	if (attempts_ <= 20 && options_.initial_delay * (1 << (attempts_ - 1)) < cap) {
+		cap = options_.initial_delay * (1 << (attempts_ - 1));
+	}
+	std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(0, cap.count());
+	retry_timer_.expires_after(std::chrono::milliseconds(jitter(rng_)));
+	retry_timer_.async_wait([this](const boost::system::error_code& e) {
+		if (!e) {
+			connect();
+		}
+	});
+}
+
 void net_client::read_header() {
 	// Similar to the server's read loop, we start by reading net_message::header_length bytes
 	// from every message so that we can figure out how many bytes the body of message is.
 	boost::asio::async_read(socket_,
 	  boost::asio::buffer(read_message_.get_data(), net_message::header_length),
-	  boost::bind(&net_client::handle_read_header, this, boost::asio::placeholders::error,
-	  boost::asio::placeholders::bytes_transferred));
+	  make_alloc_handler(read_memory_, boost::bind(&net_client::handle_read_header, this, boost::asio::placeholders::error,
+	  boost::asio::placeholders::bytes_transferred, generation_)));
 }
 
-void net_client::handle_read_header(const boost::system::error_code e, std::size_t bytes_transferred) {
+void net_client::handle_read_header(const boost::system::error_code e, std::size_t bytes_transferred, std::uint64_t generation) {
 	// Decode the header and call read_body()
-	read_message_.decode_header();
+	// Pings from the server are answered right here and never reach the application.
+	if (generation != generation_) return;
+	if (e) {
+		connection_lost(e);
+		return;
+	}
+	if (!read_message_.decode_header()) {
+		std::cerr << "received a malformed header from the server, closing the connection" << std::endl;
+		connection_lost(boost::asio::error::invalid_argument);
+		return;
+	}
+	if (read_message_.get_type() == net_message::ping_frame) {
+		queue_message(net_message(net_message::pong_frame));
+		read_header();
+		return;
+	}
+	if (read_message_.get_type() == net_message::pong_frame) {
+		read_header();
+		return;
+	}
 	read_body();
 }
 
@@ -37,11 +139,34 @@ void net_client::read_body() {
 	// Read the body of the message into the read_message_ member variable (which is of type net_message).
 	// We know how many bytes the body is because we decoded the header above.
 	boost::asio::async_read(socket_, boost::asio::buffer(read_message_.get_data() + net_message::header_length, read_message_.get_body_length()),
-	  boost::bind(&net_client::handle_read_body, this, boost::asio::placeholders::error,
-	  boost::asio::placeholders::bytes_transferred));
+	  make_alloc_handler(read_memory_, boost::bind(&net_client::handle_read_body, this, boost::asio::placeholders::error,
+	  boost::asio::placeholders::bytes_transferred, generation_)));
 }
 
-void net_client::handle_read_body(const boost::system::error_code e, std::size_t bytes_transferred) {
+void net_client::handle_read_body(const boost::system::error_code e, std::size_t bytes_transferred, std::uint64_t generation) {
+	if (generation != generation_) return;
+	if (e) {
+		connection_lost(e);
+		return;
+	}
+	if (read_message_.get_type() == net_message::welcome_frame) {
+		handle_welcome();
+		read_header();
+		return;
+	}
+	if (read_message_.get_type() == net_message::ack_frame) {
+		handle_ack(read_message_.get_count());
+		read_header();
+		return;
+	}
+	if (read_message_.get_type() != net_message::data_frame) {
+		read_header();
+		return;
+	}
+	received_++;
+	if (has_token_ && received_ % net_message::ack_every == 0) {
+		queue_message(net_message(net_message::ack_frame, nullptr, received_));
+	}
 	// The body of the message is now located at read_message_.get_body()
 	// Let's copy the body of the message into a local char array and forward it
 	// to the application client so they can do some processing if they want.
@@ -53,40 +178,117 @@ void net_client::handle_read_body(const boost::system::error_code e, std::size_t
 	read_header();
 }
 
+void net_client::handle_welcome() {
+	// The server has answered the handshake. Works out which data frames it still needs
+	// and puts them at the front of the write queue.
+	bool resumed = has_token_ && !std::memcmp(token_, read_message_.get_token(), net_message::token_length);
+	message_queue pending;
+	if (resumed) {
+		// the server's count covers frames that were written (unacked_) and maybe some that
+		// were still queued when the connection dropped, so both are lined up before trimming
+		pending.swap(unacked_);
+	} else {
+		unacked_.clear();
+	}
+	for (std::size_t i = 0; i < write_messages_.size(); i++) {
+		if (write_messages_[i].get_type() == net_message::data_frame) {
+			pending.push_back(write_messages_[i]);
+		}
+	}
+	if (resumed) {
+		std::uint64_t count = read_message_.get_count();
+		while (acked_ < count && !pending.empty()) {
+			pending.pop_front();
+			acked_++;
+		}
+		acked_ = std::max(acked_, count);
+	} else {
+		// a server without sessions sends a token of all zeros
+		std::memcpy(token_, read_message_.get_token(), net_message::token_length);
+		has_token_ = std::any_of(token_, token_ + net_message::token_length, [](char c) { return c != 0; });
+		received_ = 0;
+		acked_ = 0;
+	}
+	write_messages_.swap(pending);
+	state_ = established;
+	attempts_ = 0;
+	if (!write_messages_.empty()) {
+		do_write();
+	}
+	if (reconnected_ && reconnect_handler_) {
+		reconnect_handler_(resumed);
+	}
+	reconnected_ = true;
+}
+
+void net_client::handle_ack(std::uint64_t count) {
+	while (acked_ < count && !unacked_.empty()) {
+		unacked_.pop_front();
+		acked_++;
+	}
+}
+
 void net_client::send(const char* body, std::size_t length) {
 	// For sending messages, we use an outgoing message queue.
 	// Anytime the client wants to send a message, this function will be called.
 	// If the message queue is not currently empty, do_write() will be called.
 	// do_write() will call itself recursively until every message has been sent from
 	// the queue.
-	// Because of this, we know that if the message queue is not already empty,
-	// do_write() must still be in progress so we don't need to call it again.
-	bool write_in_progress = !write_messages_.empty();
-	write_messages_.emplace_back(body, length);
-	if (!write_in_progress) {
+	// The queue belongs to the io thread (which also queues pongs), so the message is
+	// handed over to it rather than being pushed from the application's thread.
+	// A send from one of the client's own handlers is already on the io thread,
+	// so it goes straight in the queue (without an extra handler to allocate).
+	net_message msg(body, length);
+	if (io_context_.get_executor().running_in_this_thread()) {
+		queue_message(msg);
+		return;
+	}
+	boost::asio::post(io_context_, boost::bind(&net_client::queue_message, this, msg));
+}
+
+void net_client::queue_message(net_message msg) {
+	// while the client isn't connected the message just waits in the queue
+	write_messages_.push_back(msg);
+	if (state_ == established && !writing_) {
 		do_write();
 	}
 }
 
 void net_client::do_write() {
-	// The function that repeatedly starts async_write calls until the 
+	// The function that repeatedly starts async_write calls until the
 	// message queue is empty.
-	boost::asio::async_write(socket_, boost::asio::buffer(write_messages_.front().get_data(), 
+	writing_ = true;
+	boost::asio::async_write(socket_, boost::asio::buffer(write_messages_.front().get_data(),
 	    write_messages_.front().get_body_length() + net_message::header_length),
-	  [this] (boost::system::error_code ec, std::size_t /*length*/) {
-		  if (!ec) {
-			  write_messages_.pop_front();
-			  if (!write_messages_.empty()) {
-				  do_write();
-			  }
-		  } else {
-			  std::cerr << "error with writing to server with error code: " << ec << std::endl;
-		  }
-	  });
+	  make_alloc_handler(write_memory_, boost::bind(&net_client::handle_write, this, boost::asio::placeholders::error, generation_)));
+}
+
+void net_client::handle_write(const boost::system::error_code e, std::uint64_t generation) {
+	if (generation != generation_) return;
+	if (e) {
+		std::cerr << "error with writing to server with error code: " << e << std::endl;
+		connection_lost(e);
+		return;
+	}
+	// data frames are kept until the server says it has them, in case they have to be sent again
+	if (has_token_ && write_messages_.front().get_type() == net_message::data_frame) {
+		unacked_.push_back(write_messages_.front());
+		if (unacked_.size() > options_.replay_frames) {
+			// too far behind on acknowledgements, the oldest frame couldn't be resent anymore
+			unacked_.pop_front();
+			acked_++;
+		}
+	}
+	write_messages_.pop_front();
+	if (!write_messages_.empty()) {
+		do_write();
+	} else {
+		writing_ = false;
+	}
 }
 
 std::size_t net_client::get_max_body_length() {
-	// Getter function that lets the application client 
+	// Getter function that lets the application client
 	// find out what the max_body_length of a message is.
 	return net_message::max_body_length;
-}
\ No newline at end of file
+}
@@ -0,0 +1,78 @@
+#include "net_coalescer.hpp"
+
+broadcast_coalescer::broadcast_coalescer(boost::asio::io_context& io_context, std::shared_ptr<net_server> server,
+                                         const coalesce_options& options)
+  : server_(server), options_(options), timer_(io_context), timer_running_(false), count_(0)
+{}
+
+broadcast_coalescer::~broadcast_coalescer() {
+	timer_.cancel();
+}
+
+void broadcast_coalescer::send(const net_message& msg) {
+	std::scoped_lock lock(mutex_);
+	if (!options_.enabled) {
+		server_->send_to_all(msg);
+		return;
+	}
+	if (msg.get_type() != net_message::data_frame && msg.get_type() != net_message::batch_frame) {
+		return;
+	}
+	frames_.append(msg.get_frame_data(), msg.get_frame_length());
+	count_ += msg.get_frame_count();
+	if (frames_.size() >= options_.max_bytes) {
+		flush_locked(nullptr);
+	} else if (!timer_running_) {
+		timer_running_ = true;
+		timer_.expires_after(options_.window);
+		timer_.async_wait(std::bind(&broadcast_coalescer::handle_timer, this, std::placeholders::_1));
+	}
+}
+
+void broadcast_coalescer::flush(const std::function<bool (std::size_t)>& filter) {
+	std::scoped_lock lock(mutex_);
+	flush_locked(filter);
+}
+
+void broadcast_coalescer::flush_locked(const std::function<bool (std::size_t)>& filter) {
+	if (timer_running_) {
+		timer_running_ = false;
+		timer_.cancel();
+	}
+	if (count_ == 0) {
+		return;
+	}
+	net_message batch(std::make_shared<const std::string>(std::move(frames_)), count_);
+	frames_.clear();
+	count_ = 0;
+	if (filter) {
+		server_->send_to_all(batch, filter);
+	} else {
+		server_->send_to_all(batch);
+	}
+}
+
+void broadcast_coalescer::handle_timer(const boost::system::error_code& e) {
+	if (e == boost::asio::error::operation_aborted) {
+		return;
+	}
+	// a timer that went off just as the batch was flushed early finds the next batch instead,
+	// which then goes out a little sooner than it had to
+	flush();
+}
+
+void broadcast_coalescer::set_options(const coalesce_options& options) {
+	std::scoped_lock lock(mutex_);
+	flush_locked(nullptr);
+	options_ = options;
+}
+
+coalesce_options broadcast_coalescer::get_options() {
+	std::scoped_lock lock(mutex_);
+	return options_;
+}
+
+std::size_t broadcast_coalescer::pending() {
+	std::scoped_lock lock(mutex_);
+	return count_;
+}
@@ -0,0 +1,227 @@
+#include "net_filter.hpp"
+
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace {
+	unsigned char fold(unsigned char c) {
+		return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	}
+
+	bool is_word_byte(unsigned char c) {
+		// bytes of UTF-8 sequences count as letters, so a word doesn't end in the middle of "é"
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+	}
+
+	std::uint64_t message_hash(const char* text, std::size_t length) {
+		// FNV-1a over the letters and digits, folded to lower case
+		const unsigned char* s = reinterpret_cast<const unsigned char*>(text);
+		std::uint64_t h = 14695981039346656037ull;
+		for (std::size_t i = 0; i < length; i++) {
+			if (is_word_byte(s[i])) {
+				h = (h ^ fold(s[i])) * 1099511628211ull;
+			}
+		}
+		return h;
+	}
+}
+
+word_automaton::word_automaton(const std::vector<std::string>& words)
+  : columns_(1), words_(0)
+{
+	// column 0 is every byte that isn't in any word
+	std::memset(classes_, 0, sizeof(classes_));
+	for (auto& word : words) {
+		for (unsigned char c : word) {
+			c = fold(c);
+			if (!classes_[c]) {
+				classes_[c] = columns_++;
+			}
+		}
+	}
+	for (int c = 'A'; c <= 'Z'; c++) {
+		classes_[c] = classes_[fold(c)];
+	}
+
+	// the trie, where 0 is "no edge" (nothing leads back to the root)
+	next_.assign(columns_, 0);
+	word_length_.assign(1, 0);
+	for (auto& word : words) {
+		if (word.empty()) {
+			continue;
+		}
+		std::uint32_t state = 0;
+		for (unsigned char c : word) {
+			std::size_t edge = state * columns_ + classes_[c];
+			if (!next_[edge]) {
+				next_[edge] = word_length_.size();
+				next_.resize(next_.size() + columns_, 0);
+				word_length_.push_back(0);
+			}
+			state = next_[edge];
+		}
+		if (!word_length_[state]) {
+			words_++;
+		}
+		word_length_[state] = word.length();
+	}
+
+	// Breadth first, so a state's failure state (which is shallower) already has all of its edges.
+	// A missing edge becomes the failure state's edge for the same column, which turns the trie into a DFA.
+	std::vector<std::uint32_t> fail(word_length_.size(), 0);
+	output_.assign(word_length_.size(), 0);
+	std::deque<std::uint32_t> queue;
+	for (std::size_t c = 0; c < columns_; c++) {
+		if (next_[c]) {
+			queue.push_back(next_[c]);
+		}
+	}
+	while (!queue.empty()) {
+		std::uint32_t state = queue.front();
+		queue.pop_front();
+		std::uint32_t failure = fail[state];
+		output_[state] = word_length_[failure] ? failure : output_[failure];
+		for (std::size_t c = 0; c < columns_; c++) {
+			std::uint32_t& edge = next_[state * columns_ + c];
+			if (edge) {
+				fail[edge] = next_[failure * columns_ + c];
+				queue.push_back(edge);
+			} else {
+				edge = next_[failure * columns_ + c];
+			}
+		}
+	}
+}
+
+template <typename Found>
+void word_automaton::scan(const char* text, std::size_t length, bool whole_words, Found found) const {
+	// found(start, length) returns false to stop
+	const unsigned char* s = reinterpret_cast<const unsigned char*>(text);
+	std::uint32_t state = 0;
+	for (std::size_t i = 0; i < length; i++) {
+		state = next_[state * columns_ + classes_[s[i]]];
+		for (std::uint32_t w = word_length_[state] ? state : output_[state]; w; w = output_[w]) {
+			std::size_t start = i + 1 - word_length_[w];
+			if (whole_words && ((start > 0 && is_word_byte(s[start - 1])) || (i + 1 < length && is_word_byte(s[i + 1])))) {
+				continue;
+			}
+			if (!found(start, word_length_[w])) {
+				return;
+			}
+		}
+	}
+}
+
+std::size_t word_automaton::mask(char* text, std::size_t length, bool whole_words) const {
+	// masked once the scan is done, so the scan still sees the letters around every word
+	std::vector<std::pair<std::size_t, std::size_t>> found;
+	scan(text, length, whole_words, [&](std::size_t start, std::size_t word_length) {
+		found.emplace_back(start, word_length);
+		return true;
+	});
+	for (auto& word : found) {
+		std::memset(text + word.first, '*', word.second);
+	}
+	return found.size();
+}
+
+bool word_automaton::contains(const char* text, std::size_t length, bool whole_words) const {
+	bool found = false;
+	scan(text, length, whole_words, [&](std::size_t, std::size_t) {
+		found = true;
+		return false;
+	});
+	return found;
+}
+
+std::size_t word_automaton::words() const {
+	return words_;
+}
+
+std::size_t word_automaton::states() const {
+	return word_length_.size();
+}
+
+content_filter::content_filter(const filter_options& options)
+  : options_(options)
+{}
+
+content_filter::~content_filter() {
+	std::scoped_lock lock(reload_mutex_);
+	if (reloader_.joinable()) {
+		reloader_.join();
+	}
+}
+
+void content_filter::set_words(const std::vector<std::string>& words) {
+	std::shared_ptr<const word_automaton> automaton = std::make_shared<const word_automaton>(words);
+	std::atomic_store(&automaton_, automaton);
+}
+
+void content_filter::reload(const std::string& path) {
+	std::scoped_lock lock(reload_mutex_);
+	if (reloader_.joinable()) {
+		reloader_.join();
+	}
+	reloader_ = std::thread([this, path]() {
+		std::ifstream file(path);
+		if (!file) {
+			std::cerr << "Couldn't read the word list " << path << ", keeping the current one." << std::endl;
+			return;
+		}
+		std::vector<std::string> words;
+		std::string line;
+		while (std::getline(file, line)) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (!line.empty() && line[0] != '#') {
+				words.push_back(line);
+			}
+		}
+		set_words(words);
+	});
+}
+
+std::size_t content_filter::words() {
+	std::shared_ptr<const word_automaton> automaton = std::atomic_load(&automaton_);
+	return automaton ? automaton->words() : 0;
+}
+
+content_filter::verdict content_filter::check(std::size_t sender, char* body, std::size_t length) {
+	if (options_.duplicate_window > 0 && is_repeat(sender, message_hash(body, length))) {
+		return repeated;
+	}
+	std::shared_ptr<const word_automaton> automaton = std::atomic_load(&automaton_);
+	if (automaton && automaton->mask(body, length, options_.whole_words) > 0) {
+		return masked;
+	}
+	return passed;
+}
+
+bool content_filter::is_repeat(std::size_t sender, std::uint64_t hash) {
+	auto now = std::chrono::steady_clock::now();
+	std::scoped_lock lock(recent_mutex_);
+	std::vector<recent_message>& recent = recent_[sender];
+	while (!recent.empty() && now - recent.front().time > options_.duplicate_age) {
+		recent.erase(recent.begin());
+	}
+	for (auto& message : recent) {
+		if (message.hash == hash) {
+			return true;
+		}
+	}
+	if (recent.size() == options_.duplicate_window) {
+		recent.erase(recent.begin());
+	}
+	recent.push_back(recent_message{ hash, now });
+	return false;
+}
+
+void content_filter::forget(std::size_t sender) {
+	std::scoped_lock lock(recent_mutex_);
+	recent_.erase(sender);
+}
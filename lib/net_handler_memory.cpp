@@ -0,0 +1,21 @@
+#include "net_handler_memory.hpp"
+
+handler_memory::handler_memory()
+  : in_use_(false)
+{}
+
+void* handler_memory::allocate(std::size_t length) {
+	if (!in_use_ && length <= size) {
+		in_use_ = true;
+		return &storage_;
+	}
+	return ::operator new(length);
+}
+
+void handler_memory::deallocate(void* pointer) {
+	if (pointer == &storage_) {
+		in_use_ = false;
+	} else {
+		::operator delete(pointer);
+	}
+}
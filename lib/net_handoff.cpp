@@ -0,0 +1,249 @@
+#include "net_handoff.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+	const char magic[4] = { 'N', 'H', 'O', '2' };
+	// the kernel limits how many descriptors one message can carry (SCM_MAX_FD), so they go in batches
+	const std::uint32_t fds_per_batch = 128;
+
+	bool write_all(int fd, const char* data, std::size_t length) {
+		while (length > 0) {
+			ssize_t written = ::write(fd, data, length);
+			if (written < 0 && errno == EINTR) continue;
+			if (written <= 0) return false;
+			data += written;
+			length -= written;
+		}
+		return true;
+	}
+
+	bool read_all(int fd, char* data, std::size_t length) {
+		while (length > 0) {
+			ssize_t got = ::read(fd, data, length);
+			if (got < 0 && errno == EINTR) continue;
+			if (got <= 0) return false;
+			data += got;
+			length -= got;
+		}
+		return true;
+	}
+
+	bool send_fds(int socket_fd, const int* fds, std::uint32_t count) {
+		// the count goes in the payload because ancillary data can't be sent without at least one byte
+		char control[CMSG_SPACE(sizeof(int) * fds_per_batch)];
+		std::memset(control, 0, sizeof(control));
+		iovec iov;
+		iov.iov_base = &count;
+		iov.iov_len = sizeof(count);
+		msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+		std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+		ssize_t sent;
+		do {
+			sent = ::sendmsg(socket_fd, &msg, 0);
+		} while (sent < 0 && errno == EINTR);
+		return sent == sizeof(count);
+	}
+
+	bool receive_fds(int socket_fd, std::vector<int>& fds) {
+		std::uint32_t count = 0;
+		char control[CMSG_SPACE(sizeof(int) * fds_per_batch)];
+		iovec iov;
+		iov.iov_base = &count;
+		iov.iov_len = sizeof(count);
+		msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		ssize_t got;
+		do {
+			got = ::recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+		} while (got < 0 && errno == EINTR);
+		if (got != sizeof(count) || (msg.msg_flags & MSG_CTRUNC)) {
+			return false;
+		}
+		std::size_t received = 0;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+			std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (std::size_t i = 0; i < n; i++) {
+				int fd;
+				std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				fds.push_back(fd);
+			}
+			received += n;
+		}
+		return received == count;
+	}
+
+	void put_u64(std::string& out, std::uint64_t value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	void put_string(std::string& out, const std::string& value) {
+		put_u64(out, value.size());
+		out.append(value);
+	}
+
+	bool get_u64(const std::string& in, std::size_t& pos, std::uint64_t& value) {
+		if (in.size() - pos < sizeof(value)) return false;
+		std::memcpy(&value, in.data() + pos, sizeof(value));
+		pos += sizeof(value);
+		return true;
+	}
+
+	bool get_string(const std::string& in, std::size_t& pos, std::string& value) {
+		std::uint64_t length;
+		if (!get_u64(in, pos, length) || in.size() - pos < length) return false;
+		value.assign(in, pos, length);
+		pos += length;
+		return true;
+	}
+}
+
+bool send_handoff(int socket_fd, const handoff_state& state) {
+	// Sends a fixed header, then the descriptors (the acceptor first, then one per connection),
+	// then everything else as a single length prefixed payload.
+	std::string payload;
+	put_u64(payload, state.next_id);
+	put_u64(payload, state.connections.size());
+	for (auto& connection : state.connections) {
+		put_u64(payload, connection.id);
+		put_string(payload, connection.inbound);
+		put_string(payload, connection.outbound);
+		put_u64(payload, connection.established);
+		put_string(payload, connection.session);
+		put_u64(payload, connection.received);
+		put_u64(payload, connection.acked);
+		put_string(payload, connection.replay);
+	}
+	put_string(payload, state.application);
+
+	std::vector<int> fds;
+	fds.push_back(state.acceptor_fd);
+	for (auto& connection : state.connections) {
+		fds.push_back(connection.fd);
+	}
+
+	std::string header(magic, sizeof(magic));
+	put_u64(header, fds.size());
+	put_u64(header, payload.size());
+	if (!write_all(socket_fd, header.data(), header.size())) {
+		std::cerr << "handoff: couldn't send the header: " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	for (std::size_t i = 0; i < fds.size(); i += fds_per_batch) {
+		std::uint32_t count = std::min<std::size_t>(fds_per_batch, fds.size() - i);
+		if (!send_fds(socket_fd, fds.data() + i, count)) {
+			std::cerr << "handoff: couldn't send file descriptors: " << std::strerror(errno) << std::endl;
+			return false;
+		}
+	}
+	if (!write_all(socket_fd, payload.data(), payload.size())) {
+		std::cerr << "handoff: couldn't send the state: " << std::strerror(errno) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool receive_handoff(int socket_fd, handoff_state& state) {
+	char header[sizeof(magic) + 2 * sizeof(std::uint64_t)];
+	if (!read_all(socket_fd, header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic))) {
+		std::cerr << "handoff: didn't get a valid header" << std::endl;
+		return false;
+	}
+	std::uint64_t fd_count;
+	std::uint64_t payload_length;
+	std::memcpy(&fd_count, header + sizeof(magic), sizeof(fd_count));
+	std::memcpy(&payload_length, header + sizeof(magic) + sizeof(fd_count), sizeof(payload_length));
+
+	std::vector<int> fds;
+	while (fds.size() < fd_count) {
+		if (!receive_fds(socket_fd, fds)) {
+			std::cerr << "handoff: couldn't receive file descriptors" << std::endl;
+			for (int fd : fds) ::close(fd);
+			return false;
+		}
+	}
+	std::string payload(payload_length, '\0');
+	bool ok = read_all(socket_fd, &payload[0], payload_length);
+
+	std::size_t pos = 0;
+	std::uint64_t next_id = 0;
+	std::uint64_t count = 0;
+	ok = ok && fd_count >= 1 && get_u64(payload, pos, next_id) && get_u64(payload, pos, count) && count == fd_count - 1;
+	std::vector<handoff_connection> connections;
+	for (std::uint64_t i = 0; ok && i < count; i++) {
+		handoff_connection connection;
+		std::uint64_t id;
+		std::uint64_t established;
+		ok = get_u64(payload, pos, id) && get_string(payload, pos, connection.inbound)
+		     && get_string(payload, pos, connection.outbound) && get_u64(payload, pos, established)
+		     && get_string(payload, pos, connection.session) && get_u64(payload, pos, connection.received)
+		     && get_u64(payload, pos, connection.acked) && get_string(payload, pos, connection.replay);
+		connection.id = id;
+		connection.established = established;
+		connection.fd = fds[i + 1];
+		connections.push_back(std::move(connection));
+	}
+	std::string application;
+	ok = ok && get_string(payload, pos, application);
+	if (!ok) {
+		std::cerr << "handoff: the state that was received is malformed" << std::endl;
+		for (int fd : fds) ::close(fd);
+		return false;
+	}
+	state.acceptor_fd = fds[0];
+	state.next_id = next_id;
+	state.connections = std::move(connections);
+	state.application = std::move(application);
+	return true;
+}
+
+bool receive_handoff(const std::string& path, handoff_state& state) {
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	if (path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "handoff: socket path is too long" << std::endl;
+		return false;
+	}
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	int socket_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socket_fd < 0 || ::connect(socket_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+		std::cerr << "handoff: couldn't connect to " << path << ": " << std::strerror(errno) << std::endl;
+		if (socket_fd >= 0) ::close(socket_fd);
+		return false;
+	}
+	bool ok = receive_handoff(socket_fd, state);
+	::close(socket_fd);
+	return ok;
+}
+
+boost::asio::ip::tcp handoff_protocol(int fd) {
+	sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if (::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) == 0 && address.ss_family == AF_INET6) {
+		return boost::asio::ip::tcp::v6();
+	}
+	return boost::asio::ip::tcp::v4();
+}
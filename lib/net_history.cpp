@@ -0,0 +1,76 @@
+#include "net_history.hpp"
+
+message_history::message_history(std::size_t depth)
+  : depth_(depth), messages_(depth)
+{}
+
+void message_history::append(const net_message& msg) {
+	std::scoped_lock lock(mutex_);
+	append_locked(msg);
+}
+
+void message_history::append_locked(const net_message& msg) {
+	if (msg.get_type() != net_message::data_frame || depth_ == 0) {
+		return;
+	}
+	if (messages_.size() == depth_) {
+		messages_.pop_front();
+	}
+	messages_.push_back(msg);
+	replay_ = nullptr;
+}
+
+net_message message_history::replay() {
+	std::scoped_lock lock(mutex_);
+	if (!replay_) {
+		std::string frames;
+		std::size_t length = 0;
+		for (std::size_t i = 0; i < messages_.size(); i++) {
+			length += messages_[i].get_frame_length();
+		}
+		frames.reserve(length);
+		for (std::size_t i = 0; i < messages_.size(); i++) {
+			frames.append(messages_[i].get_frame_data(), messages_[i].get_frame_length());
+		}
+		replay_ = std::make_shared<const std::string>(std::move(frames));
+	}
+	return net_message(replay_, messages_.size());
+}
+
+std::size_t message_history::size() {
+	std::scoped_lock lock(mutex_);
+	return messages_.size();
+}
+
+std::size_t message_history::depth() const {
+	return depth_;
+}
+
+void message_history::clear() {
+	std::scoped_lock lock(mutex_);
+	messages_.clear();
+	replay_ = nullptr;
+}
+
+std::string message_history::save() {
+	net_message batch = replay();
+	return std::string(batch.get_frame_data(), batch.get_frame_length());
+}
+
+void message_history::restore(const std::string& frames) {
+	// stops at anything that isn't a whole data frame
+	std::scoped_lock lock(mutex_);
+	messages_.clear();
+	replay_ = nullptr;
+	std::size_t pos = 0;
+	while (frames.size() - pos >= net_message::header_length) {
+		net_message msg;
+		std::memcpy(msg.get_data(), frames.data() + pos, net_message::header_length);
+		if (!msg.decode_header() || frames.size() - pos - net_message::header_length < msg.get_body_length()) {
+			break;
+		}
+		std::memcpy(msg.get_body(), frames.data() + pos + net_message::header_length, msg.get_body_length());
+		pos += net_message::header_length + msg.get_body_length();
+		append_locked(msg);
+	}
+}
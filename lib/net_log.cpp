@@ -0,0 +1,393 @@
+#include "net_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/crc.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+	// offsets inside a record header
+	const std::size_t length_at = 0;
+	const std::size_t crc_at = 4;
+	const std::size_t sequence_at = 8;
+	const std::size_t time_at = 16;
+	const std::size_t max_frame_length = net_message::header_length + net_message::max_body_length;
+
+	template <typename T>
+	T get(const char* at) {
+		T value;
+		std::memcpy(&value, at, sizeof(value));
+		return value;
+	}
+
+	template <typename T>
+	void put(char* at, T value) {
+		std::memcpy(at, &value, sizeof(value));
+	}
+
+	std::uint32_t record_crc(const char* record, std::size_t frame_length) {
+		boost::crc_32_type crc;
+		crc.process_bytes(record + sequence_at, message_log::record_header_length - sequence_at + frame_length);
+		return crc.checksum();
+	}
+
+	bool write_all(int fd, const char* data, std::size_t length) {
+		while (length > 0) {
+			ssize_t written = ::write(fd, data, length);
+			if (written < 0 && errno == EINTR) continue;
+			if (written <= 0) return false;
+			data += written;
+			length -= written;
+		}
+		return true;
+	}
+
+	std::int64_t now_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+		  std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	class mapped_file {
+		// a read only mapping of the first length bytes of a file, empty if it couldn't be mapped
+	public:
+		mapped_file(const std::string& path, std::size_t length)
+		  : data_(nullptr), length_(0) {
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0) return; // deleted by retention in the meantime
+			struct stat st;
+			if (::fstat(fd, &st) == 0) {
+				length = std::min<std::size_t>(length, st.st_size);
+				void* data = length > 0 ? ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+				if (data != MAP_FAILED) {
+					data_ = static_cast<const char*>(data);
+					length_ = length;
+				}
+			}
+			::close(fd); // the mapping stays valid without it
+		}
+		~mapped_file() {
+			if (data_) ::munmap(const_cast<char*>(data_), length_);
+		}
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		const char* data() const { return data_; }
+		std::size_t length() const { return length_; }
+
+	private:
+		const char* data_;
+		std::size_t length_;
+	};
+}
+
+message_log::message_log(const log_options& options)
+  : options_(options), next_sequence_(1), durable_(1), stopping_(false), dropping_(false), fd_(-1) {
+	if (::mkdir(options_.directory.c_str(), 0755) < 0 && errno != EEXIST) {
+		throw std::runtime_error("message_log: couldn't create " + options_.directory + ": " + std::strerror(errno));
+	}
+	recover();
+	writer_ = std::thread(&message_log::run, this);
+}
+
+message_log::~message_log() {
+	{
+		std::scoped_lock lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_one();
+	writer_.join();
+	if (fd_ >= 0) {
+		::close(fd_);
+	}
+}
+
+void message_log::recover() {
+	DIR* dir = ::opendir(options_.directory.c_str());
+	if (!dir) {
+		throw std::runtime_error("message_log: couldn't open " + options_.directory + ": " + std::strerror(errno));
+	}
+	std::vector<segment> found;
+	while (dirent* entry = ::readdir(dir)) {
+		std::string name(entry->d_name);
+		if (name.size() != 24 || name.compare(20, 4, ".log") || name.find_first_not_of("0123456789") != 20) {
+			continue;
+		}
+		found.push_back(segment{ std::strtoull(name.c_str(), nullptr, 10), options_.directory + "/" + name, 0, 0, {} });
+	}
+	::closedir(dir);
+	std::sort(found.begin(), found.end(), [](const segment& a, const segment& b) { return a.first < b.first; });
+
+	for (std::size_t i = 0; i < found.size(); i++) {
+		// a record that doesn't add up can only be the last thing written before a crash,
+		// so only the newest segment gets cut short, anything after it in an older one is just never read
+		std::uint64_t next = scan(found[i], i + 1 == found.size());
+		if (found[i].bytes == 0) {
+			::unlink(found[i].path.c_str());
+			continue;
+		}
+		segments_.push_back(found[i]);
+		next_sequence_ = std::max(next_sequence_, next);
+	}
+	durable_ = next_sequence_;
+}
+
+std::uint64_t message_log::scan(segment& seg, bool truncate) {
+	// Sets seg.bytes to the length of its valid records and returns the sequence after the last one.
+	mapped_file file(seg.path, SIZE_MAX);
+	std::size_t pos = 0;
+	std::uint64_t sequence = seg.first;
+	while (file.length() - pos >= record_header_length) {
+		const char* record = file.data() + pos;
+		std::uint32_t length = get<std::uint32_t>(record + length_at);
+		if (length < net_message::header_length || length > max_frame_length || file.length() - pos - record_header_length < length
+		    || get<std::uint64_t>(record + sequence_at) != sequence || get<std::uint32_t>(record + crc_at) != record_crc(record, length)) {
+			break;
+		}
+		if ((sequence - seg.first) % index_interval == 0) {
+			seg.offsets.push_back(pos);
+		}
+		seg.newest_ms = get<std::int64_t>(record + time_at);
+		pos += record_header_length + length;
+		sequence++;
+	}
+	seg.bytes = pos;
+	if (pos < file.length()) {
+		std::cerr << "message_log: " << seg.path << " has " << file.length() - pos << " bytes that aren't whole records";
+		if (truncate && ::truncate(seg.path.c_str(), pos) == 0) {
+			std::cerr << ", they have been cut off";
+		}
+		std::cerr << std::endl;
+	}
+	return sequence;
+}
+
+std::uint64_t message_log::append(const net_message& msg) {
+	std::int64_t time = now_ms();
+	std::size_t length = msg.get_frame_length();
+	if (msg.get_type() != net_message::data_frame) {
+		return 0; // a batch is made of frames that were logged on their own
+	}
+	bool wake;
+	std::uint64_t sequence;
+	{
+		std::scoped_lock lock(mutex_);
+		if (stopping_) {
+			return 0;
+		}
+		if (pending_.size() + record_header_length + length > options_.max_pending) {
+			if (!dropping_) {
+				std::cerr << "message_log: the disk is too far behind, messages are being dropped from the log" << std::endl;
+				dropping_ = true;
+			}
+			return 0;
+		}
+		dropping_ = false;
+		sequence = next_sequence_++;
+		// the crc is filled in by the writer, so that it isn't worked out on the caller's thread
+		char header[record_header_length];
+		put<std::uint32_t>(header + length_at, length);
+		put<std::uint32_t>(header + crc_at, 0);
+		put<std::uint64_t>(header + sequence_at, sequence);
+		put<std::int64_t>(header + time_at, time);
+		wake = pending_.empty();
+		pending_.append(header, record_header_length);
+		pending_.append(msg.get_frame_data(), length);
+	}
+	if (wake) {
+		wake_.notify_one();
+	}
+	return sequence;
+}
+
+void message_log::flush() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	std::uint64_t target = next_sequence_;
+	written_.wait(lock, [this, target]() { return durable_ >= target; });
+}
+
+void message_log::run() {
+	// The writer thread. Takes everything that has been appended since it last looked,
+	// so while it's busy writing and syncing one group, the next one builds up behind it.
+	// The two buffers are swapped back and forth, so neither of them is allocated again once they've grown.
+	apply_retention();
+	std::string group;
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;) {
+		wake_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+		if (pending_.empty()) {
+			break; // stopping, and everything has been written
+		}
+		group.swap(pending_);
+		std::uint64_t written = next_sequence_;
+		lock.unlock();
+		write_group(group);
+		group.clear();
+		apply_retention();
+		lock.lock();
+		durable_ = written;
+		written_.notify_all();
+	}
+}
+
+void message_log::write_group(std::string& group) {
+	// Precondition: running on the writer thread
+	// Writes the group in as few writes as it can, starting a new segment wherever the current one fills up.
+	std::size_t pos = 0;
+	std::size_t chunk = 0; // the start of what hasn't been written yet
+	std::int64_t newest_ms = 0;
+	std::uint64_t bytes = 0; // the current segment's size, counting what's been gone through but not written yet
+	std::uint64_t first = 0; // the current segment's first sequence
+	std::vector<std::uint64_t> offsets; // index entries for what hasn't been written yet
+	{
+		std::scoped_lock lock(segments_mutex_);
+		if (fd_ >= 0) {
+			bytes = segments_.back().bytes;
+			first = segments_.back().first;
+		}
+	}
+	auto write_chunk = [&](std::size_t end) {
+		if (fd_ < 0) {
+			// start_segment has already said why
+		} else if (!write_all(fd_, group.data() + chunk, end - chunk)) {
+			std::cerr << "message_log: couldn't write to the log: " << std::strerror(errno) << std::endl;
+		} else {
+			std::scoped_lock lock(segments_mutex_);
+			segments_.back().bytes += end - chunk;
+			segments_.back().newest_ms = newest_ms;
+			segments_.back().offsets.insert(segments_.back().offsets.end(), offsets.begin(), offsets.end());
+		}
+		offsets.clear();
+		chunk = end;
+	};
+	while (pos < group.size()) {
+		char* record = &group[pos];
+		std::uint32_t length = get<std::uint32_t>(record + length_at);
+		if (fd_ < 0 || bytes >= options_.segment_bytes) {
+			if (pos > chunk) {
+				write_chunk(pos);
+			}
+			first = get<std::uint64_t>(record + sequence_at);
+			start_segment(first);
+			bytes = 0;
+		}
+		if ((get<std::uint64_t>(record + sequence_at) - first) % index_interval == 0) {
+			offsets.push_back(bytes);
+		}
+		put<std::uint32_t>(record + crc_at, record_crc(record, length));
+		newest_ms = get<std::int64_t>(record + time_at);
+		pos += record_header_length + length;
+		bytes += record_header_length + length;
+	}
+	write_chunk(pos);
+	if (options_.sync && fd_ >= 0 && ::fdatasync(fd_) < 0) {
+		std::cerr << "message_log: couldn't sync the log: " << std::strerror(errno) << std::endl;
+	}
+}
+
+void message_log::start_segment(std::uint64_t first) {
+	// Precondition: running on the writer thread
+	if (fd_ >= 0) {
+		if (options_.sync) ::fdatasync(fd_);
+		::close(fd_);
+	}
+	char name[32];
+	std::snprintf(name, sizeof(name), "/%020llu.log", static_cast<unsigned long long>(first));
+	std::string path = options_.directory + name;
+	fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd_ < 0) {
+		std::cerr << "message_log: couldn't create " << path << ": " << std::strerror(errno) << std::endl;
+		return;
+	}
+	std::scoped_lock lock(segments_mutex_);
+	segments_.push_back(segment{ first, path, 0, now_ms(), {} });
+}
+
+void message_log::apply_retention() {
+	// Precondition: running on the writer thread
+	// The segment being written to is never deleted, however old or big it is.
+	std::int64_t oldest_kept = options_.max_age.count() > 0
+	  ? now_ms() - std::chrono::duration_cast<std::chrono::milliseconds>(options_.max_age).count() : INT64_MIN;
+	std::scoped_lock lock(segments_mutex_);
+	std::uint64_t total = 0;
+	for (auto& seg : segments_) {
+		total += seg.bytes;
+	}
+	std::size_t expired = 0;
+	while (segments_.size() - expired > 1) {
+		segment& seg = segments_[expired];
+		if (!(options_.max_bytes > 0 && total > options_.max_bytes) && seg.newest_ms >= oldest_kept) {
+			break;
+		}
+		// a reader that has it mapped keeps its pages until it's done
+		::unlink(seg.path.c_str());
+		total -= seg.bytes;
+		expired++;
+	}
+	segments_.erase(segments_.begin(), segments_.begin() + expired);
+}
+
+std::size_t message_log::read(std::uint64_t from, std::size_t max, const std::function<void (const log_record&)>& visit) {
+	// only the segments from the one holding from onwards, and where in the first of them to start
+	std::vector<read_range> ranges;
+	{
+		std::scoped_lock lock(segments_mutex_);
+		for (std::size_t i = 0; i < segments_.size(); i++) {
+			const segment& seg = segments_[i];
+			if (i + 1 < segments_.size() && segments_[i + 1].first <= from) {
+				continue; // everything in this one comes before from
+			}
+			std::uint64_t offset = 0;
+			if (ranges.empty() && from > seg.first && !seg.offsets.empty()) {
+				offset = seg.offsets[std::min<std::uint64_t>((from - seg.first) / index_interval, seg.offsets.size() - 1)];
+			}
+			ranges.push_back(read_range{ seg.path, seg.bytes, offset });
+		}
+	}
+	std::size_t visited = 0;
+	for (std::size_t i = 0; i < ranges.size() && visited < max; i++) {
+		mapped_file file(ranges[i].path, ranges[i].bytes);
+		std::size_t pos = std::min<std::size_t>(ranges[i].offset, file.length());
+		while (file.length() - pos >= record_header_length && visited < max) {
+			const char* record = file.data() + pos;
+			log_record entry;
+			entry.frame_length = get<std::uint32_t>(record + length_at);
+			if (file.length() - pos - record_header_length < entry.frame_length) {
+				break;
+			}
+			entry.sequence = get<std::uint64_t>(record + sequence_at);
+			entry.time_ms = get<std::int64_t>(record + time_at);
+			entry.frame = record + record_header_length;
+			pos += record_header_length + entry.frame_length;
+			if (entry.sequence >= from) {
+				visit(entry);
+				visited++;
+			}
+		}
+	}
+	return visited;
+}
+
+std::size_t message_log::read_last(std::size_t count, const std::function<void (const log_record&)>& visit) {
+	std::uint64_t end;
+	{
+		std::scoped_lock lock(mutex_);
+		end = durable_;
+	}
+	return read(end > count ? end - count : 0, count, visit);
+}
+
+std::uint64_t message_log::next_sequence() {
+	std::scoped_lock lock(mutex_);
+	return next_sequence_;
+}
@@ -1,11 +1,35 @@
 #include "net_message.hpp"
 
+#include <utility>
+
+namespace {
+	// headers for the control frames, they can't be parsed as a number
+	const char ping_header[net_message::header_length + 1] = "PING";
+	const char pong_header[net_message::header_length + 1] = "PONG";
+	const char hello_header[net_message::header_length + 1] = "HELO";
+	const char welcome_header[net_message::header_length + 1] = "WELC";
+	const char ack_header[net_message::header_length + 1] = "ACKN";
+	
+	struct control_frame {
+		const char* header;
+		net_message::frame_type type;
+		std::size_t body_length;
+	};
+	const control_frame control_frames[] = {
+		{ ping_header, net_message::ping_frame, 0 },
+		{ pong_header, net_message::pong_frame, 0 },
+		{ hello_header, net_message::hello_frame, net_message::session_body_length },
+		{ welcome_header, net_message::welcome_frame, net_message::session_body_length },
+		{ ack_header, net_message::ack_frame, net_message::session_body_length }
+	};
+}
+
 net_message::net_message()
-  : body_length_(0)
+  : body_length_(0), type_(data_frame), batch_count_(0)
 {}
 
 net_message::net_message(const char* body, std::size_t length) 
-  : body_length_(length)
+  : body_length_(length > max_body_length ? max_body_length : length), type_(data_frame), batch_count_(0)
 {
 	if (length > max_body_length) {
 		std::cerr << "message length exceeds max_body_length and will be trimmed accordingly" << std::endl;
@@ -20,18 +44,52 @@ net_message::net_message(const char* body, std::size_t length)
 	std::memcpy(data_ + header_length, body, body_length_);
 }
 
+net_message::net_message(frame_type type)
+  : body_length_(0), type_(type), batch_count_(0)
+{
+	std::memcpy(data_, type == ping_frame ? ping_header : pong_header, header_length);
+}
+
+net_message::net_message(frame_type type, const char* token, std::uint64_t count)
+  : body_length_(session_body_length), type_(type), batch_count_(0)
+{
+	for (auto& frame : control_frames) {
+		if (frame.type == type) {
+			std::memcpy(data_, frame.header, header_length);
+		}
+	}
+	if (token) {
+		std::memcpy(data_ + header_length, token, token_length);
+	} else {
+		std::memset(data_ + header_length, 0, token_length);
+	}
+	for (int i = 0; i < 8; i++) {
+		data_[header_length + token_length + i] = static_cast<char>(count >> (8 * (7 - i)));
+	}
+}
+
+net_message::net_message(std::shared_ptr<const std::string> frames, std::size_t count)
+  : body_length_(0), type_(batch_frame), batch_(std::move(frames)), batch_count_(count)
+{}
+
 net_message::net_message(const net_message& other) {
 	// For copying, we want to make a distinct copy of the data.
 	// This is necessary because the async_write calls return immediately
 	// but they need the net_message variables to stay valid until the 
 	// async_write is actually completed.
 	body_length_ = other.body_length_;
+	type_ = other.type_;
+	batch_ = other.batch_;
+	batch_count_ = other.batch_count_;
 	std::memcpy(data_, other.data_, other.body_length_ + header_length);
 }
 
 net_message& net_message::operator=(const net_message& other) {
 	body_length_ = other.body_length_;
-	std::memcpy(data_, other.data_, other.body_length_);
+	type_ = other.type_;
+	batch_ = other.batch_;
+	batch_count_ = other.batch_count_;
+	std::memcpy(data_, other.data_, other.body_length_ + header_length);
 	return *this;
 }
 
@@ -55,11 +113,129 @@ std::size_t net_message::get_body_length() const {
 	return body_length_;
 }
 
-void net_message::decode_header() {
+net_message::frame_type net_message::get_type() const {
+	return type_;
+}
+
+bool net_message::decode_header() {
+	// returns false if the header is malformed, in which case the connection can't be trusted anymore
+	for (auto& frame : control_frames) {
+		if (!std::memcmp(data_, frame.header, header_length)) {
+			type_ = frame.type;
+			body_length_ = frame.body_length;
+			return true;
+		}
+	}
+	type_ = data_frame;
 	char header[header_length + 1];
 	memcpy(header, data_, header_length);
+	header[header_length] = '\0';
 	body_length_ = std::atoi(header);
 	if (body_length_ > max_body_length) {
 		std::cerr << "In decode_header(), body_length_ > max_body_length" << std::endl;
+		body_length_ = 0;
+		return false;
+	}
+	return true;
+}
+
+const char* net_message::get_token() const {
+	return data_ + header_length;
+}
+
+std::uint64_t net_message::get_count() const {
+	std::uint64_t count = 0;
+	for (int i = 0; i < 8; i++) {
+		count = (count << 8) | static_cast<unsigned char>(data_[header_length + token_length + i]);
+	}
+	return count;
+}
+
+const char* net_message::get_frame_data() const {
+	if (type_ == batch_frame) {
+		return batch_ ? batch_->data() : nullptr;
+	}
+	return data_;
+}
+
+std::size_t net_message::get_frame_length() const {
+	if (type_ == batch_frame) {
+		return batch_ ? batch_->size() : 0; // a batch without a buffer is empty
 	}
-}
\ No newline at end of file
+	return header_length + body_length_;
+}
+
+std::size_t net_message::get_frame_count() const {
+	return type_ == batch_frame ? batch_count_ : 1;
+}
+
+message_queue::message_queue(std::size_t capacity)
+  : ring_(capacity == 0 ? 1 : capacity), head_(0), size_(0)
+{}
+
+bool message_queue::empty() const {
+	return size_ == 0;
+}
+
+std::size_t message_queue::size() const {
+	return size_;
+}
+
+std::size_t message_queue::capacity() const {
+	return ring_.size();
+}
+
+net_message& message_queue::front() {
+	return ring_[head_];
+}
+
+net_message& message_queue::operator[](std::size_t i) {
+	return ring_[(head_ + i) % ring_.size()];
+}
+
+void message_queue::push_back(const net_message& msg) {
+	if (size_ == ring_.size()) {
+		grow();
+	}
+	ring_[(head_ + size_) % ring_.size()] = msg;
+	size_++;
+}
+
+void message_queue::pop_front() {
+	if (ring_[head_].get_type() == net_message::batch_frame) {
+		ring_[head_] = net_message(); // lets go of the batch's buffer instead of keeping it until the slot is reused
+	}
+	head_ = (head_ + 1) % ring_.size();
+	size_--;
+}
+
+void message_queue::clear() {
+	while (size_ > 0) {
+		pop_front();
+	}
+	head_ = 0;
+	size_ = 0;
+}
+
+void message_queue::swap(message_queue& other) {
+	ring_.swap(other.ring_);
+	std::swap(head_, other.head_);
+	std::swap(size_, other.size_);
+}
+
+void message_queue::shrink(std::size_t keep) {
+	if (size_ == 0 && ring_.size() > keep) {
+		std::vector<net_message>(keep == 0 ? 1 : keep).swap(ring_);
+		head_ = 0;
+	}
+}
+
+void message_queue::grow() {
+	// doubles the ring and lines the messages back up from the start
+	std::vector<net_message> bigger(ring_.size() * 2);
+	for (std::size_t i = 0; i < size_; i++) {
+		bigger[i] = (*this)[i];
+	}
+	ring_.swap(bigger);
+	head_ = 0;
+}
@@ -0,0 +1,89 @@
+#include "net_rate_limiter.hpp"
+
+#include <algorithm>
+
+namespace {
+	const std::int64_t ns_per_second = 1000000000;
+}
+
+token_bucket::token_bucket()
+  : tokens_(0), capacity_(0), rate_(0), last_ns_(0)
+{}
+
+void token_bucket::configure(std::uint32_t rate, std::uint32_t burst, std::int64_t now_ns) {
+	// the bucket starts out full so that a new client can send its burst straight away
+	rate_ = rate;
+	capacity_ = static_cast<std::int64_t>(std::max<std::uint32_t>(burst, 1)) * ns_per_second;
+	tokens_ = capacity_;
+	last_ns_ = now_ns;
+}
+
+void token_bucket::refill(std::int64_t now_ns) {
+	// Elapsed time is capped at however long it takes to fill an empty bucket,
+	// which keeps elapsed * rate from overflowing after a long quiet period.
+	std::int64_t elapsed = now_ns - last_ns_;
+	last_ns_ = now_ns;
+	if (elapsed <= 0 || rate_ == 0) {
+		return;
+	}
+	std::int64_t fill_time = (capacity_ - std::min<std::int64_t>(tokens_, 0)) / rate_ + 1;
+	elapsed = std::min(elapsed, fill_time);
+	tokens_ = std::min(capacity_, tokens_ + elapsed * rate_);
+}
+
+std::int64_t token_bucket::wait_time(std::uint32_t cost, std::int64_t now_ns) {
+	refill(now_ns);
+	std::int64_t needed = static_cast<std::int64_t>(cost) * ns_per_second;
+	if (tokens_ >= needed) {
+		return 0;
+	}
+	if (rate_ == 0) {
+		return ns_per_second;
+	}
+	return (needed - tokens_ + rate_ - 1) / rate_;
+}
+
+std::int64_t token_bucket::force(std::uint32_t cost, std::int64_t now_ns) {
+	refill(now_ns);
+	tokens_ -= static_cast<std::int64_t>(cost) * ns_per_second;
+	if (tokens_ >= 0) {
+		return 0;
+	}
+	if (rate_ == 0) {
+		return ns_per_second;
+	}
+	return (-tokens_ + rate_ - 1) / rate_;
+}
+
+rate_limiter::rate_limiter()
+  : policy_(rate_limit_options::delay), enabled_(false)
+{}
+
+void rate_limiter::configure(const rate_limit_options& options, std::int64_t now_ns) {
+	enabled_ = options.enabled;
+	policy_ = options.policy;
+	messages_.configure(options.messages_per_second, options.message_burst, now_ns);
+	bytes_.configure(options.bytes_per_second, options.byte_burst, now_ns);
+}
+
+bool rate_limiter::enabled() const {
+	return enabled_;
+}
+
+rate_limit_options::policy_type rate_limiter::policy() const {
+	return policy_;
+}
+
+std::int64_t rate_limiter::charge(std::uint32_t bytes, std::int64_t now_ns) {
+	if (policy_ == rate_limit_options::delay) {
+		return std::max(messages_.force(1, now_ns), bytes_.force(bytes, now_ns));
+	}
+	// only charge the message if both buckets have room for it
+	std::int64_t wait = std::max(messages_.wait_time(1, now_ns), bytes_.wait_time(bytes, now_ns));
+	if (wait > 0) {
+		return wait;
+	}
+	messages_.force(1, now_ns);
+	bytes_.force(bytes, now_ns);
+	return 0;
+}
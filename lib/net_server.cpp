@@ -1,17 +1,161 @@
 #include "net_server.hpp"
 
-tcp_connection::tcp_connection(tcp::socket socket, int id, 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <random>
+
+namespace {
+	std::int64_t now_ns(std::chrono::steady_clock::time_point now) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+	}
+	
+	template <typename Queue>
+	void append_frames(std::string& out, Queue& frames) {
+		for (std::size_t i = 0; i < frames.size(); i++) {
+			out.append(frames[i].get_frame_data(), frames[i].get_frame_length());
+		}
+	}
+	
+	template <typename Queue>
+	void parse_frames(const std::string& in, Queue& frames) {
+		// the reverse of append_frames, stops at anything that isn't a whole frame
+		std::size_t pos = 0;
+		while (in.size() - pos >= net_message::header_length) {
+			net_message msg;
+			std::memcpy(msg.get_data(), in.data() + pos, net_message::header_length);
+			if (!msg.decode_header() || in.size() - pos - net_message::header_length < msg.get_body_length()) {
+				break;
+			}
+			std::memcpy(msg.get_body(), in.data() + pos + net_message::header_length, msg.get_body_length());
+			pos += net_message::header_length + msg.get_body_length();
+			frames.push_back(msg);
+		}
+	}
+	
+	std::string make_token() {
+		// random_device is expensive, but a token is only made once per client
+		static std::mutex mutex;
+		static std::random_device device;
+		std::scoped_lock lock(mutex);
+		std::string token(net_message::token_length, '\0');
+		for (std::size_t i = 0; i < token.size(); i += 4) {
+			unsigned int bits = device();
+			std::memcpy(&token[i], &bits, 4);
+		}
+		return token;
+	}
+}
+
+tcp_connection::tcp_connection(boost::asio::io_context& io_context, net_timer_wheel& timers, std::shared_ptr<outbound_state> outbound,
 					std::function<void (std::size_t, char*, std::size_t)> read_handler,
-					std::function<void (std::shared_ptr<tcp_connection>)> disconnect)
-  : socket_(std::move(socket)), id_(id), read_handler_(read_handler), disconnect_(disconnect), valid_(true) {
+					std::function<void (std::shared_ptr<tcp_connection>)> disconnect,
+					std::function<void (std::shared_ptr<tcp_connection>, const net_message*)> session_handler)
+  : socket_(io_context), strand_(boost::asio::make_strand(io_context)), id_(-1), read_handler_(read_handler),
+    disconnect_(disconnect), valid_(false), reading_body_(false), ping_outstanding_(false),
+    liveness_timer_(0), timers_(timers), pause_reasons_(0), read_stalled_(false),
+    draining_(false), write_shut_(false), handing_off_(false), handoff_writes_done_(false),
+    handoff_reads_done_(false), handoff_cancelled_(false), handoff_inbound_(0),
+    established_(true), parked_(false), received_(0), acked_(0),
+    replay_frames_(0), session_handler_(session_handler), outbound_(outbound), write_messages_(initial_queue) {
+}
+
+tcp_connection::~tcp_connection() {
+	recycle();
+}
+
+void tcp_connection::reset(tcp::socket socket, int id, net_strand strand,
+                           const rate_limit_options& limits, const session_options& sessions) {
+	// everything that belongs to one client goes back to how a new connection starts out,
+	// the buffers and the write queue's storage are kept
+	socket_ = std::move(socket);
+	{
+		std::scoped_lock lock(strand_mutex_);
+		strand_ = strand;
+	}
+	id_ = id;
+	valid_ = true;
+	last_receive_ = std::chrono::steady_clock::now();
+	reading_body_ = false;
+	ping_outstanding_ = false;
+	liveness_timer_ = 0;
+	limiter_.configure(limits, now_ns(last_receive_));
+	pause_reasons_ = 0;
+	read_stalled_ = false;
+	draining_ = false;
+	write_shut_ = false;
+	handing_off_ = false;
+	handoff_writes_done_ = false;
+	handoff_reads_done_ = false;
+	handoff_cancelled_ = false;
+	handoff_inbound_ = 0;
+	established_ = !sessions.enabled;
+	parked_ = false;
+	token_.clear();
+	received_ = 0;
+	acked_ = 0;
+	replay_frames_ = sessions.replay_frames;
+}
+
+void tcp_connection::recycle() {
+	// whatever never made it out still counts towards the server's outbound total
+	std::int64_t unsent = 0;
+	for (std::size_t i = 0; i < write_messages_.size(); i++) {
+		unsent += write_messages_[i].get_frame_length();
+	}
+	if (unsent > 0) {
+		std::int64_t queued = outbound_->queued_bytes.fetch_sub(unsent) - unsent;
+		if (outbound_->saturated && queued <= outbound_->low_watermark && outbound_->saturated.exchange(false)
+		    && outbound_->on_change) {
+			outbound_->on_change(false);
+		}
+	}
+	write_messages_.clear();
+	// a client that had a big backlog doesn't get to keep that much memory tied up in the pool
+	write_messages_.shrink(initial_queue);
+	unacked_.clear();
+	handoff_done_ = nullptr;
+	boost::system::error_code ec;
+	socket_.close(ec);
 }
 
 void tcp_connection::start() {
-	char first_message[] = "server: connected";
-	net_message msg(first_message, strlen(first_message));
-	send(msg);
+	// with sessions on, the greeting waits until we know whether this is a new client (see net_server::establish)
+	if (established_) {
+		char first_message[] = "server: connected";
+		net_message msg(first_message, strlen(first_message));
+		send(msg);
+	}
 	  
-	read_header();
+	boost::asio::dispatch(get_strand(), boost::bind(&tcp_connection::read_header, shared_from_this()));
+}
+
+void tcp_connection::send_greeting() {
+	char first_message[] = "server: connected";
+	do_send(net_message(first_message, strlen(first_message)));
+}
+
+void tcp_connection::handle_ack(std::uint64_t count) {
+	// a batch is only let go of once the client has every frame in it
+	while (!unacked_.empty() && acked_ + unacked_.front().get_frame_count() <= count) {
+		acked_ += unacked_.front().get_frame_count();
+		unacked_.pop_front();
+	}
+}
+
+void tcp_connection::hold_message(net_message msg) {
+	// Precondition: running on the connection's strand and the connection is parked.
+	// Held messages count towards the outbound total like any other queued message.
+	if (msg.get_type() != net_message::data_frame && msg.get_type() != net_message::batch_frame) {
+		return;
+	}
+	if (write_messages_.size() >= replay_frames_) {
+		std::cerr << "client " << id_ << " has been away too long to hold any more messages for it" << std::endl;
+		return;
+	}
+	write_messages_.push_back(msg);
+	outbound_->queued_bytes += msg.get_frame_length();
 }
 
 int tcp_connection::get_id() {
@@ -22,33 +166,324 @@ bool tcp_connection::valid() {
 	return valid_;
 }
 
+net_strand tcp_connection::get_strand() {
+	std::scoped_lock lock(strand_mutex_);
+	return strand_;
+}
+
+void tcp_connection::set_strand(net_strand strand) {
+	// The switch itself runs on the old strand so that it can't overlap with a handler
+	// that is still running there. Any completion that was already bound to the old strand
+	// notices that it is no longer on the current strand and hops over (see handle_read_header).
+	auto self(shared_from_this());
+	boost::asio::dispatch(get_strand(), [this, self, strand]() {
+		std::scoped_lock lock(strand_mutex_);
+		strand_ = strand;
+	});
+}
+
+std::chrono::steady_clock::time_point tcp_connection::check_liveness(const heartbeat_options& options) {
+	// Precondition: running on the connection's strand
+	auto now = std::chrono::steady_clock::now();
+	if (!valid_) {
+		return std::chrono::steady_clock::time_point();
+	}
+	if (read_stalled_ || handing_off_) {
+		// we are the ones not reading, so silence from the client doesn't mean anything right now
+		last_receive_ = now;
+		ping_outstanding_ = false;
+		return now + options.ping_interval;
+	}
+	if (reading_body_ && now - body_started_ >= options.read_timeout) {
+		std::cerr << "client " << id_ << " took too long to send a message body, closing the connection" << std::endl;
+		close();
+		return std::chrono::steady_clock::time_point();
+	}
+	if (now - last_receive_ >= options.idle_timeout) {
+		std::cerr << "client " << id_ << " stopped responding, closing the connection" << std::endl;
+		close();
+		return std::chrono::steady_clock::time_point();
+	}
+	if (now - last_receive_ >= options.ping_interval && !ping_outstanding_) {
+		ping_outstanding_ = true;
+		do_send(net_message(net_message::ping_frame));
+	}
+	auto next = last_receive_ + (ping_outstanding_ ? options.idle_timeout : options.ping_interval);
+	if (reading_body_) {
+		next = std::min(next, body_started_ + options.read_timeout);
+	}
+	return next;
+}
+
+void tcp_connection::close() {
+	// Closing the socket makes the outstanding read complete with operation_aborted,
+	// which goes through the normal disconnect path in handle_read_header / handle_read_body.
+	boost::system::error_code ec;
+	socket_.shutdown(tcp::socket::shutdown_both, ec);
+	socket_.close(ec);
+	if (read_stalled_.exchange(false)) {
+		// there is no read to fail, so start one to go through the disconnect path
+		read_header();
+	}
+}
+
+void tcp_connection::drain() {
+	boost::asio::dispatch(get_strand(), boost::bind(&tcp_connection::begin_drain, shared_from_this()));
+}
+
+void tcp_connection::begin_drain() {
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, boost::bind(&tcp_connection::begin_drain, shared_from_this()));
+		return;
+	}
+	draining_ = true;
+	// pauses don't matter anymore, the connection has to keep reading to see the client close its side
+	if (read_stalled_.exchange(false)) {
+		read_header();
+	}
+	if (write_messages_.empty()) {
+		finish_writes();
+	}
+}
+
+void tcp_connection::finish_writes() {
+	// Precondition: running on the connection's strand with nothing left in the write queue
+	if (write_shut_) return;
+	write_shut_ = true;
+	boost::system::error_code ec;
+	socket_.shutdown(tcp::socket::shutdown_send, ec);
+}
+
+void tcp_connection::hand_off(std::function<void (std::shared_ptr<tcp_connection>, handoff_connection)> done) {
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, boost::bind(&tcp_connection::hand_off, shared_from_this(), done));
+		return;
+	}
+	if (!valid_ || handing_off_) {
+		return;
+	}
+	handing_off_ = true;
+	handoff_done_ = done;
+	// Outside of a handoff the queue is only ever non-empty while a write is in flight.
+	// That write is allowed to finish so that no frame is split between the two processes.
+	handoff_writes_done_ = write_messages_.empty();
+	if (read_stalled_.exchange(false)) {
+		handoff_reads_done_ = true;
+	}
+	check_handoff();
+}
+
+void tcp_connection::check_handoff() {
+	// Precondition: running on the connection's strand
+	// Once the write in flight is done, the read is cancelled. Either it completes with part of a
+	// message (which goes along as inbound) or it had already finished and the handlers stop
+	// before starting the next one (see stop_reading_for_handoff).
+	if (!handoff_writes_done_) {
+		return;
+	}
+	boost::system::error_code ec;
+	if (!handoff_reads_done_) {
+		if (!handoff_cancelled_) {
+			handoff_cancelled_ = true;
+			socket_.cancel(ec);
+		}
+		return;
+	}
+	if (!valid_.exchange(false)) {
+		return; // the client went away in the meantime, which goes through disconnect_ instead
+	}
+	handoff_connection handed_off;
+	handed_off.id = id_;
+	handed_off.inbound.assign(read_message_.get_data(), handoff_inbound_);
+	append_frames(handed_off.outbound, write_messages_);
+	handed_off.established = established_;
+	handed_off.session = token_;
+	handed_off.received = received_;
+	handed_off.acked = acked_;
+	append_frames(handed_off.replay, unacked_);
+	handed_off.fd = socket_.release(ec);
+	if (ec) {
+		std::cerr << "couldn't hand off client " << id_ << ": " << ec.message() << std::endl;
+		disconnect_(shared_from_this());
+		return;
+	}
+	auto done = std::move(handoff_done_);
+	done(shared_from_this(), std::move(handed_off));
+}
+
+bool tcp_connection::stop_reading_for_handoff(std::size_t buffered) {
+	// Called wherever the read loop would carry on. Returns true if it has to stop instead,
+	// buffered is how many bytes of read_message_ belong to a message that hasn't been handled yet.
+	if (!handing_off_) {
+		return false;
+	}
+	handoff_reads_done_ = true;
+	handoff_inbound_ = buffered;
+	check_handoff();
+	return true;
+}
+
+void tcp_connection::resume(const std::string& inbound, const std::string& outbound) {
+	auto self(shared_from_this());
+	boost::asio::dispatch(get_strand(), [this, self, inbound, outbound]() {
+		// frames the old process never got to write go out first
+		std::deque<net_message> frames;
+		parse_frames(outbound, frames);
+		for (auto& msg : frames) {
+			do_send(msg);
+		}
+		
+		// then reading carries on from wherever the old process stopped
+		std::size_t buffered = std::min<std::size_t>(inbound.size(), net_message::header_length + net_message::max_body_length);
+		std::memcpy(read_message_.get_data(), inbound.data(), buffered);
+		if (buffered < net_message::header_length) {
+			boost::asio::async_read(socket_, boost::asio::buffer(read_message_.get_data() + buffered, net_message::header_length - buffered),
+			  boost::asio::bind_executor(get_strand(),
+			    boost::bind(&tcp_connection::handle_read_header, self, boost::asio::placeholders::error,
+			    boost::asio::placeholders::bytes_transferred)));
+		} else if (buffered == net_message::header_length) {
+			handle_read_header(boost::system::error_code(), buffered);
+		} else if (!read_message_.decode_header() || buffered > net_message::header_length + read_message_.get_body_length()) {
+			close();
+			read_header(); // completes right away with an error and disconnects
+		} else {
+			reading_body_ = true;
+			body_started_ = std::chrono::steady_clock::now();
+			std::size_t total = net_message::header_length + read_message_.get_body_length();
+			boost::asio::async_read(socket_, boost::asio::buffer(read_message_.get_data() + buffered, total - buffered),
+			  boost::asio::bind_executor(get_strand(),
+			    boost::bind(&tcp_connection::handle_read_body, self, boost::asio::placeholders::error,
+			    boost::asio::placeholders::bytes_transferred)));
+		}
+	});
+}
+
+void tcp_connection::pause_reading(pause_reason reason) {
+	pause_reasons_.fetch_or(reason);
+}
+
+void tcp_connection::resume_reading(pause_reason reason) {
+	// Only the call that clears the last reason has to wake up the read loop, and only if it
+	// actually stopped. Whoever takes read_stalled_ back from true gets to start the next read.
+	std::uint8_t before = pause_reasons_.fetch_and(static_cast<std::uint8_t>(~reason));
+	if (before == reason && read_stalled_.exchange(false)) {
+		try_resume();
+	}
+}
+
+void tcp_connection::try_resume() {
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, boost::bind(&tcp_connection::try_resume, shared_from_this()));
+		return;
+	}
+	if (stop_reading_for_handoff(0)) {
+		return;
+	}
+	read_header();
+}
+
+void tcp_connection::continue_reading() {
+	// Precondition: running on the connection's strand, with no read outstanding
+	// Starts the next read unless reading is paused, in which case resume_reading starts it later.
+	// The flag is set before the reasons are checked, so a resume_reading on another thread
+	// either sees the flag or has already cleared the reason before the check below.
+	if (stop_reading_for_handoff(0)) {
+		return;
+	}
+	read_stalled_ = true;
+	if ((pause_reasons_ == 0 || draining_) && read_stalled_.exchange(false)) {
+		read_header();
+	}
+}
+
 void tcp_connection::send(net_message msg) {
 	// this function takes a net_message by value to force the copy constructor to be called
 	// the copy constructor does a deep copy of the underlying data
 	// so that the net_message object will survive until the async_write has been completed
+	// the write queue belongs to the connection's strand, so if we are being called from
+	// somewhere else (another connection's read_handler for example) we hop over first
+	boost::asio::dispatch(get_strand(), boost::bind(&tcp_connection::do_send, shared_from_this(), msg));
+}
+
+void tcp_connection::do_send(net_message msg) {
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, boost::bind(&tcp_connection::do_send, shared_from_this(), msg));
+		return;
+	}
+	if (write_shut_ || msg.get_frame_length() == 0) {
+		return; // nothing to write for an empty batch
+	}
+	if (parked_) {
+		hold_message(msg);
+		return;
+	}
 	bool write_in_progress = !write_messages_.empty();
 	write_messages_.push_back(msg);
-	if (!write_in_progress) {
+	std::int64_t bytes = msg.get_frame_length();
+	std::int64_t queued = outbound_->queued_bytes.fetch_add(bytes) + bytes;
+	if (outbound_->high_watermark > 0 && queued > outbound_->high_watermark && !outbound_->saturated.exchange(true)) {
+		outbound_->on_change(true);
+	}
+	if (!write_in_progress && !handing_off_) {
 		do_write();
 	}
 }
 
 void tcp_connection::do_write() {
 	// This function starts an async_write call on the first message in the queue.
-	// Once the write finishes, it will call the function again
+	// Once the write finishes, handle_write will call this function again
 	// until the message queue is empty.
-	boost::asio::async_write(socket_, boost::asio::buffer(write_messages_.front().get_data(), 
-	    write_messages_.front().get_body_length() + net_message::header_length),
-	  [this] (boost::system::error_code ec, std::size_t /*length*/) {
-		  if (!ec) {
-			  write_messages_.pop_front();
-			  if (!write_messages_.empty()) {
-				  do_write();
-			  }
-		  } else {
-			  std::cerr << "error with writing to client " << id_ << " with error code: " << ec << std::endl;
-		  }
-	  });
+	// a batch goes out in this one write as well, straight from its shared buffer
+	boost::asio::async_write(socket_, boost::asio::buffer(write_messages_.front().get_frame_data(), 
+	    write_messages_.front().get_frame_length()),
+	  boost::asio::bind_executor(get_strand(), make_alloc_handler(write_memory_,
+	    boost::bind(&tcp_connection::handle_write, shared_from_this(), boost::asio::placeholders::error,
+	    boost::asio::placeholders::bytes_transferred))));
+}
+
+void tcp_connection::handle_write(const boost::system::error_code e, std::size_t bytes_transferred) {
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, make_alloc_handler(write_memory_,
+		  boost::bind(&tcp_connection::handle_write, shared_from_this(), e, bytes_transferred)));
+		return;
+	}
+	if (!e) {
+		if (write_messages_.empty()) {
+			return; // the queue was taken over by a resumed session while this write was completing
+		}
+		std::int64_t bytes = write_messages_.front().get_frame_length();
+		std::int64_t queued = outbound_->queued_bytes.fetch_sub(bytes) - bytes;
+		if (outbound_->saturated && queued <= outbound_->low_watermark && outbound_->saturated.exchange(false)) {
+			outbound_->on_change(false);
+		}
+		net_message::frame_type type = write_messages_.front().get_type();
+		if (!token_.empty() && (type == net_message::data_frame || type == net_message::batch_frame)) {
+			// kept until the client says it has it, in case it has to be sent again after a reconnect
+			// (a batch is kept as it is, only its buffer is shared, and counts as the frames in it)
+			unacked_.push_back(write_messages_.front());
+			if (unacked_.size() > replay_frames_) {
+				acked_ += unacked_.front().get_frame_count();
+				unacked_.pop_front();
+			}
+		}
+		write_messages_.pop_front();
+		if (handing_off_) {
+			// the rest of the queue goes to the new process
+			handoff_writes_done_ = true;
+			check_handoff();
+		} else if (!write_messages_.empty()) {
+			do_write();
+		} else if (draining_) {
+			finish_writes();
+		}
+	} else {
+		std::cerr << "error with writing to client " << id_ << " with error code: " << e << std::endl;
+	}
 }
 
 void tcp_connection::read_header() {
@@ -59,18 +494,50 @@ void tcp_connection::read_header() {
 	// how many bytes we need to ready for the body.
 	auto self(shared_from_this());
 	boost::asio::async_read(socket_, boost::asio::buffer(read_message_.get_data(), net_message::header_length),
-	  boost::bind(&tcp_connection::handle_read_header, self, boost::asio::placeholders::error,
-	  boost::asio::placeholders::bytes_transferred));
+	  boost::asio::bind_executor(get_strand(), make_alloc_handler(read_memory_,
+	    boost::bind(&tcp_connection::handle_read_header, self, boost::asio::placeholders::error,
+	    boost::asio::placeholders::bytes_transferred))));
 }
 
 void tcp_connection::handle_read_header(const boost::system::error_code e, std::size_t bytes_transferred) {
-	// If a client has disconnected, one of these two errors will be returned
+	// If the connection was moved to a different strand while this read was in flight,
+	// the completion still arrives on the old one, so we forward it to the current strand.
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, make_alloc_handler(read_memory_,
+		  boost::bind(&tcp_connection::handle_read_header, shared_from_this(), e, bytes_transferred)));
+		return;
+	}
+	// If a client has disconnected, eof or connection_reset will be returned,
+	// and if the connection was closed because the client stopped responding
+	// it will be operation_aborted. Any error means the connection is finished.
 	// Otherwise, we decode the header in order to figure out the length of the body
 	// Then we call read_body()
-	if (e == boost::asio::error::eof || e == boost::asio::error::connection_reset) {
-		disconnect_(shared_from_this());
-	} else {
-		read_message_.decode_header();
+	if (e == boost::asio::error::operation_aborted && stop_reading_for_handoff(bytes_transferred)) {
+		return;
+	}
+	if (e) {
+		if (valid_.exchange(false)) {
+			disconnect_(shared_from_this());
+		}
+		return;
+	}
+	// any frame at all (including a pong) shows that the client is still there
+	last_receive_ = std::chrono::steady_clock::now();
+	ping_outstanding_ = false;
+	if (!read_message_.decode_header()) {
+		close();
+		read_header(); // completes right away with an error and disconnects
+		return;
+	}
+	if (read_message_.get_type() == net_message::ping_frame) {
+		do_send(net_message(net_message::pong_frame));
+		continue_reading();
+	} else if (read_message_.get_type() == net_message::pong_frame) {
+		continue_reading();
+	} else if (!stop_reading_for_handoff(net_message::header_length)) {
+		reading_body_ = true;
+		body_started_ = last_receive_;
 		read_body();
 	}
 }
@@ -80,11 +547,83 @@ void tcp_connection::read_body() {
 	// we can now read the body of the message.
 	auto self(shared_from_this());
 	boost::asio::async_read(socket_, boost::asio::buffer(read_message_.get_data() + net_message::header_length, read_message_.get_body_length()),
-	  boost::bind(&tcp_connection::handle_read_body, self, boost::asio::placeholders::error,
-	  boost::asio::placeholders::bytes_transferred));
+	  boost::asio::bind_executor(get_strand(), make_alloc_handler(read_memory_,
+	    boost::bind(&tcp_connection::handle_read_body, self, boost::asio::placeholders::error,
+	    boost::asio::placeholders::bytes_transferred))));
 }
 
 void tcp_connection::handle_read_body(const boost::system::error_code e, std::size_t bytes_transferred) {
+	net_strand strand = get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, make_alloc_handler(read_memory_,
+		  boost::bind(&tcp_connection::handle_read_body, shared_from_this(), e, bytes_transferred)));
+		return;
+	}
+	if (e == boost::asio::error::operation_aborted && stop_reading_for_handoff(net_message::header_length + bytes_transferred)) {
+		return;
+	}
+	if (e) {
+		if (valid_.exchange(false)) {
+			disconnect_(shared_from_this());
+		}
+		return;
+	}
+	reading_body_ = false;
+	if (write_shut_) {
+		// nothing can be sent back anymore, so messages that arrive this late are thrown away
+		continue_reading();
+		return;
+	}
+	
+	// session frames never reach the application (see net_client.hpp)
+	if (read_message_.get_type() == net_message::hello_frame) {
+		if (!established_) {
+			established_ = true;
+			session_handler_(shared_from_this(), &read_message_);
+		} else if (token_.empty()) {
+			// sessions are off, an all zero token tells the client it doesn't have one
+			do_send(net_message(net_message::welcome_frame, nullptr, 0));
+		}
+		continue_reading();
+		return;
+	}
+	if (read_message_.get_type() == net_message::ack_frame) {
+		handle_ack(read_message_.get_count());
+		continue_reading();
+		return;
+	}
+	if (read_message_.get_type() != net_message::data_frame) {
+		continue_reading();
+		return;
+	}
+	if (!established_) {
+		// a client that doesn't know about sessions
+		established_ = true;
+		session_handler_(shared_from_this(), nullptr);
+	}
+	if (!token_.empty() && ++received_ % net_message::ack_every == 0) {
+		do_send(net_message(net_message::ack_frame, nullptr, received_));
+	}
+	
+	// Flood control happens before the application sees the message (see net_rate_limiter.hpp)
+	std::int64_t wait = 0;
+	if (limiter_.enabled()) {
+		std::uint32_t bytes = net_message::header_length + read_message_.get_body_length();
+		wait = limiter_.charge(bytes, now_ns(std::chrono::steady_clock::now()));
+		if (wait > 0 && limiter_.policy() == rate_limit_options::drop) {
+			continue_reading();
+			return;
+		}
+		if (wait > 0 && limiter_.policy() == rate_limit_options::disconnect) {
+			std::cerr << "client " << id_ << " exceeded its rate limit, closing the connection" << std::endl;
+			close();
+			if (valid_.exchange(false)) {
+				disconnect_(shared_from_this());
+			}
+			return;
+		}
+	}
+	
 	// The body has been read into the read_message_ variable (of type net_message)
 	// We will now extract the message into a specific char array so that we can
 	// send it to the application server using the read_handler callback they provided
@@ -95,77 +634,756 @@ void tcp_connection::handle_read_body(const boost::system::error_code e, std::si
 	body[read_message_.get_body_length()] = '\0';
 	// call the read_handler from the net_server object
 	read_handler_(id_, body, read_message_.get_body_length());
-	read_header();
+	if (wait > 0) {
+		// delay policy: stop reading until the client is back under its limit
+		pause_reading(paused_by_rate_limit);
+		// resume_reading can be called from any thread, so this doesn't need the connection's strand
+		timers_.schedule(std::chrono::nanoseconds(wait),
+		  boost::bind(&tcp_connection::resume_reading, shared_from_this(), paused_by_rate_limit));
+	}
+	continue_reading();
+}
+
+connection_pool::connection_pool(std::size_t capacity)
+  : capacity_(capacity), block_size_(0) {
+	idle_.reserve(capacity_);
+	blocks_.reserve(capacity_);
+}
+
+connection_pool::~connection_pool() {
+	for (tcp_connection* connection : idle_) {
+		delete connection;
+	}
+	for (void* block : blocks_) {
+		::operator delete(block);
+	}
+}
+
+tcp_connection* connection_pool::take() {
+	std::scoped_lock lock(mutex_);
+	if (idle_.empty()) {
+		return nullptr;
+	}
+	tcp_connection* connection = idle_.back();
+	idle_.pop_back();
+	return connection;
+}
+
+void connection_pool::give_back(tcp_connection* connection) {
+	{
+		std::scoped_lock lock(mutex_);
+		if (idle_.size() < capacity_) {
+			idle_.push_back(connection);
+			return;
+		}
+	}
+	delete connection;
+}
+
+void* connection_pool::allocate_block(std::size_t size) {
+	{
+		std::scoped_lock lock(mutex_);
+		if (block_size_ == 0) {
+			block_size_ = size;
+		}
+		if (size == block_size_ && !blocks_.empty()) {
+			void* block = blocks_.back();
+			blocks_.pop_back();
+			return block;
+		}
+	}
+	return ::operator new(size);
+}
+
+void connection_pool::free_block(void* block, std::size_t size) {
+	{
+		std::scoped_lock lock(mutex_);
+		if (size == block_size_ && blocks_.size() < capacity_) {
+			blocks_.push_back(block);
+			return;
+		}
+	}
+	::operator delete(block);
 }
 
-net_server::net_server(boost::asio::io_context& io_context, std::size_t port,
+net_server::net_server(boost::asio::io_context& io_context, const server_options& options,
 			   std::function<void (std::size_t, bool)> accept_handler,
-	           std::function<void (std::size_t, char*, std::size_t)> read_handler)
-  : io_context_(io_context), acceptor_(io_context, tcp::endpoint(tcp::v4(), 1234)),
-    accept_handler_(accept_handler), read_handler_(read_handler), next_id_(0)  {
+	           std::function<void (std::size_t, char*, std::size_t)> read_handler,
+	           const handoff_state* takeover)
+  : io_context_(io_context), acceptor_(io_context),
+    accept_strand_(boost::asio::make_strand(io_context)), options_(options),
+    accept_handler_(accept_handler), read_handler_(read_handler), next_id_(0),
+    shutting_down_(false), shutdown_finished_(false), shutdown_timer_(0),
+    handing_off_(false), handoff_pending_(0),
+    timer_wheel_(boost::asio::use_service<net_timer_wheel>(io_context)) {
+		outbound_ = std::make_shared<outbound_state>();
+		outbound_->on_change = std::bind(&net_server::outbound_changed, this, std::placeholders::_1);
+		pool_ = std::make_shared<connection_pool>(options_.pooled_connections);
+		if (takeover) {
+			// waits until the io_context runs, so that the application has set its options by then
+			boost::asio::post(io_context_, std::bind(&net_server::adopt, this, *takeover));
+			return;
+		}
+		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+		typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_DEFER_ACCEPT> defer_accept;
+		tcp::endpoint endpoint(boost::asio::ip::make_address(options_.address), options_.port);
+		acceptor_.open(endpoint.protocol());
+		if (endpoint.protocol() == tcp::v6()) {
+			acceptor_.set_option(boost::asio::ip::v6_only(options_.v6_only));
+		}
+		acceptor_.set_option(tcp::acceptor::reuse_address(options_.reuse_address));
+		if (options_.reuse_port) {
+			acceptor_.set_option(reuse_port(true));
+		}
+		if (options_.defer_accept > 0) {
+			acceptor_.set_option(defer_accept(options_.defer_accept));
+		}
+		acceptor_.bind(endpoint);
+		acceptor_.listen(options_.backlog);
+		acceptor_.non_blocking(true);
 		start_accept();
 }
 
+net_server::~net_server() {
+	// Connections can outlive the server, the io_context destroys the handlers that still hold them
+	// after the application has gone. They keep the outbound total alive, but mustn't call back in here.
+	outbound_->on_change = nullptr;
+}
+
+void net_server::set_heartbeat(const heartbeat_options& options) {
+	// should be called before the server starts running
+	heartbeat_ = options;
+}
+
+void net_server::set_rate_limit(const rate_limit_options& options) {
+	// should be called before the server starts running
+	rate_limit_ = options;
+}
+
+void net_server::set_session(const session_options& options) {
+	// should be called before the server starts running
+	session_ = options;
+}
+
+void net_server::set_flow_control(std::size_t high_watermark, std::size_t low_watermark) {
+	// should be called before the server starts running
+	outbound_->high_watermark = high_watermark;
+	outbound_->low_watermark = std::min(low_watermark, high_watermark);
+}
+
+bool net_server::pause_reading(std::size_t id) {
+	std::scoped_lock lock(connections_mutex_);
+	std::shared_ptr<tcp_connection> connection = find_connection(id);
+	if (!connection) {
+		return false;
+	}
+	connection->pause_reading(tcp_connection::paused_by_application);
+	return true;
+}
+
+bool net_server::resume_reading(std::size_t id) {
+	std::scoped_lock lock(connections_mutex_);
+	std::shared_ptr<tcp_connection> connection = find_connection(id);
+	if (!connection) {
+		return false;
+	}
+	connection->resume_reading(tcp_connection::paused_by_application);
+	return true;
+}
+
+void net_server::outbound_changed(bool saturated) {
+	// Called when the total number of queued outbound bytes crosses a watermark.
+	// The connection that noticed may be in the middle of a send_to_all (which holds connections_mutex_),
+	// so the work is posted rather than done here.
+	boost::asio::post(io_context_, [this, saturated]() {
+		std::scoped_lock lock(connections_mutex_);
+		// the state may have flipped back while this was queued
+		if (saturated != outbound_->saturated) return;
+		for (auto& connection : connections_) {
+			if (saturated) {
+				connection->pause_reading(tcp_connection::paused_by_outbound);
+			} else {
+				connection->resume_reading(tcp_connection::paused_by_outbound);
+			}
+		}
+	});
+}
+
+net_timer_wheel& net_server::get_timer_wheel() {
+	return timer_wheel_;
+}
+
+void net_server::configure_socket(tcp::socket& socket) {
+	// Applies server_options (and keepalive) to a socket that was just accepted.
+	// Like the keepalive options, a failure only means the socket keeps the kernel's default.
+	typedef boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK> quick_ack;
+	boost::system::error_code ec;
+	if (options_.no_delay) {
+		socket.set_option(tcp::no_delay(true), ec);
+	}
+	if (options_.quick_ack) {
+		socket.set_option(quick_ack(true), ec);
+	}
+	if (options_.send_buffer > 0) {
+		socket.set_option(boost::asio::socket_base::send_buffer_size(options_.send_buffer), ec);
+	}
+	if (options_.receive_buffer > 0) {
+		socket.set_option(boost::asio::socket_base::receive_buffer_size(options_.receive_buffer), ec);
+	}
+	if (heartbeat_.tcp_keepalive) {
+		set_keepalive(socket);
+	}
+}
+
+void net_server::set_keepalive(tcp::socket& socket) {
+	// TCP keepalive catches peers that vanished even if the application level pings are turned off.
+	// Errors are ignored, not every platform supports the fine grained options.
+	typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE> keepalive_idle;
+	typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL> keepalive_interval;
+	typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT> keepalive_count;
+	boost::system::error_code ec;
+	socket.set_option(boost::asio::socket_base::keep_alive(true), ec);
+	socket.set_option(keepalive_idle(heartbeat_.keepalive_idle), ec);
+	socket.set_option(keepalive_interval(heartbeat_.keepalive_interval), ec);
+	socket.set_option(keepalive_count(heartbeat_.keepalive_count), ec);
+}
+
+void net_server::schedule_check(std::shared_ptr<tcp_connection> connection, std::chrono::steady_clock::time_point when) {
+	// Precondition: running on the connection's strand (or before the connection has started)
+	// The timer only holds a weak_ptr so a disconnected connection isn't kept alive by it.
+	// It isn't scheduled on the connection's strand, which may not be the connection's strand anymore
+	// by the time it fires (see set_strand), check_connection finds the strand then.
+	std::weak_ptr<tcp_connection> weak_connection = connection;
+	connection->liveness_timer_ = timer_wheel_.schedule(when - std::chrono::steady_clock::now(),
+	  boost::bind(&net_server::check_connection, this, weak_connection));
+}
+
+void net_server::check_connection(std::weak_ptr<tcp_connection> weak_connection) {
+	std::shared_ptr<tcp_connection> connection = weak_connection.lock();
+	if (!connection) return;
+	net_strand strand = connection->get_strand();
+	if (!strand.running_in_this_thread()) {
+		boost::asio::dispatch(strand, boost::bind(&net_server::check_connection, this, weak_connection));
+		return;
+	}
+	if (!connection->valid()) return;
+	auto next = connection->check_liveness(heartbeat_);
+	if (next != std::chrono::steady_clock::time_point()) {
+		schedule_check(connection, next);
+	}
+}
+
 void net_server::client_disconnect(std::shared_ptr<tcp_connection> connection) {
 	// Whenever a client connects and a tcp_connection object is created
 	// to represent that client, this disconnect function will be passed to it.
 	// That way, when the tcp_connection object receives a notification that it 
 	// the client has disconnected, it can remove itself from the connections_ list.
+	// A client with a session is parked instead, and the application only hears about it
+	// if the client doesn't come back within the grace period (see expire_session).
 	std::size_t id = connection->get_id();
+	bool last_one;
+	bool last_handed_off = false;
+	bool park = false;
+	std::pair<std::shared_ptr<tcp_connection>, std::uint64_t> waiting;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		connections_.remove(connection);
+		last_one = shutting_down_ && connections_.empty();
+		if (handing_off_ && handoff_pending_ > 0) {
+			last_handed_off = --handoff_pending_ == 0;
+		}
+		if (!connection->token_.empty()) {
+			park = !shutting_down_ && !handing_off_;
+			if (park) {
+				auto found = waiting_resume_.find(id);
+				if (found != waiting_resume_.end()) {
+					// the client already came back on a new connection, which takes over straight away
+					waiting = found->second;
+					waiting_resume_.erase(found);
+				} else {
+					parked_[id] = connection;
+				}
+			} else {
+				sessions_.erase(connection->token_);
+			}
+		}
+	}
+	// we are on the connection's strand, so the liveness check can't be rescheduling itself right now
+	timer_wheel_.cancel(connection->liveness_timer_);
+	if (park) {
+		connection->parked_ = true;
+		if (waiting.first) {
+			resume_session(waiting.first, connection, waiting.second);
+		} else {
+			connection->liveness_timer_ = timer_wheel_.schedule(connection->get_strand(), session_.grace,
+			  boost::bind(&net_server::expire_session, this, connection));
+		}
+	} else if (connection->established_) {
+		// a connection that never finished its handshake was never announced to the application
+		accept_handler_(id, false);
+	}
+	if (last_one) {
+		finish_shutdown();
+	}
+	if (last_handed_off) {
+		finish_handoff();
+	}
+}
+
+void net_server::open_session(std::shared_ptr<tcp_connection> connection, const net_message* hello) {
+	// Called on the connection's strand with the client's HELO, or with nullptr
+	// if the client sent a message without doing the handshake.
+	if (!hello) {
+		establish(connection, false);
+		return;
+	}
+	std::string token(hello->get_token(), net_message::token_length);
+	std::uint64_t client_received = hello->get_count();
+	std::shared_ptr<tcp_connection> parked;
+	std::shared_ptr<tcp_connection> stale;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		auto session = sessions_.find(token);
+		if (session == sessions_.end() || shutting_down_ || handing_off_) {
+			// an unknown (or all zero) token just means a new client
+		} else if (parked_.count(session->second)) {
+			parked = parked_[session->second];
+			parked_.erase(session->second);
+		} else {
+			// The client noticed the connection was dead before we did. The old connection is closed,
+			// and this one takes the session over once the old one has been parked (see client_disconnect).
+			stale = find_connection(session->second);
+			if (stale) {
+				waiting_resume_[session->second] = std::make_pair(connection, client_received);
+			}
+		}
+	}
+	if (stale) {
+		boost::asio::dispatch(stale->get_strand(), [stale]() { stale->close(); });
+	} else if (parked) {
+		resume_session(connection, parked, client_received);
+	} else {
+		establish(connection, true);
+	}
+}
+
+void net_server::establish(std::shared_ptr<tcp_connection> connection, bool with_session) {
+	// a brand new client, which the application gets to hear about now
+	// Precondition: running on the connection's strand
+	if (with_session) {
+		std::string token = make_token();
+		{
+			std::scoped_lock lock(connections_mutex_);
+			sessions_[token] = connection->get_id();
+		}
+		connection->token_ = token;
+		connection->do_send(net_message(net_message::welcome_frame, token.data(), 0));
+	}
+	connection->send_greeting();
+	accept_handler_(connection->get_id(), true);
+}
+
+void net_server::resume_session(std::shared_ptr<tcp_connection> connection, std::shared_ptr<tcp_connection> parked,
+                                std::uint64_t client_received) {
+	// Moves a parked session onto the client's new connection. Whatever was waiting in the parked
+	// connection is collected on its strand, then installed in the new connection on its strand.
+	boost::asio::dispatch(parked->get_strand(), [this, connection, parked, client_received]() {
+		timer_wheel_.cancel(parked->liveness_timer_);
+		// frames the client may not have got, oldest first: written but unacknowledged, then never written
+		std::deque<net_message> pending;
+		for (std::size_t i = 0; i < parked->unacked_.size(); i++) {
+			pending.push_back(parked->unacked_[i]);
+		}
+		parked->unacked_.clear();
+		std::int64_t held = 0;
+		for (std::size_t i = 0; i < parked->write_messages_.size(); i++) {
+			net_message& msg = parked->write_messages_[i];
+			held += msg.get_frame_length();
+			if (msg.get_type() == net_message::data_frame || msg.get_type() == net_message::batch_frame) {
+				pending.push_back(msg);
+			}
+		}
+		parked->write_messages_.clear();
+		outbound_->queued_bytes -= held; // they are counted again as the new connection queues them
+		boost::asio::dispatch(connection->get_strand(),
+		  boost::bind(&net_server::finish_resume, this, connection, parked, pending, client_received));
+	});
+}
+
+void net_server::finish_resume(std::shared_ptr<tcp_connection> connection, std::shared_ptr<tcp_connection> parked,
+                               std::deque<net_message> pending, std::uint64_t client_received) {
+	// Precondition: running on the new connection's strand
+	// The new connection takes over the parked connection's id, so connections_ has to be re-sorted.
 	{
 		std::scoped_lock lock(connections_mutex_);
 		connections_.remove(connection);
+		connection->id_ = parked->id_;
+		auto position = std::lower_bound(connections_.begin(), connections_.end(), connection->get_id(),
+		  [](const std::shared_ptr<tcp_connection>& c1, const std::size_t& id) {
+			return c1->get_id() < id;
+		});
+		connections_.insert(position, connection);
+	}
+	connection->token_ = parked->token_;
+	connection->received_ = parked->received_;
+	connection->acked_ = parked->acked_;
+	connection->do_send(net_message(net_message::welcome_frame, connection->token_.data(), connection->received_));
+	while (connection->acked_ < client_received && !pending.empty()) {
+		std::size_t count = pending.front().get_frame_count();
+		if (connection->acked_ + count <= client_received) {
+			pending.pop_front();
+			connection->acked_ += count;
+		} else {
+			// the client got part of a batch, split it up to drop just the frames it has
+			std::string frames(pending.front().get_frame_data(), pending.front().get_frame_length());
+			pending.pop_front();
+			std::deque<net_message> split;
+			parse_frames(frames, split);
+			pending.insert(pending.begin(), split.begin(), split.end());
+		}
+	}
+	if (connection->acked_ < client_received) {
+		std::cerr << "client " << connection->get_id() << " has received more than was kept for it" << std::endl;
+		connection->acked_ = client_received;
+	}
+	for (auto& msg : pending) {
+		connection->do_send(msg);
+	}
+	// the application may have put the client on a strand of its own
+	connection->set_strand(parked->get_strand());
+	if (!connection->valid()) {
+		// gone again while the session was moving over, so it goes back to waiting
+		client_disconnect(connection);
+	}
+}
+
+void net_server::expire_session(std::shared_ptr<tcp_connection> connection) {
+	// The client didn't come back within the grace period, so now it's really gone.
+	std::size_t id = connection->get_id();
+	{
+		std::scoped_lock lock(connections_mutex_);
+		auto parked = parked_.find(id);
+		if (parked == parked_.end() || parked->second != connection) {
+			return; // resumed in the meantime
+		}
+		parked_.erase(parked);
+		sessions_.erase(connection->token_);
 	}
 	accept_handler_(id, false);
 }
 
+void net_server::shutdown(std::chrono::milliseconds deadline, const std::string& goodbye, std::function<void ()> done) {
+	std::vector<std::shared_ptr<tcp_connection>> draining;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		if (shutting_down_) return;
+		shutting_down_ = true;
+		shutdown_handler_ = done;
+		draining.assign(connections_.begin(), connections_.end());
+	}
+	boost::asio::dispatch(accept_strand_, [this]() {
+		boost::system::error_code ec;
+		acceptor_.close(ec);
+	});
+	// the goodbye is queued on each connection's strand before the drain, so it is the last thing written
+	net_message msg(goodbye.c_str(), goodbye.length());
+	for (auto& connection : draining) {
+		if (!goodbye.empty()) {
+			connection->send(msg);
+		}
+		connection->drain();
+	}
+	if (draining.empty()) {
+		finish_shutdown();
+		return;
+	}
+	shutdown_timer_ = timer_wheel_.schedule(deadline, boost::bind(&net_server::shutdown_deadline, this));
+}
+
+void net_server::shutdown_deadline() {
+	// some clients never closed their side, so stop waiting for them
+	std::scoped_lock lock(connections_mutex_);
+	if (!connections_.empty()) {
+		std::cerr << "closing " << connections_.size() << " connections that didn't finish draining in time" << std::endl;
+	}
+	for (auto& connection : connections_) {
+		auto self = connection;
+		boost::asio::dispatch(connection->get_strand(), [self]() { self->close(); });
+	}
+}
+
+void net_server::finish_shutdown() {
+	if (shutdown_finished_.exchange(true)) return;
+	timer_wheel_.cancel(shutdown_timer_);
+	boost::asio::post(io_context_, shutdown_handler_);
+}
+
+void net_server::enable_hot_restart(const std::string& path, bool include_connections,
+                                    std::function<std::string ()> save_state, std::function<void ()> done) {
+	// A stale socket file left behind by an earlier process would make the bind fail.
+	::unlink(path.c_str());
+	handoff_acceptor_ = std::make_unique<boost::asio::local::stream_protocol::acceptor>(io_context_,
+	  boost::asio::local::stream_protocol::endpoint(path));
+	auto socket = std::make_shared<boost::asio::local::stream_protocol::socket>(io_context_);
+	handoff_acceptor_->async_accept(*socket, boost::asio::bind_executor(accept_strand_,
+	  [this, socket, path, include_connections, save_state, done](boost::system::error_code ec) {
+		if (ec) {
+			if (ec != boost::asio::error::operation_aborted) {
+				std::cerr << "error accepting a hot restart request: " << ec.message() << std::endl;
+			}
+			return;
+		}
+		// only one process gets to take over, and it binds the path for the next restart itself
+		handoff_acceptor_->close(ec);
+		hand_off(include_connections, [this, socket, path, include_connections, save_state, done](handoff_state state) {
+			state.application = save_state();
+			if (!send_handoff(socket->native_handle(), state)) {
+				std::cerr << "hot restart failed, carrying on in this process" << std::endl;
+				adopt(state);
+				enable_hot_restart(path, include_connections, save_state, done);
+				return;
+			}
+			// the new process has its own copies of the descriptors now
+			::close(state.acceptor_fd);
+			for (auto& connection : state.connections) {
+				::close(connection.fd);
+			}
+			done();
+		});
+	}));
+}
+
+void net_server::hand_off(bool include_connections, std::function<void (handoff_state)> done) {
+	// The acceptor lives on accept_strand_, so it can be released without racing an accept.
+	// Anything that connects from now on waits in the listen backlog for the new process.
+	boost::asio::dispatch(accept_strand_, [this, include_connections, done]() {
+		std::vector<std::shared_ptr<tcp_connection>> moving;
+		{
+			std::scoped_lock lock(connections_mutex_);
+			if (handing_off_ || shutting_down_) return;
+			handing_off_ = true;
+			handoff_handler_ = done;
+			handoff_ = handoff_state();
+			boost::system::error_code ec;
+			handoff_.acceptor_fd = acceptor_.release(ec);
+			handoff_.next_id = next_id_;
+			if (include_connections) {
+				moving.assign(connections_.begin(), connections_.end());
+			}
+			handoff_pending_ = moving.size();
+		}
+		if (moving.empty()) {
+			finish_handoff();
+			return;
+		}
+		for (auto& connection : moving) {
+			connection->hand_off(std::bind(&net_server::connection_handed_off, this, std::placeholders::_1, std::placeholders::_2));
+		}
+	});
+}
+
+void net_server::connection_handed_off(std::shared_ptr<tcp_connection> connection, handoff_connection handed_off) {
+	// runs on the connection's strand, the connection is already detached from its socket
+	bool last;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		connections_.remove(connection);
+		handoff_.connections.push_back(std::move(handed_off));
+		last = --handoff_pending_ == 0;
+	}
+	timer_wheel_.cancel(connection->liveness_timer_);
+	if (last) {
+		finish_handoff();
+	}
+}
+
+void net_server::finish_handoff() {
+	handoff_state state;
+	std::function<void (handoff_state)> done;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		state = std::move(handoff_);
+		done = std::move(handoff_handler_);
+	}
+	boost::asio::post(io_context_, std::bind(done, std::move(state)));
+}
+
+void net_server::adopt(const handoff_state& state) {
+	// Takes over a listening socket and connections from a handoff_state, either at startup in
+	// a new process or to take them back after a handoff that couldn't be sent.
+	boost::system::error_code ec;
+	acceptor_.assign(handoff_protocol(state.acceptor_fd), state.acceptor_fd, ec);
+	if (!ec) {
+		acceptor_.non_blocking(true, ec);
+	}
+	if (ec) {
+		std::cerr << "couldn't take over the listening socket: " << ec.message() << std::endl;
+	}
+	std::vector<std::pair<std::shared_ptr<tcp_connection>, const handoff_connection*>> adopted;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		handing_off_ = false;
+		next_id_ = std::max(next_id_, state.next_id);
+		for (auto& handed_off : state.connections) {
+			tcp::socket socket(io_context_);
+			socket.assign(handoff_protocol(handed_off.fd), handed_off.fd, ec);
+			if (ec) {
+				std::cerr << "couldn't take over client " << handed_off.id << ": " << ec.message() << std::endl;
+				::close(handed_off.fd);
+				continue;
+			}
+			auto connection = make_connection(std::move(socket), handed_off.id, make_strand());
+			connection->established_ = handed_off.established;
+			if (!handed_off.session.empty()) {
+				connection->token_ = handed_off.session;
+				connection->received_ = handed_off.received;
+				connection->acked_ = handed_off.acked;
+				parse_frames(handed_off.replay, connection->unacked_);
+				sessions_[handed_off.session] = handed_off.id;
+			}
+			// the connections came over in whatever order they finished in, but connections_ has to stay sorted
+			auto position = std::lower_bound(connections_.begin(), connections_.end(), handed_off.id,
+			  [](const std::shared_ptr<tcp_connection>& c1, const std::size_t& id) {
+				return c1->get_id() < id;
+			});
+			connections_.insert(position, connection);
+			adopted.emplace_back(connection, &handed_off);
+		}
+	}
+	for (auto& [connection, handed_off] : adopted) {
+		connection->resume(handed_off->inbound, handed_off->outbound);
+		if (heartbeat_.enabled) {
+			schedule_check(connection, std::chrono::steady_clock::now() + heartbeat_.ping_interval);
+		}
+	}
+	boost::asio::dispatch(accept_strand_, boost::bind(&net_server::start_accept, this));
+}
+
+std::shared_ptr<tcp_connection> net_server::make_connection(tcp::socket socket, std::size_t id, net_strand strand) {
+	// Takes a connection out of the pool if there is one. When the last reference goes away,
+	// the connection goes back to the pool instead of being deleted.
+	tcp_connection* connection = pool_->take();
+	if (!connection) {
+		connection = new tcp_connection(io_context_, timer_wheel_, outbound_, read_handler_,
+		  std::bind(&net_server::client_disconnect, this, std::placeholders::_1),
+		  std::bind(&net_server::open_session, this, std::placeholders::_1, std::placeholders::_2));
+	}
+	connection->reset(std::move(socket), id, strand, rate_limit_, session_);
+	std::shared_ptr<connection_pool> pool = pool_;
+	return std::shared_ptr<tcp_connection>(connection,
+	  [pool](tcp_connection* released) {
+		released->recycle();
+		pool->give_back(released);
+	  },
+	  pool_allocator<tcp_connection>(pool));
+}
+
 void net_server::start_accept() {
+	// Precondition: running on accept_strand_ (or before the io_context is running)
+	// Several accepts wait on the listening socket at once, so a burst of clients
+	// (everyone reconnecting after a restart for example) isn't taken one connection per wakeup.
+	for (std::size_t i = 0; i < std::max<std::size_t>(options_.accepts_outstanding, 1); i++) {
+		accept_one();
+	}
+}
+
+void net_server::accept_one() {
 	// Anytime a client tries to connect to the server, the lambda function below
 	// will be called. 
+	// The accept path only takes sockets off the listening socket and puts the accept straight back.
+	// Everything else (creating the connection, giving it an id, telling the application)
+	// happens in add_connection, on the new connection's strand.
+	// On each completion, whatever else is already waiting in the backlog is taken as well,
+	// up to accept_batch, with non-blocking accepts (the acceptor is in non-blocking mode).
+	acceptor_.async_accept(boost::asio::bind_executor(accept_strand_,
+	  [this](boost::system::error_code ec, tcp::socket socket) {
+		if (ec == boost::asio::error::operation_aborted || !acceptor_.is_open()) {
+			return; // closed by shutdown
+		}
+		if (!ec) {
+			add_connection(std::move(socket));
+			for (std::size_t i = 0; i < options_.accept_batch; i++) {
+				tcp::socket next = acceptor_.accept(ec);
+				if (ec) {
+					break; // would_block once the backlog is empty
+				}
+				add_connection(std::move(next));
+			}
+		}
+		accept_one();
+	  }));
+}
+
+void net_server::add_connection(tcp::socket socket) {
+	// Precondition: running on accept_strand_
+	net_strand strand = make_strand();
+	boost::asio::post(strand, [this, strand, socket = std::move(socket)]() mutable {
+		setup_connection(socket, strand);
+	});
+}
+
+void net_server::setup_connection(tcp::socket& socket, net_strand strand) {
+	// Precondition: running on strand, which becomes the new connection's strand
 	// We give each connection a unique id that is continuously increasing.
-	// We also pass the connection object the read_handler that was passed in
-	// by the application server and the client_disconnect function from above.
+	// The id is handed out under the same lock that adds the connection to connections_,
+	// so the list stays sorted even though connections are set up on many threads.
 	// Each connection is added to the connections_ list which is a list of
 	// shared_ptr so that when the list gets reallocated, the connection objects themselves
 	// don't need to be moved in memory.
 	// Once all of the connection setup is finished, we let the application server
 	// know that a new user has connected by calling the accept_handler function that 
 	// they provided us.
-	acceptor_.async_accept(
-	  [this](boost::system::error_code ec, tcp::socket socket) {
-		if (!ec) {
-			std::unique_lock lock(connections_mutex_);
-			std::size_t id = next_id_++;
-			connections_.push_back(std::make_shared<tcp_connection>(std::move(socket), id, read_handler_, 
-									std::bind(&net_server::client_disconnect, this, std::placeholders::_1)));
-			auto connection = connections_.back();
-			lock.unlock();
+	configure_socket(socket);
+	std::unique_lock lock(connections_mutex_);
+	if (shutting_down_ || handing_off_) {
+		return; // the socket is closed as it goes out of scope
+	}
+	std::size_t id = next_id_++;
+	connections_.push_back(make_connection(std::move(socket), id, strand));
+	auto connection = connections_.back();
+	lock.unlock();
 
-			connection->start();
-			accept_handler_(id, true);
-		}
-		start_accept();
-	  });
+	connection->start();
+	if (heartbeat_.enabled) {
+		schedule_check(connection, std::chrono::steady_clock::now() + heartbeat_.ping_interval);
+	}
+	if (!session_.enabled) {
+		accept_handler_(id, true);
+	}
 }
 
 void net_server::send_to(std::size_t id, const char* body, std::size_t length) {
 	// Function used to send a message to a specific client
+	send_to(id, net_message(body, length));
+}
+
+void net_server::send_to(std::size_t id, const net_message& msg) {
 	// We could optimize  the search in the future by leveraging the fact that the id's
 	// are constantly increasing so we know that the list of connections will be in
 	// sorted order according to the id.
-	std::shared_ptr<tcp_connection> connection = find_connection(id);
+	std::shared_ptr<tcp_connection> connection;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		connection = find_connection(id);
+		if (!connection && parked_.count(id)) {
+			connection = parked_[id]; // held until the client comes back
+		}
+	}
 	if (!connection) {
 		std::cerr << "Attempting to send a message to client " << id << ", but client not found." << std::endl;
 		return;
 	}
-	net_message msg(body, length);
 	connection->send(msg);
 	return;
 }
 
 void net_server::send_to_all(const char* body, std::size_t length) {
 	// Function called to send a message to every client.
-	net_message msg(body, length);
+	send_to_all(net_message(body, length));
+}
+
+void net_server::send_to_all(const net_message& msg) {
+	std::scoped_lock lock(connections_mutex_);
 	for (auto& connection : connections_) {
 		// send function takes a net_message by value so the copy constructor gets called
 		// this constructor makes a deep copy of the underlying data
@@ -181,26 +1399,66 @@ void net_server::send_to_all(const char* body, std::size_t length) {
 		if (!connection->valid()) continue;
 		connection->send(msg);
 	}
+	for (auto& parked : parked_) {
+		parked.second->send(msg);
+	}
+}
+
+void net_server::send_to_all(const net_message& msg, const std::function<bool (std::size_t)>& filter) {
+	std::scoped_lock lock(connections_mutex_);
+	for (auto& connection : connections_) {
+		if (!connection->valid() || !filter(connection->get_id())) continue;
+		connection->send(msg);
+	}
+	for (auto& parked : parked_) {
+		if (!filter(parked.first)) continue;
+		parked.second->send(msg);
+	}
 }
 
 void net_server::send_to_all_except(std::size_t id, const char* body, std::size_t length) {
 	// Function called to send a message to every client except 1.
 	net_message msg(body, length);
+	std::scoped_lock lock(connections_mutex_);
 	for (auto& connection : connections_) {
 		if (connection->get_id() == id) continue;
 		if (!connection->valid()) continue;
 		connection->send(msg);
 	}
+	for (auto& parked : parked_) {
+		if (parked.first == id) continue;
+		parked.second->send(msg);
+	}
+}
+
+net_strand net_server::make_strand() {
+	return boost::asio::make_strand(io_context_);
+}
+
+bool net_server::set_strand(std::size_t id, net_strand strand) {
+	// Moves a connection onto a strand chosen by the application.
+	// Returns false if the client has already disconnected.
+	std::shared_ptr<tcp_connection> connection;
+	{
+		std::scoped_lock lock(connections_mutex_);
+		connection = find_connection(id);
+	}
+	if (!connection) {
+		return false;
+	}
+	connection->set_strand(strand);
+	return true;
 }
 
 std::shared_ptr<tcp_connection> net_server::find_connection(std::size_t id) {
 	// connections_ list is always guaranteed to be sorted according to id
+	// the caller must be holding connections_mutex_
 	auto iterator = std::lower_bound(connections_.begin(), connections_.end(), id,
 	  [](const std::shared_ptr<tcp_connection>& c1, const std::size_t& id) {
 		return c1->get_id() < id;
 	});
 	
-	if (iterator == connections_.end()) {
+	if (iterator == connections_.end() || (*iterator)->get_id() != id) {
 		return nullptr;
 	}
 	
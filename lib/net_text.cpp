@@ -0,0 +1,364 @@
+#include "net_text.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NET_TEXT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+	bool valid_utf8_scalar(const char* data, std::size_t length) {
+		const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+		std::size_t i = 0;
+		while (i < length) {
+			// eight ASCII bytes at a time while there are any
+			if (length - i >= 8) {
+				std::uint64_t word;
+				std::memcpy(&word, s + i, 8);
+				if (!(word & 0x8080808080808080ull)) {
+					i += 8;
+					continue;
+				}
+			}
+			unsigned char c = s[i];
+			if (c < 0x80) {
+				i++;
+				continue;
+			}
+			std::size_t sequence;
+			std::uint32_t code_point;
+			std::uint32_t smallest;
+			if ((c & 0xE0) == 0xC0) {
+				sequence = 2;
+				code_point = c & 0x1F;
+				smallest = 0x80;
+			} else if ((c & 0xF0) == 0xE0) {
+				sequence = 3;
+				code_point = c & 0x0F;
+				smallest = 0x800;
+			} else if ((c & 0xF8) == 0xF0) {
+				sequence = 4;
+				code_point = c & 0x07;
+				smallest = 0x10000;
+			} else {
+				return false;
+			}
+			if (length - i < sequence) {
+				return false;
+			}
+			for (std::size_t k = 1; k < sequence; k++) {
+				if ((s[i + k] & 0xC0) != 0x80) {
+					return false;
+				}
+				code_point = (code_point << 6) | (s[i + k] & 0x3F);
+			}
+			if (code_point < smallest || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+				return false;
+			}
+			i += sequence;
+		}
+		return true;
+	}
+
+	bool is_identifier_char(unsigned char c) {
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	}
+
+	bool is_identifier_scalar(const char* data, std::size_t length) {
+		for (std::size_t i = 0; i < length; i++) {
+			if (!is_identifier_char(data[i])) {
+				return false;
+			}
+		}
+		return length > 0;
+	}
+
+	std::size_t find_scalar(const char* data, std::size_t length, char delimiter) {
+		const void* found = std::memchr(data, delimiter, length);
+		return found ? static_cast<const char*>(found) - data : length;
+	}
+
+	std::size_t utf8_restart(const char* data, std::size_t checked) {
+		// The vector loops stop at a whole vector, maybe in the middle of a sequence, whose
+		// continuation bytes they haven't seen. The rest is checked from that sequence's lead byte on.
+		const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+		for (std::size_t back = 1; back <= 3 && back <= checked; back++) {
+			unsigned char c = s[checked - back];
+			if (c < 0x80) {
+				break;
+			}
+			if (c >= 0xC0) {
+				std::size_t sequence = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+				return sequence > back ? checked - back : checked;
+			}
+		}
+		return checked;
+	}
+
+#ifdef NET_TEXT_X86
+	// The error classes of the lookup algorithm, a bit each. Looking up the high and low nibble
+	// of a byte and the high nibble of the byte after it gives three masks whose AND is non-zero
+	// exactly when the pair is one of these.
+	enum : std::uint8_t {
+		too_short = 1 << 0, // a lead byte followed by a lead byte or ASCII
+		too_long = 1 << 1, // ASCII followed by a continuation byte
+		overlong_3 = 1 << 2, // 11100000 100_____
+		too_large = 1 << 3, // 11110100 1001____, 11110100 101_____ or 11110101 and up
+		surrogate = 1 << 4, // 11101101 101_____
+		overlong_2 = 1 << 5, // 1100000_ 10______
+		too_large_1000 = 1 << 6, // 11110101 and up followed by 1000____
+		overlong_4 = 1 << 6, // 11110000 1000____
+		two_conts = 1 << 7, // a continuation byte followed by one (an error unless it's part of a 3 or 4 byte sequence)
+		carry = too_short | too_long | two_conts
+	};
+
+	alignas(16) const std::uint8_t byte_1_high[16] = {
+		too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+		two_conts, two_conts, two_conts, two_conts,
+		too_short | overlong_2,
+		too_short,
+		too_short | overlong_3 | surrogate,
+		too_short | too_large | too_large_1000 | overlong_4
+	};
+
+	alignas(16) const std::uint8_t byte_1_low[16] = {
+		carry | overlong_3 | overlong_2 | overlong_4,
+		carry | overlong_2,
+		carry,
+		carry,
+		carry | too_large,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000 | surrogate,
+		carry | too_large | too_large_1000,
+		carry | too_large | too_large_1000
+	};
+
+	alignas(16) const std::uint8_t byte_2_high[16] = {
+		too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+		too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+		too_long | overlong_2 | two_conts | overlong_3 | too_large,
+		too_long | overlong_2 | two_conts | surrogate | too_large,
+		too_long | overlong_2 | two_conts | surrogate | too_large,
+		too_short, too_short, too_short, too_short
+	};
+
+	// a vector ending in a lead byte whose sequence doesn't fit is incomplete
+	alignas(32) const std::uint8_t incomplete_limit[32] = {
+		255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+		255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+		0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+	};
+
+	__attribute__((target("avx2")))
+	bool valid_utf8_avx2(const char* data, std::size_t length) {
+		const __m256i table_1_high = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_high)));
+		const __m256i table_1_low = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_low)));
+		const __m256i table_2_high = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(byte_2_high)));
+		const __m256i limit = _mm256_load_si256(reinterpret_cast<const __m256i*>(incomplete_limit));
+		const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i previous = zero;
+		__m256i previous_incomplete = zero;
+		__m256i error = zero;
+		std::size_t i = 0;
+		for (; i + 32 <= length; i += 32) {
+			__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			if (!_mm256_movemask_epi8(input)) {
+				// all ASCII, which is only wrong if the last vector left a sequence open
+				error = _mm256_or_si256(error, previous_incomplete);
+				previous = input;
+				previous_incomplete = zero;
+				continue;
+			}
+			// the input shifted by one, two and three bytes, with the end of the previous vector shifted in
+			__m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+			__m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+			__m256i prev2 = _mm256_alignr_epi8(input, carried, 14);
+			__m256i prev3 = _mm256_alignr_epi8(input, carried, 13);
+			__m256i special = _mm256_and_si256(
+			  _mm256_and_si256(
+			    _mm256_shuffle_epi8(table_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble)),
+			    _mm256_shuffle_epi8(table_1_low, _mm256_and_si256(prev1, low_nibble))),
+			  _mm256_shuffle_epi8(table_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble)));
+			// the bytes that have to be the second or third continuation byte of a sequence,
+			// where two continuation bytes in a row is what's expected
+			__m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 1)));
+			__m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 1)));
+			__m256i must_continue = _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_or_si256(third, fourth), zero),
+			                                         _mm256_set1_epi8(static_cast<char>(0x80)));
+			error = _mm256_or_si256(error, _mm256_xor_si256(must_continue, special));
+			previous = input;
+			previous_incomplete = _mm256_subs_epu8(input, limit);
+		}
+		if (!_mm256_testz_si256(error, error)) {
+			return false;
+		}
+		std::size_t restart = utf8_restart(data, i);
+		return valid_utf8_scalar(data + restart, length - restart);
+	}
+
+	__attribute__((target("sse4.2")))
+	bool valid_utf8_sse(const char* data, std::size_t length) {
+		const __m128i table_1_high = _mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_high));
+		const __m128i table_1_low = _mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_low));
+		const __m128i table_2_high = _mm_load_si128(reinterpret_cast<const __m128i*>(byte_2_high));
+		const __m128i limit = _mm_loadu_si128(reinterpret_cast<const __m128i*>(incomplete_limit + 16));
+		const __m128i low_nibble = _mm_set1_epi8(0x0F);
+		const __m128i zero = _mm_setzero_si128();
+		__m128i previous = zero;
+		__m128i previous_incomplete = zero;
+		__m128i error = zero;
+		std::size_t i = 0;
+		for (; i + 16 <= length; i += 16) {
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			if (!_mm_movemask_epi8(input)) {
+				error = _mm_or_si128(error, previous_incomplete);
+				previous = input;
+				previous_incomplete = zero;
+				continue;
+			}
+			__m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+			__m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+			__m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+			__m128i special = _mm_and_si128(
+			  _mm_and_si128(
+			    _mm_shuffle_epi8(table_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble)),
+			    _mm_shuffle_epi8(table_1_low, _mm_and_si128(prev1, low_nibble))),
+			  _mm_shuffle_epi8(table_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble)));
+			__m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 1)));
+			__m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 1)));
+			__m128i must_continue = _mm_and_si128(_mm_cmpgt_epi8(_mm_or_si128(third, fourth), zero),
+			                                      _mm_set1_epi8(static_cast<char>(0x80)));
+			error = _mm_or_si128(error, _mm_xor_si128(must_continue, special));
+			previous = input;
+			previous_incomplete = _mm_subs_epu8(input, limit);
+		}
+		if (!_mm_testz_si128(error, error)) {
+			return false;
+		}
+		std::size_t restart = utf8_restart(data, i);
+		return valid_utf8_scalar(data + restart, length - restart);
+	}
+
+	__attribute__((target("avx2")))
+	bool is_identifier_avx2(const char* data, std::size_t length) {
+		// a byte is a digit if byte - '0' is at most 9, and a letter if (byte | 0x20) - 'a' is at most 25
+		const __m256i zero_char = _mm256_set1_epi8('0');
+		const __m256i a_char = _mm256_set1_epi8('a');
+		const __m256i lower = _mm256_set1_epi8(0x20);
+		const __m256i nine = _mm256_set1_epi8(9);
+		const __m256i twenty_five = _mm256_set1_epi8(25);
+		std::size_t i = 0;
+		for (; i + 32 <= length; i += 32) {
+			__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			__m256i digit = _mm256_sub_epi8(input, zero_char);
+			__m256i letter = _mm256_sub_epi8(_mm256_or_si256(input, lower), a_char);
+			__m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit),
+			                             _mm256_cmpeq_epi8(_mm256_min_epu8(letter, twenty_five), letter));
+			if (_mm256_movemask_epi8(ok) != -1) {
+				return false;
+			}
+		}
+		return is_identifier_scalar(data + i, length - i) || (i > 0 && i == length);
+	}
+
+	__attribute__((target("sse4.2")))
+	bool is_identifier_sse(const char* data, std::size_t length) {
+		const __m128i zero_char = _mm_set1_epi8('0');
+		const __m128i a_char = _mm_set1_epi8('a');
+		const __m128i lower = _mm_set1_epi8(0x20);
+		const __m128i nine = _mm_set1_epi8(9);
+		const __m128i twenty_five = _mm_set1_epi8(25);
+		std::size_t i = 0;
+		for (; i + 16 <= length; i += 16) {
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			__m128i digit = _mm_sub_epi8(input, zero_char);
+			__m128i letter = _mm_sub_epi8(_mm_or_si128(input, lower), a_char);
+			__m128i ok = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit),
+			                          _mm_cmpeq_epi8(_mm_min_epu8(letter, twenty_five), letter));
+			if (_mm_movemask_epi8(ok) != 0xFFFF) {
+				return false;
+			}
+		}
+		return is_identifier_scalar(data + i, length - i) || (i > 0 && i == length);
+	}
+
+	__attribute__((target("avx2")))
+	std::size_t find_avx2(const char* data, std::size_t length, char delimiter) {
+		const __m256i wanted = _mm256_set1_epi8(delimiter);
+		std::size_t i = 0;
+		for (; i + 32 <= length; i += 32) {
+			__m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(input, wanted));
+			if (mask) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+		return i + find_scalar(data + i, length - i, delimiter);
+	}
+
+	__attribute__((target("sse4.2")))
+	std::size_t find_sse(const char* data, std::size_t length, char delimiter) {
+		const __m128i wanted = _mm_set1_epi8(delimiter);
+		std::size_t i = 0;
+		for (; i + 16 <= length; i += 16) {
+			__m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(input, wanted));
+			if (mask) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+		return i + find_scalar(data + i, length - i, delimiter);
+	}
+#endif
+
+	struct text_functions {
+		bool (*valid_utf8)(const char*, std::size_t);
+		bool (*is_identifier)(const char*, std::size_t);
+		std::size_t (*find)(const char*, std::size_t, char);
+		const char* name;
+	};
+
+	text_functions choose_functions() {
+#ifdef NET_TEXT_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return { valid_utf8_avx2, is_identifier_avx2, find_avx2, "avx2" };
+		}
+		if (__builtin_cpu_supports("sse4.2")) {
+			return { valid_utf8_sse, is_identifier_sse, find_sse, "sse4.2" };
+		}
+#endif
+		return { valid_utf8_scalar, is_identifier_scalar, find_scalar, "scalar" };
+	}
+
+	const text_functions& functions() {
+		static const text_functions chosen = choose_functions();
+		return chosen;
+	}
+}
+
+bool text_valid_utf8(const char* data, std::size_t length) {
+	return functions().valid_utf8(data, length);
+}
+
+bool text_is_identifier(const char* data, std::size_t length) {
+	return functions().is_identifier(data, length);
+}
+
+std::size_t text_find(const char* data, std::size_t length, char delimiter) {
+	return functions().find(data, length, delimiter);
+}
+
+const char* text_implementation() {
+	return functions().name;
+}
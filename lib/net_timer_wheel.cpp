@@ -0,0 +1,249 @@
+#include "net_timer_wheel.hpp"
+
+boost::asio::io_context::id net_timer_wheel::id;
+
+net_timer_wheel::net_timer_wheel(boost::asio::io_context& io_context)
+  : boost::asio::io_context::service(io_context), tick_timer_(io_context),
+    origin_(clock::now()), resolution_(std::chrono::milliseconds(10)), current_tick_(0),
+    ticking_(false), shutdown_(false), size_(0) {
+	for (std::uint32_t& head : heads_) {
+		head = npos;
+	}
+}
+
+net_timer_wheel::handle net_timer_wheel::schedule(clock::duration delay, std::function<void ()> callback) {
+	return add(delay, std::move(callback), std::nullopt);
+}
+
+net_timer_wheel::handle net_timer_wheel::schedule(strand_type strand, clock::duration delay, std::function<void ()> callback) {
+	// same as above but the callback is dispatched to strand, the one it is now (see the comment in the header)
+	return add(delay, std::move(callback), std::move(strand));
+}
+
+net_timer_wheel::handle net_timer_wheel::add(clock::duration delay, std::function<void ()> callback,
+                                             std::optional<strand_type> strand) {
+	// Puts a new timer on the wheel and starts the tick timer if the wheel was idle.
+	std::scoped_lock lock(mutex_);
+	if (shutdown_) {
+		return 0;
+	}
+	if (!ticking_) {
+		// nothing has been moving while the wheel was empty, so catch up to the present first
+		current_tick_ = now_tick();
+	}
+
+	std::uint32_t index;
+	if (!free_.empty()) {
+		index = free_.back();
+		free_.pop_back();
+	} else {
+		index = static_cast<std::uint32_t>(entries_.size());
+		entries_.push_back(entry());
+		entries_.back().generation = 0;
+	}
+	entry& e = entries_[index];
+	e.callback = std::move(callback);
+	e.strand = std::move(strand);
+
+	// round up so that a timer never fires early
+	std::uint64_t ticks = (delay.count() <= 0) ? 1 : (delay + resolution_ - clock::duration(1)) / resolution_;
+	e.expire_tick = std::max(current_tick_ + 1, now_tick() + ticks);
+	insert(index);
+	size_++;
+
+	if (!ticking_) {
+		arm();
+	}
+	return (static_cast<handle>(e.generation) << 32) | (index + 1);
+}
+
+bool net_timer_wheel::cancel(handle timer) {
+	// Returns true if the timer was removed before its callback was started.
+	std::scoped_lock lock(mutex_);
+	std::uint32_t index = static_cast<std::uint32_t>(timer & 0xffffffff) - 1;
+	std::uint32_t generation = static_cast<std::uint32_t>(timer >> 32);
+	if (timer == 0 || index >= entries_.size()) {
+		return false;
+	}
+	entry& e = entries_[index];
+	if (e.generation != generation || e.list == npos) {
+		return false;
+	}
+	unlink(index);
+	release(index);
+	return true;
+}
+
+void net_timer_wheel::set_resolution(clock::duration resolution) {
+	std::scoped_lock lock(mutex_);
+	if (size_ == 0 && resolution.count() > 0) {
+		resolution_ = resolution;
+		origin_ = clock::now();
+		current_tick_ = 0;
+	}
+}
+
+net_timer_wheel::clock::duration net_timer_wheel::resolution() {
+	std::scoped_lock lock(mutex_);
+	return resolution_;
+}
+
+std::size_t net_timer_wheel::size() {
+	std::scoped_lock lock(mutex_);
+	return size_;
+}
+
+void net_timer_wheel::shutdown() {
+	// Called when the io_context is being destroyed. The callbacks are dropped without being
+	// called, which also releases anything they were keeping alive.
+	std::scoped_lock lock(mutex_);
+	shutdown_ = true;
+	entries_.clear();
+	free_.clear();
+	size_ = 0;
+}
+
+void net_timer_wheel::insert(std::uint32_t index) {
+	// Precondition: mutex_ is held
+	// Picks the lowest level whose range covers the time left on the timer.
+	entry& e = entries_[index];
+	if (e.expire_tick <= current_tick_) {
+		// due already (this happens when a cascade moves a timer down on the tick it expires)
+		link(index, current_tick_ & (slots - 1));
+		return;
+	}
+	std::uint64_t diff = e.expire_tick - current_tick_;
+	for (int level = 0; level < levels; level++) {
+		std::uint64_t range = std::uint64_t(1) << (slot_bits * (level + 1));
+		if (diff < range) {
+			std::uint64_t slot = (e.expire_tick >> (slot_bits * level)) & (slots - 1);
+			link(index, level * slots + slot);
+			return;
+		}
+	}
+	// further away than the wheel can represent, so park it in the farthest slot.
+	// it gets cascaded down and reinserted from there with its real expiry
+	int level = levels - 1;
+	std::uint64_t farthest = current_tick_ + (std::uint64_t(1) << (slot_bits * levels)) - 1;
+	std::uint64_t slot = (farthest >> (slot_bits * level)) & (slots - 1);
+	link(index, level * slots + slot);
+}
+
+void net_timer_wheel::link(std::uint32_t index, std::uint32_t list) {
+	entry& e = entries_[index];
+	e.list = list;
+	e.prev = npos;
+	e.next = heads_[list];
+	if (e.next != npos) {
+		entries_[e.next].prev = index;
+	}
+	heads_[list] = index;
+}
+
+void net_timer_wheel::unlink(std::uint32_t index) {
+	entry& e = entries_[index];
+	if (e.prev != npos) {
+		entries_[e.prev].next = e.next;
+	} else {
+		heads_[e.list] = e.next;
+	}
+	if (e.next != npos) {
+		entries_[e.next].prev = e.prev;
+	}
+	e.list = npos;
+}
+
+void net_timer_wheel::release(std::uint32_t index) {
+	entry& e = entries_[index];
+	e.callback = nullptr;
+	e.strand.reset();
+	e.generation++;
+	e.list = npos;
+	free_.push_back(index);
+	size_--;
+}
+
+std::uint64_t net_timer_wheel::now_tick() {
+	return (clock::now() - origin_) / resolution_;
+}
+
+void net_timer_wheel::advance(std::vector<due_timer>& due) {
+	// Precondition: mutex_ is held
+	// Moves the wheel forward by one tick and collects the callbacks that are now due.
+	current_tick_++;
+	for (int level = 1; level < levels; level++) {
+		// a higher level only needs attention when every level below it has wrapped around
+		if (current_tick_ & ((std::uint64_t(1) << (slot_bits * level)) - 1)) {
+			break;
+		}
+		cascade(level);
+	}
+
+	std::uint32_t list = current_tick_ & (slots - 1);
+	std::uint32_t index = heads_[list];
+	heads_[list] = npos;
+	while (index != npos) {
+		std::uint32_t next = entries_[index].next;
+		entry& e = entries_[index];
+		e.list = npos;
+		if (e.expire_tick > current_tick_) {
+			insert(index);
+		} else {
+			due.push_back(due_timer{ std::move(e.callback), std::move(e.strand) });
+			release(index);
+		}
+		index = next;
+	}
+}
+
+void net_timer_wheel::cascade(int level) {
+	// Empties the current slot of a level back into the wheel. Everything in it expires within
+	// the range of the levels below, so each timer lands somewhere lower down.
+	std::uint32_t list = level * slots + ((current_tick_ >> (slot_bits * level)) & (slots - 1));
+	std::uint32_t index = heads_[list];
+	heads_[list] = npos;
+	while (index != npos) {
+		std::uint32_t next = entries_[index].next;
+		entries_[index].list = npos;
+		insert(index);
+		index = next;
+	}
+}
+
+void net_timer_wheel::arm() {
+	// Precondition: mutex_ is held
+	ticking_ = true;
+	tick_timer_.expires_at(origin_ + (current_tick_ + 1) * resolution_);
+	tick_timer_.async_wait([this](const boost::system::error_code& e) { handle_tick(e); });
+}
+
+void net_timer_wheel::handle_tick(const boost::system::error_code& e) {
+	// Catches the wheel up with the clock (more than one tick if the io_context was busy)
+	// and runs the callbacks that came due. The tick timer stops while the wheel is empty.
+	if (e == boost::asio::error::operation_aborted) {
+		return;
+	}
+	std::vector<due_timer> due;
+	{
+		std::scoped_lock lock(mutex_);
+		if (shutdown_) {
+			return;
+		}
+		std::uint64_t target = now_tick();
+		while (current_tick_ < target && size_ > 0) {
+			advance(due);
+		}
+		if (size_ > 0) {
+			arm();
+		} else {
+			ticking_ = false;
+		}
+	}
+	for (auto& timer : due) {
+		if (timer.strand) {
+			boost::asio::dispatch(*timer.strand, std::move(timer.callback));
+		} else {
+			timer.callback();
+		}
+	}
+}